@@ -22,6 +22,12 @@
   #define CTR 1
 #endif
 
+// AES_CONST_ROUNDKEY uses the pre-expanded key schedule in flash (aes_roundkey.h, generated by "hex_crypt -g")
+// instead of expanding the key into RAM at every bootloader entry.
+#ifndef AES_CONST_ROUNDKEY
+  #define AES_CONST_ROUNDKEY 1
+#endif
+
 
 //#define AES128 1
 //#define AES192 1
@@ -43,15 +49,25 @@
 
 struct AES_ctx
 {
+#if defined(AES_CONST_ROUNDKEY) && (AES_CONST_ROUNDKEY == 1)
+  const uint8_t* RoundKey;
+#else
   uint8_t RoundKey[AES_keyExpSize];
+#endif
 #if (defined(CBC) && (CBC == 1)) || (defined(CTR) && (CTR == 1))
   uint8_t Iv[AES_BLOCKLEN];
 #endif
 };
 
+#if defined(AES_CONST_ROUNDKEY) && (AES_CONST_ROUNDKEY == 1)
+void AES_init_ctx_roundkey(struct AES_ctx* ctx, const uint8_t* RoundKey);
+#else
 void AES_init_ctx(struct AES_ctx* ctx, const uint8_t* key);
 #if (defined(CBC) && (CBC == 1)) || (defined(CTR) && (CTR == 1))
 void AES_init_ctx_iv(struct AES_ctx* ctx, const uint8_t* key, const uint8_t* iv);
+#endif
+#endif
+#if (defined(CBC) && (CBC == 1)) || (defined(CTR) && (CTR == 1))
 void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv);
 #endif
 
@@ -85,6 +101,10 @@ void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
 //        no IV should ever be reused with the same key 
 void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
 
+// Encrypt one counter block in place, buf[AES_BLOCKLEN] holds the IV on entry and the keystream on return.
+// ctx->Iv is neither used nor modified, so it is safe to call while another context owns the IV.
+void AES_CTR_keystream(const struct AES_ctx* ctx, uint8_t* buf);
+
 #endif // #if defined(CTR) && (CTR == 1)
 
 
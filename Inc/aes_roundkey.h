@@ -0,0 +1,28 @@
+// Generated by hex_crypt -g, do not edit.
+// Pre-expanded AES key schedule of the key in crypt.c, placed in flash by the bootloader.
+
+#ifndef _AES_ROUNDKEY_H_
+#define _AES_ROUNDKEY_H_
+
+#include <stdint.h>
+#include "aes.h"
+
+static const uint8_t AES_ROUNDKEY[AES_keyExpSize] = {
+    0x29, 0x76, 0xDE, 0xF0, 0x2A, 0xF4, 0x4E, 0xD7, 0xBE, 0x87, 0x1E, 0xA9, 0xDA, 0xB2, 0x5B, 0x24,
+    0x3A, 0xCA, 0x66, 0x38, 0xA7, 0xF6, 0x44, 0x45, 0xB1, 0x2C, 0x5E, 0x86, 0xCB, 0x73, 0xBA, 0x2F,
+    0xA7, 0x82, 0xCB, 0xEF, 0x8D, 0x76, 0x85, 0x38, 0x33, 0xF1, 0x9B, 0x91, 0xE9, 0x43, 0xC0, 0xB5,
+    0x24, 0xD0, 0xDC, 0xED, 0x83, 0x26, 0x98, 0xA8, 0x32, 0x0A, 0xC6, 0x2E, 0xF9, 0x79, 0x7C, 0x01,
+    0x13, 0x92, 0xB7, 0x76, 0x9E, 0xE4, 0x32, 0x4E, 0xAD, 0x15, 0xA9, 0xDF, 0x44, 0x56, 0x69, 0x6A,
+    0x3F, 0x61, 0x25, 0xEF, 0xBC, 0x47, 0xBD, 0x47, 0x8E, 0x4D, 0x7B, 0x69, 0x77, 0x34, 0x07, 0x68,
+    0x0F, 0x57, 0xF2, 0x83, 0x91, 0xB3, 0xC0, 0xCD, 0x3C, 0xA6, 0x69, 0x12, 0x78, 0xF0, 0x00, 0x78,
+    0x83, 0xED, 0x46, 0x53, 0x3F, 0xAA, 0xFB, 0x14, 0xB1, 0xE7, 0x80, 0x7D, 0xC6, 0xD3, 0x87, 0x15,
+    0x61, 0x40, 0xAB, 0x37, 0xF0, 0xF3, 0x6B, 0xFA, 0xCC, 0x55, 0x02, 0xE8, 0xB4, 0xA5, 0x02, 0x90,
+    0x0E, 0xEB, 0x31, 0x33, 0x31, 0x41, 0xCA, 0x27, 0x80, 0xA6, 0x4A, 0x5A, 0x46, 0x75, 0xCD, 0x4F,
+    0xEC, 0xFD, 0x2F, 0x6D, 0x1C, 0x0E, 0x44, 0x97, 0xD0, 0x5B, 0x46, 0x7F, 0x64, 0xFE, 0x44, 0xEF,
+    0x4D, 0x50, 0x2A, 0xEC, 0x7C, 0x11, 0xE0, 0xCB, 0xFC, 0xB7, 0xAA, 0x91, 0xBA, 0xC2, 0x67, 0xDE,
+    0xE9, 0x78, 0x32, 0x99, 0xF5, 0x76, 0x76, 0x0E, 0x25, 0x2D, 0x30, 0x71, 0x41, 0xD3, 0x74, 0x9E,
+    0xCE, 0x36, 0xB8, 0xE7, 0xB2, 0x27, 0x58, 0x2C, 0x4E, 0x90, 0xF2, 0xBD, 0xF4, 0x52, 0x95, 0x63,
+    0xA9, 0x52, 0xC9, 0x26, 0x5C, 0x24, 0xBF, 0x28, 0x79, 0x09, 0x8F, 0x59, 0x38, 0xDA, 0xFB, 0xC7
+};
+
+#endif
@@ -0,0 +1,23 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _AES_TTABLE_H_
+#define _AES_TTABLE_H_
+
+#include <stdint.h>
+#include "aes.h"
+
+// Table driven AES encryption (one 1KB table, rotated per column), ~10x faster than the
+// byte oriented AES_CTR_keystream on the Cortex-M3. Same key schedule layout as aes.c.
+void aes_ttable_encrypt(const uint8_t *round_key, uint8_t *block);     // in place, AES_BLOCKLEN bytes
+
+#endif
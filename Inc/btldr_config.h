@@ -21,18 +21,89 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 // STM32F103CBT6 - 128KB Flash Size    
 #define DEV_FLASH_SIZE                      (128*1024)
 
+#define DEV_SRAM_SIZE                       (20*1024)
 
-#define APP_OFFSET                          0x4000
+#define APP_OFFSET                          0x6000              // 24KB bootloader, see STM32_MSD_BTLDR.sct
 #define APP_ADDR                            (FLASH_BASE + APP_OFFSET)
 #define APP_SIZE                            (DEV_FLASH_SIZE - APP_OFFSET)
 #define CRC_ADDR                            (FLASH_BASE + DEV_FLASH_SIZE - 4)	//Last 32bit block of Flash
-
-/* In general, CONFIG_READ_FLASH should be set to 0 if CONFIG_SUPPORT_CRYPT_MODE is 1 */
+#define APP_TOKEN_ADDR                      (CRC_ADDR - 4)                      //CRC verified token, not covered by the CRC32, see fast_boot.h
+
+/* Staging area for in-application updates (upper half of the appcode area), see btldr_services.h */
+#define STAGE_SIZE                          (APP_SIZE / 2)
+#define STAGE_ADDR                          (APP_ADDR + APP_SIZE - STAGE_SIZE)
+
+/* Run-from-RAM images: hex records in this window are loaded into SRAM and started without
+   touching the flash. The bootloader RAM ends at RAMAPP_ADDR, see RW_IRAM1 in STM32_MSD_BTLDR.sct */
+#define CONFIG_RAM_APP                      1u
+#define RAMAPP_ADDR                         (SRAM_BASE + 0x2800)                // VTOR needs 512 byte alignment
+#define RAMAPP_SIZE                         (SRAM_BASE + DEV_SRAM_SIZE - 0x30 - RAMAPP_ADDR)   // up to the mailbox
+
+/* Bootloader self-update: hex records below APP_ADDR are staged into the top 2*APP_OFFSET
+   bytes of flash (new image, backup of the running bootloader), then copied from RAM.
+   The staging area overlaps the appcode area, a file mixing bootloader and appcode records is rejected */
+#define CONFIG_SELF_UPDATE                  0u
+#define SELFUPDATE_NEW_ADDR                 (FLASH_BASE + DEV_FLASH_SIZE - 2*APP_OFFSET)
+#define SELFUPDATE_BACKUP_ADDR              (FLASH_BASE + DEV_FLASH_SIZE - APP_OFFSET)
+
+/* With CONFIG_SUPPORT_CRYPT_MODE set, CONFIG_READ_FLASH returns FIRMWARE.BIN encrypted with the keystream of
+   hex_crypt (CONFIG_READ_FLASH_CRYPT), "hex_crypt -r" decrypts it. Without it the plain appcode can be read */
 #define CONFIG_SUPPORT_CRYPT_MODE           1u
 
 #define CONFIG_READ_FLASH                   0u
+#define CONFIG_READ_FLASH_CRYPT             1u
+
+/* Table driven AES for the CTR keystream (1KB table in flash), fast enough to encrypt FIRMWARE.BIN at USB speed.
+   ~1.5KB of flash, set it together with CONFIG_READ_FLASH */
+#define CONFIG_CRYPT_TTABLE                 0u
 #define CONFIG_SOFT_RESET_AFTER_IHEX_EOF    1u
 
+/* Skip to the next "\n:" after a broken record instead of stopping, non hex sectors are ignored */
+#define CONFIG_IHEX_RESYNC                  1u
+
+/* Sector aligned hex files (hex_crypt -a): each sector starts with a 0F header record and holds whole records,
+   it is parsed from its first line whatever order the host writes the sectors in */
+#define CONFIG_IHEX_SECTOR_ALIGNED          1u
+
+/* Fingerprints (LBA, 32-bit hash) of the last data sectors written (power of 2, 12 bytes each, 0 = disable).
+   A sector written again with the same content is skipped, with other content it is parsed again */
+#define CONFIG_SECTOR_FP_NBR                16u
+
+/* Hex files decoded in one session (app.hex, calib.hex...), each one has its parser context (~300 bytes RAM).
+   The session is committed when all of them reached EOF and the host was idle for CONFIG_HEX_SESSION_IDLE_MS, or on eject */
+#define CONFIG_HEX_FILE_NBR                 3u
+#define CONFIG_HEX_SESSION_IDLE_MS          1000u
+
+/* Sink at the end of the firmware write path (pipeline.h). PIPE_SINK_VERIFY compares the records with the
+   flash, PIPE_SINK_NULL only decodes and decrypts to time the stages. Both stay in the bootloader after the
+   session so STATUS.TXT can be read */
+#define PIPE_SINK_FLASH                     0u
+#define PIPE_SINK_VERIFY                    1u
+#define PIPE_SINK_NULL                      2u
+#define CONFIG_PIPE_SINK                    PIPE_SINK_FLASH
+
+/* CRC32 of the decoded records in STATUS.TXT, software CRC (~40 cycles per byte) */
+#define CONFIG_PIPE_HASH                    0u
+
+/* UF2 files (one block per sector) are accepted on the drive besides intel hex */
+#define CONFIG_UF2                          1u
+
+/* Number of AES blocks of CTR keystream precomputed in the main loop (power of 2, 0 = disable) */
+#define CONFIG_CRYPT_KEYSTREAM_AHEAD        8u
+
+/* Second USB drive (LUN 1) mapped 1:1 onto the appcode area, for tools (dd). Reads follow CONFIG_READ_FLASH */
+#define CONFIG_RAW_LUN                      0u
+
+/* Export the bootloader counters in STATUS.TXT */
+#define CONFIG_STATUS_FILE                  1u
+
+/* Read-only PAGES.CRC: CRC32 of every appcode flash page, for host side sparse updates (tools/btldr-plan).
+   Like CONFIG_READ_FLASH it tells about the appcode content, keep 0 with encrypted images */
+#define CONFIG_PAGES_CRC_FILE               0u
+
+/* Decide and jump to the app from SystemInit(), before the clock, HAL and C runtime init */
+#define CONFIG_FAST_BOOT                    1u
+
 /* Options for Bootloader Activation */
 #define BTLDR_ACT_ButtonPress               1u
 #define BTLDR_ACT_NoAppExist                1u
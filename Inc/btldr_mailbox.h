@@ -0,0 +1,169 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _BTLDR_MAILBOX_H_
+#define _BTLDR_MAILBOX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * App <-> bootloader mailbox in the no-init RAM at the top of the 20KB SRAM.
+ *
+ * This header has no dependency on the bootloader sources, copy it into the application
+ * project as is. The application must keep the last 48 bytes of SRAM out of its own
+ * RW/ZI/stack regions.
+ *
+ * 'key' is the last word so it stays at 0x20004FFC, applications that only write
+ * BOOTKEY there keep working.
+ *
+ * Update request from the application:
+ *
+ *     btldr_mailbox_request_update(APP_ADDR, image_size, image_crc);
+ *     NVIC_SystemReset();
+ *
+ * The bootloader answers in 'result' before it starts the application again, see
+ * btldr_mailbox_get_result().
+ */
+
+#define BTLDR_MAILBOX_ADDR          0x20004FD0ul
+#define BTLDR_MAILBOX_MAGIC         0x424D4258ul    // "XBMB"
+#define BTLDR_MAILBOX_VERSION       2u
+
+#ifndef BOOTKEY
+  #define BOOTKEY                   0x12345678
+#endif
+
+typedef enum
+{
+    BTLDR_MB_ACTION_NONE = 0,
+    BTLDR_MB_ACTION_ENTER,          // stay in the bootloader, same as the plain BOOTKEY
+    BTLDR_MB_ACTION_UPDATE,         // image_addr/image_size/image_crc describe the incoming image
+    BTLDR_MB_ACTION_COMMIT,         // install the image staged at image_addr, see btldr_services.h
+}btldr_mb_action_t;
+
+typedef enum
+{
+    BTLDR_MB_RESULT_NONE = 0,
+    BTLDR_MB_RESULT_PENDING,        // request accepted, waiting for the hex file
+    BTLDR_MB_RESULT_UP_TO_DATE,     // flash already holds an image with image_crc, nothing written
+    BTLDR_MB_RESULT_DONE,           // image written, CRC of the region matches image_crc
+    BTLDR_MB_RESULT_CRC_MISMATCH,   // image written, CRC of the region is in result_crc
+    BTLDR_MB_RESULT_ERASE_FAILED,
+    BTLDR_MB_RESULT_INVALID_REQUEST,// region outside of the application area
+    BTLDR_MB_RESULT_RESTORED,       // bootloader self-update failed, the previous bootloader was written back
+    BTLDR_MB_RESULT_MIXED_IMAGE,    // bootloader and appcode records in one session, nothing installed
+}btldr_mb_result_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t action;                // btldr_mb_action_t
+    uint32_t image_addr;            // absolute flash address of the image
+    uint32_t image_size;            // in bytes
+    uint32_t image_crc;             // crc32 of [image_addr, image_addr+image_size), see btldr_mailbox_crc32(), APP_TOKEN_ADDR as 0xFF
+    uint32_t result;                // btldr_mb_result_t, written by the bootloader
+    uint32_t result_crc;            // crc32 of the region computed by the bootloader
+    uint32_t boot_us;               // reset to application jump, written by the bootloader at every jump
+    uint32_t btldr_update_result;   // btldr_mb_result_t of the last bootloader self-update
+    uint32_t btldr_update_us;       // bootloader flash pages erased -> programmed and verified
+    uint32_t reserved;
+    uint32_t key;                   // BOOTKEY
+}btldr_mailbox_t;
+
+#define BTLDR_MAILBOX               ((volatile btldr_mailbox_t*)BTLDR_MAILBOX_ADDR)
+
+//-------------------------------------------------------
+
+static inline bool btldr_mailbox_is_valid(const volatile btldr_mailbox_t *mb)
+{
+    return (mb->magic == BTLDR_MAILBOX_MAGIC) && (mb->version == BTLDR_MAILBOX_VERSION);
+}
+
+static inline void btldr_mailbox_request_enter(void)
+{
+    volatile btldr_mailbox_t *mb = BTLDR_MAILBOX;
+    
+    mb->magic = BTLDR_MAILBOX_MAGIC;
+    mb->version = BTLDR_MAILBOX_VERSION;
+    mb->action = BTLDR_MB_ACTION_ENTER;
+    mb->result = BTLDR_MB_RESULT_NONE;
+    mb->key = BOOTKEY;
+}
+
+static inline void btldr_mailbox_request(btldr_mb_action_t action, uint32_t image_addr, uint32_t image_size, uint32_t image_crc)
+{
+    volatile btldr_mailbox_t *mb = BTLDR_MAILBOX;
+    
+    mb->magic = BTLDR_MAILBOX_MAGIC;
+    mb->version = BTLDR_MAILBOX_VERSION;
+    mb->action = action;
+    mb->image_addr = image_addr;
+    mb->image_size = image_size;
+    mb->image_crc = image_crc;
+    mb->result = BTLDR_MB_RESULT_NONE;
+    mb->result_crc = 0;
+    mb->key = BOOTKEY;
+}
+
+static inline void btldr_mailbox_request_update(uint32_t image_addr, uint32_t image_size, uint32_t image_crc)
+{
+    btldr_mailbox_request(BTLDR_MB_ACTION_UPDATE, image_addr, image_size, image_crc);
+}
+
+// Returns BTLDR_MB_RESULT_NONE if the bootloader did not leave an answer
+static inline btldr_mb_result_t btldr_mailbox_get_result(void)
+{
+    volatile btldr_mailbox_t *mb = BTLDR_MAILBOX;
+    
+    if(!btldr_mailbox_is_valid(mb))
+    {
+        return BTLDR_MB_RESULT_NONE;
+    }
+    return (btldr_mb_result_t)mb->result;
+}
+
+// Valid right after the jump, independent of the magic
+static inline uint32_t btldr_mailbox_get_boot_us(void)
+{
+    return BTLDR_MAILBOX->boot_us;
+}
+
+static inline void btldr_mailbox_clear(void)
+{
+    volatile btldr_mailbox_t *mb = BTLDR_MAILBOX;
+    
+    mb->magic = 0;
+    mb->key = 0;
+}
+
+// Same value as crc32_calculate() in the bootloader (crc32 with the bytes of the result swapped)
+static inline uint32_t btldr_mailbox_crc32(const uint8_t *data, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFFul;
+    uint8_t j;
+    
+    while(len--)
+    {
+        crc ^= *data++;
+        for(j=0; j<8; j++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320ul) : (crc >> 1);
+        }
+    }
+    crc ^= 0xFFFFFFFFul;
+    
+    return ((crc & 0x000000FF) << 24) | ((crc & 0x0000FF00) << 8) | ((crc & 0x00FF0000) >> 8) | ((crc & 0xFF000000) >> 24);
+}
+
+#endif
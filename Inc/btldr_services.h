@@ -0,0 +1,103 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _BTLDR_SERVICES_H_
+#define _BTLDR_SERVICES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "btldr_mailbox.h"
+#include "flash_sink.h"
+#include "ihex_parser.h"
+
+/*
+ * Function table exported by the bootloader at a fixed flash address, so an application
+ * receiving an update over UART/CAN/radio reuses the bootloader's flash, hex/UF2, decrypt
+ * and CRC code. None of the functions touch the bootloader's RAM, every state is passed in
+ * by the caller.
+ *
+ * The running application is never written. The new image (linked for APP_ADDR) is
+ * staged into the upper half of the appcode area, the bootloader installs it at the
+ * next reset:
+ *
+ *     const btldr_services_t *svc = BTLDR_SERVICES;
+ *     flash_sink_t sink;
+ *
+ *     svc->stage_open(&sink, image_size);
+ *     ...  svc->stage_write(&sink, addr, buf, size);    // addr as linked, e.g. from the hex callback
+ *     if(svc->app_validate(svc->stage_addr, image_size)) {
+ *         btldr_stage_commit(image_size, image_crc);
+ *         NVIC_SystemReset();
+ *     }
+ *
+ * The result is reported with btldr_mailbox_get_result(). The application must be smaller
+ * than stage_size.
+ *
+ * Entries are only appended, check 'size' before using an entry added in a later version.
+ */
+
+#define BTLDR_SERVICES_ADDR         0x08005F80ul    // see STM32_MSD_BTLDR.sct
+#define BTLDR_SERVICES_MAGIC        0x56534258ul    // "XBSV"
+#define BTLDR_SERVICES_VERSION      4u              // 2: ihex_ctx_t resync counters, 3: flash_sink_t same/conflict counters,
+                                                    // 4: flash_sink_t all-ones counter, ihex_ctx_t sector aligned flag
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;                  // sizeof(btldr_services_t) of the bootloader
+    uint32_t app_addr;
+    uint32_t stage_addr;
+    uint32_t stage_size;
+    
+    // staging flash sink, addr is the final address of the image (APP_ADDR based)
+    bool (*stage_open)(flash_sink_t *s, uint32_t image_size);
+    bool (*stage_write)(flash_sink_t *s, uint32_t addr, const uint8_t *buf, uint32_t size);
+    
+    // stream decoders, they call back with (addr, data, size)
+    void (*ihex_init)(ihex_ctx_t *ctx, ihex_callback_fp fp);
+    bool (*ihex_parse)(ihex_ctx_t *ctx, const uint8_t *buf, uint32_t size);
+    bool (*uf2_decode)(const uint8_t *block, ihex_callback_fp fp);
+    
+    // AES-CTR of the crypt mode (0 if the bootloader is built without it)
+    void (*ctr_xcrypt)(uint8_t *buf, uint32_t size, uint32_t addr);
+    
+    // crc32_update(0, ...) then the byte order of crc32_calculate: btldr_mailbox_crc32()
+    uint32_t (*crc32_update)(uint32_t crc, const unsigned char *data, size_t len);
+    
+    // vector table check of an image linked for APP_ADDR, located at addr
+    bool (*app_validate)(uint32_t addr, uint32_t size);
+}btldr_services_t;
+
+#define BTLDR_SERVICES              ((const btldr_services_t*)BTLDR_SERVICES_ADDR)
+
+static inline bool btldr_services_available(void)
+{
+    return (BTLDR_SERVICES->magic == BTLDR_SERVICES_MAGIC) && (BTLDR_SERVICES->version >= BTLDR_SERVICES_VERSION);
+}
+
+// image_crc is the crc32 of the staged image as computed by btldr_mailbox_crc32()
+static inline void btldr_stage_commit(uint32_t image_size, uint32_t image_crc)
+{
+    btldr_mailbox_request(BTLDR_MB_ACTION_COMMIT, BTLDR_SERVICES->stage_addr, image_size, image_crc);
+}
+
+//-------------------------------------------------------
+// Bootloader side
+
+bool btldr_stage_open(flash_sink_t *s, uint32_t image_size);
+bool btldr_stage_write(flash_sink_t *s, uint32_t addr, const uint8_t *buf, uint32_t size);
+bool btldr_app_validate(uint32_t addr, uint32_t size);
+bool btldr_stage_install(flash_sink_t *s, uint32_t image_size);
+
+#endif
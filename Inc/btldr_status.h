@@ -0,0 +1,47 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _BTLDR_STATUS_H_
+#define _BTLDR_STATUS_H_
+
+#include <stdint.h>
+#include "btldr_config.h"
+
+#if (CONFIG_STATUS_FILE > 0u)
+    #define STATUS_CYCCNT()     (DWT->CYCCNT)
+#else
+    #define STATUS_CYCCNT()     0u
+#endif
+
+// Startup milestones, the DWT cycle count of the first occurrence is kept
+typedef enum
+{
+    STATUS_TS_HAL_INIT = 0,
+    STATUS_TS_CLOCK,                    // PLL locked, 8MHz HSI before, 48MHz after
+    STATUS_TS_GPIO,
+    STATUS_TS_USB_START,                // USB peripheral started, the host sees the device
+    STATUS_TS_DEFERRED_INIT,            // crypt_init and other work moved behind the USB start
+    STATUS_TS_USB_RESET,
+    STATUS_TS_READ_CAPACITY,
+    STATUS_TS_BOOT_SECTOR,
+    STATUS_TS_ROOT_DIR,                 // first read of the root directory, the volume is mounted
+    STATUS_TS_NBR
+}status_ts_t;
+
+void status_init(void);                 // start the DWT cycle counter, called from SystemInit()
+void status_timestamp(status_ts_t ts);
+uint32_t status_elapsed_us(void);       // since reset, valid after the C runtime init
+#define STATUS_FILE_SIZE        1024
+
+void status_render(uint8_t *b, uint32_t offset);   // render the sector of STATUS.TXT at offset
+
+#endif
@@ -6,4 +6,12 @@
  */
 uint32_t crc32_calculate(const unsigned char *data, size_t len);
 
+/*
+ * Incremental CRC32 in software (no CRC peripheral state, usable from the application).
+ * Start with crc = 0, feed the chunks in order:
+ *   crc32_calculate(data, len) == crc32_finish(crc32_update(0, data, len))
+ */
+uint32_t crc32_update(uint32_t crc, const unsigned char *data, size_t len);
+uint32_t crc32_finish(uint32_t crc);
+
 #endif
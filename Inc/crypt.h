@@ -16,9 +16,21 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include <stdint.h>
 #include "aes.h"
 
+typedef struct
+{
+    uint32_t ks_hit;            // blocks decrypted from the precomputed keystream
+    uint32_t ks_miss;           // blocks decrypted synchronously
+    uint32_t ks_hit_cycles;     // total cycles spent in crypt_decrypt for hits
+    uint32_t ks_miss_cycles;    // total cycles spent in crypt_decrypt for misses
+}crypt_stats_t;
+
 void crypt_init(void);
 void crypt_encrypt(uint8_t *buf, uint32_t size, uint32_t addr);
 void crypt_decrypt(uint8_t *buf, uint32_t size, uint32_t addr);
+void crypt_keystream_fill(void);                    // call from main loop, precompute keystream of the next blocks
+const crypt_stats_t *crypt_get_stats(void);
+void crypt_xcrypt(uint8_t *buf, uint32_t size, uint32_t addr);   // no global state, encrypt = decrypt, addr 16 byte aligned
+void crypt_readback(uint8_t *buf, uint32_t size, uint32_t addr); // size multiple of 16, addr 16 byte aligned
 
 
 #endif
@@ -0,0 +1,29 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _FAST_BOOT_H_
+#define _FAST_BOOT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "btldr_config.h"
+
+// Called from SystemInit(), before the C runtime init. Jumps to the application if no
+// bootloader entry condition applies, returns otherwise.
+void fast_boot(void);
+
+// "CRC verified" token next to the CRC32 of the application (BTLDR_ACT_CksNotVld)
+bool app_token_valid(void);
+void app_token_set(void);
+void app_token_clear(void);             // flash_sink calls it before the first erase or program
+
+#endif
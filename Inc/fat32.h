@@ -15,8 +15,40 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "flash_sink.h"
+
+typedef struct
+{
+    uint32_t files;             // hex files seen in this session
+    uint32_t files_done;        // files with their EOF record
+    uint32_t rejected;          // files beyond CONFIG_HEX_FILE_NBR, not parsed, the session fails
+    uint32_t failed;            // a valid record could not be programmed
+    uint32_t skipped_bytes;
+    uint32_t records_dropped;
+    uint32_t quarantined;       // written sectors that are not hex
+    uint32_t sectors_duplicate; // same content written again to a sector, skipped
+    uint32_t sectors_rewritten; // other content written to a sector, parsed again
+}fat32_hex_stats_t;
+
+typedef struct
+{
+    uint32_t sectors;           // FIRMWARE.BIN sectors read
+    uint32_t cycles;            // copy (and encryption) of these sectors
+    uint32_t run_sectors;       // longest sequential read
+    uint32_t run_ms;
+}fat32_readback_stats_t;
 
 bool fat32_read(uint8_t *b, uint32_t addr);
 bool fat32_write(const uint8_t *b, uint32_t addr);
 
+void fat32_set_erase_region(uint32_t addr, uint32_t size);
+bool fat32_pre_erase_page(uint32_t addr);
+const flash_sink_t *fat32_get_flash_stats(void);
+void fat32_get_hex_stats(fat32_hex_stats_t *st);
+
+bool fat32_is_crypt_mode(void);
+bool fat32_session_is_done(void);       // commit: all hex files complete, or ejected, and none failed
+void fat32_eject(void);
+const fat32_readback_stats_t *fat32_get_readback_stats(void);     // CONFIG_READ_FLASH
+
 #endif
@@ -0,0 +1,30 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _FLASH_LL_H_
+#define _FLASH_LL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "btldr_config.h"
+
+// Register level flash routines. No HAL state, no SysTick timeout, so they can also be
+// called from the USB interrupt and from the application (service table). They stay in
+// flash: the application owns the RAM once it runs. The self-update copier has its own
+// RAM copy (selfupdate.c).
+
+bool flash_ll_unlock(void);
+void flash_ll_lock(void);
+bool flash_ll_erase_page(uint32_t addr);
+bool flash_ll_program_halfword(uint32_t addr, uint16_t value);
+
+#endif
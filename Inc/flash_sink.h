@@ -0,0 +1,43 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _FLASH_SINK_H_
+#define _FLASH_SINK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "btldr_config.h"
+
+#define FLASH_SINK_PAGE_SIZE        0x400u
+#define FLASH_SINK_PAGE_NBR         (DEV_FLASH_SIZE / FLASH_SINK_PAGE_SIZE)
+
+typedef struct
+{
+    uint32_t erased[(FLASH_SINK_PAGE_NBR + 31) / 32];   // pages erased in this session
+    
+    uint32_t page_erase;            // number of page erase operations
+    uint32_t page_erase_skip;       // erase requests for pages already erased
+    uint32_t page_erase_err;
+    uint32_t prog_halfword;
+    uint32_t prog_err;
+    uint32_t prog_same;             // half-words already holding the value, not programmed again
+    uint32_t prog_conflict;         // half-words already programmed with another value, the write fails
+    uint32_t prog_ones;             // all-ones half-words on erased cells, not programmed
+}flash_sink_t;
+
+void flash_sink_init(flash_sink_t *s);
+bool flash_sink_is_erased(const flash_sink_t *s, uint32_t addr);
+bool flash_sink_erase(flash_sink_t *s, uint32_t addr, uint32_t size);
+bool flash_sink_write(flash_sink_t *s, uint32_t addr, const uint8_t *buf, uint32_t size);
+bool flash_sink_program_page(flash_sink_t *s, uint32_t addr, const uint8_t *buf);   // FLASH_SINK_PAGE_SIZE bytes
+
+#endif
@@ -25,10 +25,37 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEAL
 
 typedef bool(*ihex_callback_fp)(uint32_t addr, const uint8_t *buf, uint8_t bufsize);
 
-void ihex_reset_state(void);                        // reset state machines, callback function is kept
-bool ihex_parser(const uint8_t *steambuf, uint32_t size);
-void ihex_set_callback_func(ihex_callback_fp fp);   // Callback function will be triggered at the end of recordtype 'Data'
-bool ihex_is_crypt_mode(void);                      // extend the ihex record type, if RECORD_TYPE_CRYPT_MODE (0x0E) is found, return true
-bool ihex_is_eof(void);
+#define IHEX_DATA_SIZE          255         // largest byte_count, no length check needed
+
+typedef struct
+{
+    uint8_t state;
+    uint8_t byte_count;
+    uint16_t address_lo;
+    uint16_t address_hi;
+    bool ex_segment_addr_mode;
+    uint8_t record_type;
+    uint8_t data[IHEX_DATA_SIZE];
+    uint16_t data_size_in_nibble;
+    
+    uint8_t temp_cs;            // save checksum high byte
+    uint8_t calc_cs;            // calculate checksum
+    bool calc_cs_toogle;
+    
+    ihex_callback_fp callback_fp;
+    bool crypt_mode;            // extend the intex hex file format to support encryption
+    bool eof;
+    bool aligned;               // 0F sector header seen, every sector holds whole records
+    
+    bool resync;                // CONFIG_IHEX_RESYNC, skip broken records instead of failing
+    bool failed;                // the callback rejected a valid data record, the stream is dropped
+    uint32_t skipped_bytes;     // bytes discarded while looking for the next record
+    uint32_t resync_nbr;        // broken records
+}ihex_ctx_t;
+
+// Context based parser, several streams can be decoded at the same time
+void ihex_ctx_init(ihex_ctx_t *ctx, ihex_callback_fp fp);
+bool ihex_ctx_parse(ihex_ctx_t *ctx, const uint8_t *steambuf, uint32_t size);
+void ihex_ctx_rewind(ihex_ctx_t *ctx, bool line_start);     // the next data replaces data already parsed
 
 #endif
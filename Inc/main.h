@@ -42,7 +42,7 @@ extern "C" {
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include <stdbool.h>
 /* USER CODE END Includes */
 
 /* Exported types ------------------------------------------------------------*/
@@ -64,6 +64,11 @@ extern "C" {
 void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
+bool is_appcode_exist(void);
+bool app_cks_valid(void);
+bool bootkey_detected(void);
+void jump_to_app(void);
+void jump_to_image(uint32_t vector);
 
 /* USER CODE END EFP */
 
@@ -0,0 +1,89 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "btldr_config.h"
+
+/*
+ * Firmware write path, assembled at compile time from const stage tables (no allocation):
+ *
+ *   decoder (hex, UF2) -> transforms (CTR decrypt, CRC32) -> sink picked by address
+ *                                                            (bootloader, RAM, appcode, verify, null)
+ *
+ * A decoder turns the sectors of a file into records {addr, buf, size} and hands them to
+ * pipe_push(). The transforms run in table order on the record, the record then goes to the
+ * first sink whose window holds it. Records outside every window are dropped.
+ * Every stage counts its records, bytes and its own DWT cycles, see STATUS.TXT.
+ */
+
+typedef struct
+{
+    uint32_t records;
+    uint32_t bytes;
+    uint32_t cycles;            // spent in the stage itself, without the stages after it
+    uint32_t errors;            // rejected records, verify mismatches
+}pipe_stats_t;
+
+typedef struct
+{
+    bool (*decode)(void *ctx, const uint8_t *b, uint32_t size);        // pipe_push() per record
+    pipe_stats_t *stats;
+}pipe_decoder_t;
+
+typedef struct
+{
+    bool (*apply)(uint32_t addr, const uint8_t *buf, uint32_t size);   // may modify buf in place
+    pipe_stats_t *stats;
+}pipe_transform_t;
+
+typedef struct
+{
+    uint32_t base;              // address window of the sink
+    uint32_t size;
+    bool (*write)(uint32_t addr, const uint8_t *buf, uint32_t size);
+    pipe_stats_t *stats;
+}pipe_sink_t;
+
+typedef struct
+{
+    const pipe_transform_t * const *transforms;
+    uint8_t transform_nbr;
+    const pipe_sink_t * const *sinks;
+    uint8_t sink_nbr;
+}pipe_t;
+
+#define PIPE_NBR(a)             ((uint8_t)(sizeof(a) / sizeof((a)[0])))
+
+bool pipe_decode(const pipe_decoder_t *d, void *ctx, const uint8_t *b, uint32_t size);
+bool pipe_push(const pipe_t *p, uint32_t addr, const uint8_t *buf, uint32_t size);
+
+// Stage statistics, summed over the stages of the same kind
+extern pipe_stats_t pipe_stats_decode;
+extern pipe_stats_t pipe_stats_transform;
+extern pipe_stats_t pipe_stats_sink;
+extern pipe_stats_t pipe_stats_dropped;
+
+// Shared stages, the flash, RAM and bootloader sinks are in fat32.c
+extern const pipe_decoder_t pipe_hex_decoder;           // ctx: ihex_ctx_t
+extern const pipe_decoder_t pipe_uf2_decoder;           // ctx: const pipe_t, one block per call
+extern const pipe_transform_t pipe_decrypt;             // AES-CTR of the crypt mode, 16 byte records
+extern const pipe_transform_t pipe_crc32;               // CRC32 of the records in arrival order
+extern const pipe_sink_t pipe_verify_sink;              // compare with the flash, nothing is written
+extern const pipe_sink_t pipe_null_sink;                // accepts everything
+
+uint32_t pipe_crc32_value(void);
+
+#endif
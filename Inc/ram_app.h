@@ -0,0 +1,33 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _RAM_APP_H_
+#define _RAM_APP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "btldr_config.h"
+
+/*
+ * Test firmware linked for SRAM: IROM at RAMAPP_ADDR (vector table first), size up to
+ * RAMAPP_SIZE. Its RW/ZI data and stack may use the whole SRAM except the mailbox, the
+ * bootloader RAM is not used anymore once the image runs. The flash is not touched, the
+ * next reset starts the appcode in flash again.
+ */
+
+#define RAM_APP_IN_WINDOW(addr, size)   (((addr) >= RAMAPP_ADDR) && (((addr) + (size)) <= (RAMAPP_ADDR + RAMAPP_SIZE)))
+
+bool ram_app_write(uint32_t addr, const uint8_t *buf, uint32_t size);
+bool ram_app_pending(void);
+void ram_app_run(void);         // jumps to the image if its vector table is valid
+
+#endif
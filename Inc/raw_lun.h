@@ -0,0 +1,32 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _RAW_LUN_H_
+#define _RAW_LUN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "btldr_config.h"
+#include "flash_sink.h"
+
+// LUN 1: LBA n = APP_ADDR + n * 512, no file system
+
+#define RAW_LUN_BLK_SIZE        512
+#define RAW_LUN_BLK_NBR         (APP_SIZE / RAW_LUN_BLK_SIZE)
+
+bool raw_lun_read(uint8_t *b, uint32_t lba);
+bool raw_lun_write(const uint8_t *b, uint32_t lba);
+bool raw_lun_flush(void);               // SYNCHRONIZE CACHE, eject: false if a page was lost since the last call
+void raw_lun_poll(void);                // main loop, writes back the page buffer when the host is idle
+const flash_sink_t *raw_lun_get_flash_stats(void);
+
+#endif
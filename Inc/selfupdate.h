@@ -0,0 +1,41 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _SELFUPDATE_H_
+#define _SELFUPDATE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "btldr_config.h"
+
+/*
+ * Bootloader self-update through the USB drive: a hex file with records in
+ * [FLASH_BASE, APP_ADDR) is a new bootloader. It is staged at SELFUPDATE_NEW_ADDR and
+ * accepted if
+ *   - the CRC32 of [0, APP_OFFSET-4) matches its last word (srec_cat -CRC32_Big_Endian,
+ *     same as the appcode CRC32),
+ *   - the vector table points into the bootloader area,
+ *   - the service table magic is at BTLDR_SERVICES_ADDR.
+ * The running bootloader is copied to SELFUPDATE_BACKUP_ADDR, then a copier in RAM
+ * rewrites the bootloader pages with readback verification and retries. If a page still
+ * fails, the backup is written back.
+ * Bootloader and appcode records in the same session (e.g. a merged image) are rejected:
+ * the staging area is the top of the appcode area. The stream fails, nothing is installed
+ * and the result is BTLDR_MB_RESULT_MIXED_IMAGE.
+ */
+
+bool selfupdate_write(uint32_t addr, const uint8_t *buf, uint32_t size);
+bool selfupdate_pending(void);
+void selfupdate_reject(void);   // appcode records after the bootloader records
+void selfupdate_run(void);   // resets the MCU if the image was installed
+
+#endif
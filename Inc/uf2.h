@@ -0,0 +1,44 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _UF2_H_
+#define _UF2_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ihex_parser.h"
+
+// https://github.com/microsoft/uf2, one 512 byte block per sector
+#define UF2_BLOCK_SIZE          512
+#define UF2_MAGIC_START0        0x0A324655ul
+#define UF2_MAGIC_START1        0x9E5D5157ul
+#define UF2_MAGIC_END           0x0AB16F30ul
+#define UF2_FLAG_NOT_MAIN_FLASH 0x00000001ul
+
+typedef struct
+{
+    uint32_t magicStart0;
+    uint32_t magicStart1;
+    uint32_t flags;
+    uint32_t targetAddr;
+    uint32_t payloadSize;
+    uint32_t blockNo;
+    uint32_t numBlocks;
+    uint32_t fileSize;          // or familyID
+    uint8_t data[476];
+    uint32_t magicEnd;
+}uf2_block_t;
+
+bool uf2_is_block(const uint8_t *block);
+bool uf2_block_decode(const uint8_t *block, ihex_callback_fp fp);    // same callback as the hex parser
+
+#endif
@@ -76,6 +76,15 @@
 #define USBD_SELF_POWERED     1
 /*---------- -----------*/
 #define MSC_MEDIA_PACKET     512
+/*---------- -----------*/
+/* A failed command with a data stage up to this length pads the IN data or drains the OUT data
+   and reports CHECK CONDITION in the CSW. Longer ones stall the endpoint and cost the host a
+   clear-halt (~1ms), padding costs ~1ms per 1.2KB at full speed (0 = always stall) */
+#define MSC_BOT_PAD_MAX     0x1000
+/*---------- -----------*/
+/* READ10: the main loop prepares the next sector in a second buffer (+512 bytes RAM) while the
+   current one is sent, usb_device_poll() has to be called from the main loop (0 = disable) */
+#define MSC_READ_AHEAD     1
 
 /****************************************/
 /* #define for FS and HS identification */
@@ -79,6 +79,9 @@ typedef struct _USBD_STORAGE
   int8_t (* Write)(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
   int8_t (* GetMaxLun)(void);
   int8_t *pInquiry;
+  int8_t (* IsWriteCached)(uint8_t lun);  /* 1: writes are buffered, reported as WCE */
+  int8_t (* SyncCache)(uint8_t lun);      /* write back the buffered data */
+  int8_t (* Eject)(uint8_t lun);          /* START STOP UNIT, LOEJ=1 START=0 */
   
 }USBD_StorageTypeDef;
 
@@ -103,6 +106,17 @@ typedef struct
   
   uint32_t                 scsi_blk_addr;
   uint32_t                 scsi_blk_len;
+  
+  uint32_t                 bot_pad_len;     /* bytes left to pad/drain after a failed command */
+  
+#if (MSC_READ_AHEAD > 0)
+  uint8_t                  ra_data[MSC_MEDIA_PACKET];   /* next READ10 sector, written by the main loop */
+  volatile uint8_t         ra_state;
+  volatile uint8_t         ra_wait;         /* DataIn waits for the sector being prepared */
+  uint8_t                  ra_lun;
+  uint16_t                 ra_blk_len;
+  uint32_t                 ra_blk_addr;
+#endif
 }
 USBD_MSC_BOT_HandleTypeDef; 
 
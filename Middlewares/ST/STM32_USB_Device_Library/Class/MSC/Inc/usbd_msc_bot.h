@@ -55,6 +55,9 @@
 #define USBD_BOT_LAST_DATA_IN              3       /* Last Data In Last */
 #define USBD_BOT_SEND_DATA                 4       /* Send Immediate data */
 #define USBD_BOT_NO_DATA                   5       /* No data Stage */
+#define USBD_BOT_PAD_IN                    6       /* Failed cmd, zeros sent up to dDataLength */
+#define USBD_BOT_DRAIN_OUT                 7       /* Failed cmd, data received and dropped */
+#define USBD_BOT_PHASE_ERROR               8       /* Failed cmd, direction mismatch: stall */
 
 #define USBD_BOT_CBW_SIGNATURE             0x43425355
 #define USBD_BOT_CSW_SIGNATURE             0x53425355
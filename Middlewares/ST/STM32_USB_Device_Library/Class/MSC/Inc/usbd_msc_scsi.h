@@ -79,6 +79,7 @@
 #define SCSI_VERIFY12                               0xAF
 #define SCSI_VERIFY16                               0x8F
 
+#define SCSI_SYNCHRONIZE_CACHE10                    0x35
 #define SCSI_SEND_DIAGNOSTIC                        0x1D
 #define SCSI_READ_FORMAT_CAPACITIES                 0x23
 
@@ -113,6 +114,11 @@
 #define READ_CAPACITY10_DATA_LEN                    0x08
 #define MODE_SENSE10_DATA_LEN                       0x08
 #define MODE_SENSE6_DATA_LEN                        0x04
+
+#define MODE_PAGE_CACHING                           0x08
+#define MODE_PAGE_CACHING_LEN                       0x14
+#define MODE_PAGE_CACHING_WCE                       0x04
+#define MODE_PAGE_ALL                               0x3F
 #define REQUEST_SENSE_DATA_LEN                      0x12
 #define STANDARD_INQUIRY_DATA_LEN                   0x24
 #define BLKVFY                                      0x04
@@ -176,6 +182,12 @@ void   SCSI_SenseCode(USBD_HandleTypeDef  *pdev,
                       uint8_t sKey, 
                       uint8_t ASC);
 
+#if (MSC_READ_AHEAD > 0)
+void   SCSI_ReadAhead(USBD_HandleTypeDef  *pdev);
+
+void   SCSI_ReadAheadCancel(USBD_HandleTypeDef  *pdev);
+#endif
+
 /**
   * @}
   */ 
@@ -85,6 +85,10 @@ static void MSC_BOT_SendData (USBD_HandleTypeDef  *pdev,
                               uint16_t len);
 
 static void MSC_BOT_Abort(USBD_HandleTypeDef  *pdev);
+
+static void MSC_BOT_Fail(USBD_HandleTypeDef  *pdev);
+
+static void MSC_BOT_Pad(USBD_HandleTypeDef  *pdev);
 /**
   * @}
   */ 
@@ -111,6 +115,9 @@ void MSC_BOT_Init (USBD_HandleTypeDef  *pdev)
   
   hmsc->scsi_sense_tail = 0;
   hmsc->scsi_sense_head = 0;
+#if (MSC_READ_AHEAD > 0)
+  SCSI_ReadAheadCancel(pdev);
+#endif
   
   ((USBD_StorageTypeDef *)pdev->pUserData)->Init(0);
   
@@ -136,6 +143,9 @@ void MSC_BOT_Reset (USBD_HandleTypeDef  *pdev)
     
   hmsc->bot_state  = USBD_BOT_IDLE;
   hmsc->bot_status = USBD_BOT_STATUS_RECOVERY;  
+#if (MSC_READ_AHEAD > 0)
+  SCSI_ReadAheadCancel(pdev);
+#endif
   
   /* Prapare EP to Receive First BOT Cmd */
   USBD_LL_PrepareReceive (pdev,
@@ -154,6 +164,9 @@ void MSC_BOT_DeInit (USBD_HandleTypeDef  *pdev)
 {
   USBD_MSC_BOT_HandleTypeDef  *hmsc = (USBD_MSC_BOT_HandleTypeDef*)pdev->pClassData;  
   hmsc->bot_state  = USBD_BOT_IDLE;
+#if (MSC_READ_AHEAD > 0)
+  SCSI_ReadAheadCancel(pdev);
+#endif
 }
 
 /**
@@ -174,6 +187,17 @@ void MSC_BOT_DataIn (USBD_HandleTypeDef  *pdev,
     if(SCSI_ProcessCmd(pdev,
                         hmsc->cbw.bLUN,
                         &hmsc->cbw.CB[0]) < 0)
+    {
+      MSC_BOT_Fail(pdev);
+    }
+    break;
+    
+  case USBD_BOT_PAD_IN:
+    if (hmsc->bot_pad_len > 0)
+    {
+      MSC_BOT_Pad(pdev);
+    }
+    else
     {
       MSC_BOT_SendCSW (pdev, USBD_CSW_CMD_FAILED);
     }
@@ -213,11 +237,33 @@ void MSC_BOT_DataOut (USBD_HandleTypeDef  *pdev,
                         hmsc->cbw.bLUN,
                         &hmsc->cbw.CB[0]) < 0)
     {
-      MSC_BOT_SendCSW (pdev, USBD_CSW_CMD_FAILED);
+      MSC_BOT_Fail(pdev);
     }
 
     break;
     
+  case USBD_BOT_DRAIN_OUT:
+    {
+      uint32_t len = MIN (hmsc->bot_pad_len, MSC_MEDIA_PACKET);
+      uint32_t rx = USBD_LL_GetRxDataSize (pdev, MSC_EPOUT_ADDR);
+      
+      hmsc->bot_pad_len -= MIN (rx, len);
+      
+      /* a short packet ends the data stage early */
+      if ((hmsc->bot_pad_len == 0) || (rx < len))
+      {
+        MSC_BOT_SendCSW (pdev, USBD_CSW_CMD_FAILED);
+      }
+      else
+      {
+        USBD_LL_PrepareReceive (pdev,
+                                MSC_EPOUT_ADDR,
+                                hmsc->bot_data,
+                                MIN (hmsc->bot_pad_len, MSC_MEDIA_PACKET));
+      }
+    }
+    break;
+    
   default:
     break;
   }
@@ -254,19 +300,14 @@ static void  MSC_BOT_CBW_Decode (USBD_HandleTypeDef  *pdev)
   }
   else
   {
+    /* a valid CBW ends the reset recovery, a later stall is answered with a CSW again */
+    hmsc->bot_status = USBD_BOT_STATUS_NORMAL;
+    
     if(SCSI_ProcessCmd(pdev,
                        hmsc->cbw.bLUN,
                        &hmsc->cbw.CB[0]) < 0)
     {
-      if(hmsc->bot_state == USBD_BOT_NO_DATA)
-      {
-       MSC_BOT_SendCSW (pdev,
-                         USBD_CSW_CMD_FAILED); 
-      }
-      else
-      {
-        MSC_BOT_Abort(pdev);
-      }
+      MSC_BOT_Fail(pdev);
     }
     /*Burst xfer handled internally*/
     else if ((hmsc->bot_state != USBD_BOT_DATA_IN) && 
@@ -367,6 +408,86 @@ static void  MSC_BOT_Abort (USBD_HandleTypeDef  *pdev)
   }
 }
 
+/**
+* @brief  MSC_BOT_Fail
+*         Complete a failed command with CHECK CONDITION (CSW status failed, the sense
+*         data is queued by the SCSI layer). The data stage is padded with zeros or
+*         drained up to dDataLength as BOT 6.7 allows, a stalled endpoint costs the
+*         host a clear-halt and often a bulk-only or port reset.
+* @param  pdev: device instance
+* @retval None
+*/
+static void  MSC_BOT_Fail (USBD_HandleTypeDef  *pdev)
+{
+  USBD_MSC_BOT_HandleTypeDef  *hmsc = (USBD_MSC_BOT_HandleTypeDef*)pdev->pClassData; 
+  
+  if ((hmsc->cbw.bmFlags & 0x80) == 0x80)
+  {
+    /* the residue still counts the padding, only the data sent so far is valid */
+    hmsc->bot_pad_len = hmsc->csw.dDataResidue;
+  }
+  else if (hmsc->bot_state == USBD_BOT_DATA_OUT)
+  {
+    /* the packet of the failed write is already received */
+    hmsc->bot_pad_len = hmsc->scsi_blk_len - MIN (hmsc->scsi_blk_len, MSC_MEDIA_PACKET);
+  }
+  else
+  {
+    hmsc->bot_pad_len = hmsc->cbw.dDataLength;
+  }
+  
+  if (hmsc->bot_pad_len == 0)
+  {
+    MSC_BOT_SendCSW (pdev, USBD_CSW_CMD_FAILED);
+  }
+  /* cases 8, 10 (Hi <> Do, Ho <> Di) and long transfers keep the stall */
+  else if ((hmsc->bot_state == USBD_BOT_PHASE_ERROR) ||
+           (hmsc->bot_pad_len > MSC_BOT_PAD_MAX))
+  {
+    MSC_BOT_Abort(pdev);
+  }
+  else if ((hmsc->cbw.bmFlags & 0x80) == 0x80)
+  {
+    hmsc->bot_state = USBD_BOT_PAD_IN;
+    MSC_BOT_Pad(pdev);
+  }
+  else
+  {
+    hmsc->bot_state = USBD_BOT_DRAIN_OUT;
+    USBD_LL_PrepareReceive (pdev,
+                            MSC_EPOUT_ADDR,
+                            hmsc->bot_data,
+                            MIN (hmsc->bot_pad_len, MSC_MEDIA_PACKET));
+  }
+}
+
+/**
+* @brief  MSC_BOT_Pad
+*         Send the next packet of zeros of a failed IN command
+* @param  pdev: device instance
+* @retval None
+*/
+static void  MSC_BOT_Pad (USBD_HandleTypeDef  *pdev)
+{
+  USBD_MSC_BOT_HandleTypeDef  *hmsc = (USBD_MSC_BOT_HandleTypeDef*)pdev->pClassData; 
+  uint32_t len = MIN (hmsc->bot_pad_len, MSC_MEDIA_PACKET);
+  uint32_t i;
+  
+  if (len == 0)
+  {
+    MSC_BOT_SendCSW (pdev, USBD_CSW_CMD_FAILED);
+    return;
+  }
+  
+  for (i = 0; i < len; i++)
+  {
+    hmsc->bot_data[i] = 0;
+  }
+  hmsc->bot_pad_len -= len;
+  
+  USBD_LL_Transmit (pdev, MSC_EPIN_ADDR, hmsc->bot_data, len);
+}
+
 /**
 * @brief  MSC_BOT_CplClrFeature
 *         Complete the clear feature request
@@ -26,6 +26,7 @@
   */ 
 
 /* Includes ------------------------------------------------------------------*/
+#include <string.h>
 #include "usbd_msc_bot.h"
 #include "usbd_msc_scsi.h"
 #include "usbd_msc.h"
@@ -54,6 +55,12 @@
 /** @defgroup MSC_SCSI_Private_Defines
   * @{
   */ 
+/* READ10 read-ahead states */
+#define SCSI_RA_IDLE                0
+#define SCSI_RA_QUEUED              1       /* next sector requested from the main loop */
+#define SCSI_RA_BUSY                2       /* the main loop reads it into ra_data */
+#define SCSI_RA_DONE                3
+#define SCSI_RA_FAILED              4       /* read again by the USB interrupt, reports the error */
 
 /**
   * @}
@@ -91,6 +98,8 @@ static int8_t SCSI_ModeSense10 (USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t
 static int8_t SCSI_Write10(USBD_HandleTypeDef  *pdev, uint8_t lun , uint8_t *params);
 static int8_t SCSI_Read10(USBD_HandleTypeDef  *pdev, uint8_t lun , uint8_t *params);
 static int8_t SCSI_Verify10(USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t *params);
+static int8_t SCSI_SynchronizeCache10(USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t *params);
+static uint16_t SCSI_CachingPage(USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t *params, uint8_t *pPage);
 static int8_t SCSI_CheckAddressRange (USBD_HandleTypeDef  *pdev, 
                                       uint8_t lun , 
                                       uint32_t blk_offset , 
@@ -160,6 +169,9 @@ int8_t SCSI_ProcessCmd(USBD_HandleTypeDef  *pdev,
   case SCSI_VERIFY10:
     return SCSI_Verify10(pdev, lun, params);
     
+  case SCSI_SYNCHRONIZE_CACHE10:
+    return SCSI_SynchronizeCache10(pdev, lun, params);
+    
   default:
     SCSI_SenseCode(pdev, 
                    lun,
@@ -336,13 +348,24 @@ static int8_t SCSI_ModeSense6 (USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t *
 {
   USBD_MSC_BOT_HandleTypeDef  *hmsc = (USBD_MSC_BOT_HandleTypeDef*)pdev->pClassData; 
   uint16_t len = 8 ;
-  hmsc->bot_data_length = len;
   
   while (len) 
   {
     len--;
     hmsc->bot_data[len] = MSC_Mode_Sense6_data[len];
   }
+  
+  len = MODE_SENSE6_DATA_LEN + SCSI_CachingPage(pdev, lun, params, &hmsc->bot_data[MODE_SENSE6_DATA_LEN]);
+  if (len > MODE_SENSE6_DATA_LEN)
+  {
+    hmsc->bot_data[0] = len - 1;
+  }
+  else
+  {
+    len = 8;
+  }
+  
+  hmsc->bot_data_length = len;
   return 0;
 }
 
@@ -358,16 +381,58 @@ static int8_t SCSI_ModeSense10 (USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t
   uint16_t len = 8;
   USBD_MSC_BOT_HandleTypeDef  *hmsc = (USBD_MSC_BOT_HandleTypeDef*)pdev->pClassData; 
   
-  hmsc->bot_data_length = len;
-
   while (len) 
   {
     len--;
     hmsc->bot_data[len] = MSC_Mode_Sense10_data[len];
   }
+  
+  len = MODE_SENSE10_DATA_LEN + SCSI_CachingPage(pdev, lun, params, &hmsc->bot_data[MODE_SENSE10_DATA_LEN]);
+  if (len > MODE_SENSE10_DATA_LEN)
+  {
+    hmsc->bot_data[0] = 0;
+    hmsc->bot_data[1] = len - 2;
+  }
+  
+  hmsc->bot_data_length = len;
   return 0;
 }
 
+/**
+* @brief  SCSI_CachingPage
+*         Append the caching mode page (08h) if the LUN buffers writes
+* @param  lun: Logical unit number
+* @param  params: Command parameters
+* @param  pPage: page destination
+* @retval page length, 0 if not reported
+*/
+static uint16_t SCSI_CachingPage(USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t *params, uint8_t *pPage)
+{
+  uint8_t page_code = params[2] & 0x3F;
+  uint8_t i;
+  
+  if ((page_code != MODE_PAGE_CACHING) && (page_code != MODE_PAGE_ALL))
+  {
+    return 0;
+  }
+  
+  if ((((USBD_StorageTypeDef *)pdev->pUserData)->IsWriteCached == NULL) ||
+      (((USBD_StorageTypeDef *)pdev->pUserData)->IsWriteCached(lun) <= 0))
+  {
+    return 0;
+  }
+  
+  for (i = 0; i < MODE_PAGE_CACHING_LEN; i++)
+  {
+    pPage[i] = 0;
+  }
+  pPage[0] = MODE_PAGE_CACHING;
+  pPage[1] = MODE_PAGE_CACHING_LEN - 2;
+  pPage[2] = MODE_PAGE_CACHING_WCE;
+  
+  return MODE_PAGE_CACHING_LEN;
+}
+
 /**
 * @brief  SCSI_RequestSense
 *         Process Request Sense command
@@ -442,6 +507,13 @@ static int8_t SCSI_StartStopUnit(USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t
 {
   USBD_MSC_BOT_HandleTypeDef  *hmsc = (USBD_MSC_BOT_HandleTypeDef*) pdev->pClassData;   
   hmsc->bot_data_length = 0;
+  
+  /* START STOP UNIT with LOEJ=1, START=0: the host ejects the medium */
+  if ((params[0] == SCSI_START_STOP_UNIT) && ((params[4] & 0x03) == 0x02) &&
+      (((USBD_StorageTypeDef *)pdev->pUserData)->Eject != NULL))
+  {
+    ((USBD_StorageTypeDef *)pdev->pUserData)->Eject(lun);
+  }
   return 0;
 }
 
@@ -458,6 +530,9 @@ static int8_t SCSI_Read10(USBD_HandleTypeDef  *pdev, uint8_t lun , uint8_t *para
   
   if(hmsc->bot_state == USBD_BOT_IDLE)  /* Idle */
   {
+#if (MSC_READ_AHEAD > 0)
+    SCSI_ReadAheadCancel(pdev);
+#endif
     
     /* case 10 : Ho <> Di */
     
@@ -467,6 +542,7 @@ static int8_t SCSI_Read10(USBD_HandleTypeDef  *pdev, uint8_t lun , uint8_t *para
                      hmsc->cbw.bLUN, 
                      ILLEGAL_REQUEST, 
                      INVALID_CDB);
+      hmsc->bot_state = USBD_BOT_PHASE_ERROR;
       return -1;
     }    
     
@@ -536,6 +612,7 @@ static int8_t SCSI_Write10 (USBD_HandleTypeDef  *pdev, uint8_t lun , uint8_t *pa
                      hmsc->cbw.bLUN, 
                      ILLEGAL_REQUEST, 
                      INVALID_CDB);
+      hmsc->bot_state = USBD_BOT_PHASE_ERROR;
       return -1;
     }
     
@@ -636,6 +713,31 @@ static int8_t SCSI_Verify10(USBD_HandleTypeDef  *pdev, uint8_t lun , uint8_t *pa
   return 0;
 }
 
+/**
+* @brief  SCSI_SynchronizeCache10
+*         Process Synchronize Cache(10) command, write back the buffered data
+* @param  lun: Logical unit number
+* @param  params: Command parameters
+* @retval status
+*/
+static int8_t SCSI_SynchronizeCache10(USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t *params)
+{
+  USBD_MSC_BOT_HandleTypeDef  *hmsc = (USBD_MSC_BOT_HandleTypeDef*) pdev->pClassData; 
+  
+  hmsc->bot_data_length = 0;
+  
+  if ((((USBD_StorageTypeDef *)pdev->pUserData)->SyncCache != NULL) &&
+      (((USBD_StorageTypeDef *)pdev->pUserData)->SyncCache(lun) != 0))
+  {
+    SCSI_SenseCode(pdev,
+                   lun,
+                   MEDIUM_ERROR,
+                   WRITE_FAULT);
+    return -1;
+  }
+  return 0;
+}
+
 /**
 * @brief  SCSI_CheckAddressRange
 *         Check address range
@@ -648,6 +750,17 @@ static int8_t SCSI_CheckAddressRange (USBD_HandleTypeDef  *pdev, uint8_t lun , u
 {
   USBD_MSC_BOT_HandleTypeDef  *hmsc = (USBD_MSC_BOT_HandleTypeDef*) pdev->pClassData; 
   
+  /* scsi_blk_nbr/scsi_blk_size hold the capacity of the LUN of the last READ CAPACITY,
+     refresh them for this LUN (multi LUN) */
+  if(((USBD_StorageTypeDef *)pdev->pUserData)->GetCapacity(lun, &hmsc->scsi_blk_nbr, &hmsc->scsi_blk_size) != 0)
+  {
+    SCSI_SenseCode(pdev,
+                   lun,
+                   NOT_READY,
+                   MEDIUM_NOT_PRESENT);
+    return -1;
+  }
+  
   if ((blk_offset + blk_nbr) > hmsc->scsi_blk_nbr )
   {
     SCSI_SenseCode(pdev,
@@ -672,17 +785,39 @@ static int8_t SCSI_ProcessRead (USBD_HandleTypeDef  *pdev, uint8_t lun)
   
   len = MIN(hmsc->scsi_blk_len , MSC_MEDIA_PACKET); 
   
-  if( ((USBD_StorageTypeDef *)pdev->pUserData)->Read(lun ,
-                              hmsc->bot_data, 
-                              hmsc->scsi_blk_addr / hmsc->scsi_blk_size, 
-                              len / hmsc->scsi_blk_size) < 0)
+#if (MSC_READ_AHEAD > 0)
+  if (hmsc->ra_state == SCSI_RA_BUSY)
   {
-    
-    SCSI_SenseCode(pdev,
-                   lun, 
-                   HARDWARE_ERROR, 
-                   UNRECOVERED_READ_ERROR);
-    return -1; 
+    /* SCSI_ReadAhead calls MSC_BOT_DataIn again when the sector is ready */
+    hmsc->ra_wait = 1;
+    return 0;
+  }
+  
+  if ((hmsc->ra_state == SCSI_RA_DONE) &&
+      (hmsc->ra_blk_addr == hmsc->scsi_blk_addr / hmsc->scsi_blk_size))
+  {
+    memcpy(hmsc->bot_data, hmsc->ra_data, len);
+    hmsc->ra_state = SCSI_RA_IDLE;
+  }
+  else
+#endif
+  {
+#if (MSC_READ_AHEAD > 0)
+    /* not started by the main loop yet or failed, read here */
+    hmsc->ra_state = SCSI_RA_IDLE;
+#endif
+    if( ((USBD_StorageTypeDef *)pdev->pUserData)->Read(lun ,
+                                hmsc->bot_data, 
+                                hmsc->scsi_blk_addr / hmsc->scsi_blk_size, 
+                                len / hmsc->scsi_blk_size) != 0)
+    {
+      
+      SCSI_SenseCode(pdev,
+                     lun, 
+                     HARDWARE_ERROR, 
+                     UNRECOVERED_READ_ERROR);
+      return -1; 
+    }
   }
   
   
@@ -702,9 +837,85 @@ static int8_t SCSI_ProcessRead (USBD_HandleTypeDef  *pdev, uint8_t lun)
   {
     hmsc->bot_state = USBD_BOT_LAST_DATA_IN;
   }
+#if (MSC_READ_AHEAD > 0)
+  else
+  {
+    /* the next sector is prepared while this one is sent */
+    hmsc->ra_lun = lun;
+    hmsc->ra_blk_addr = hmsc->scsi_blk_addr / hmsc->scsi_blk_size;
+    hmsc->ra_blk_len = MIN(hmsc->scsi_blk_len, MSC_MEDIA_PACKET) / hmsc->scsi_blk_size;
+    hmsc->ra_state = SCSI_RA_QUEUED;
+  }
+#endif
   return 0;
 }
 
+#if (MSC_READ_AHEAD > 0)
+/**
+* @brief  SCSI_ReadAhead
+*         Read the queued READ10 sector, called from the main loop. The USB interrupt
+*         keeps sending the current sector meanwhile.
+* @param  pdev: device instance
+* @retval None
+*/
+void SCSI_ReadAhead(USBD_HandleTypeDef  *pdev)
+{
+  USBD_MSC_BOT_HandleTypeDef  *hmsc = (USBD_MSC_BOT_HandleTypeDef*)pdev->pClassData;   
+  uint32_t primask;
+  uint32_t blk_addr;
+  uint16_t blk_len;
+  uint8_t lun;
+  int8_t res;
+  
+  if ((hmsc == NULL) || (hmsc->ra_state != SCSI_RA_QUEUED))
+  {
+    return;
+  }
+  
+  primask = __get_PRIMASK();
+  __disable_irq();
+  if (hmsc->ra_state != SCSI_RA_QUEUED)
+  {
+    __set_PRIMASK(primask);
+    return;
+  }
+  hmsc->ra_state = SCSI_RA_BUSY;
+  lun = hmsc->ra_lun;
+  blk_addr = hmsc->ra_blk_addr;
+  blk_len = hmsc->ra_blk_len;
+  __set_PRIMASK(primask);
+  
+  res = ((USBD_StorageTypeDef *)pdev->pUserData)->Read(lun, hmsc->ra_data, blk_addr, blk_len);
+  
+  __disable_irq();
+  if (hmsc->ra_state == SCSI_RA_BUSY)     /* not cancelled by a reset meanwhile */
+  {
+    hmsc->ra_state = (res != 0) ? SCSI_RA_FAILED : SCSI_RA_DONE;
+    if (hmsc->ra_wait)
+    {
+      hmsc->ra_wait = 0;
+      MSC_BOT_DataIn(pdev, MSC_EPIN_ADDR & 0x7F);
+    }
+  }
+  __set_PRIMASK(primask);
+}
+
+/**
+* @brief  SCSI_ReadAheadCancel
+*         Drop the queued sector. A read already started by the main loop
+*         completes into ra_data and is ignored.
+* @param  pdev: device instance
+* @retval None
+*/
+void SCSI_ReadAheadCancel(USBD_HandleTypeDef  *pdev)
+{
+  USBD_MSC_BOT_HandleTypeDef  *hmsc = (USBD_MSC_BOT_HandleTypeDef*)pdev->pClassData;   
+  
+  hmsc->ra_state = SCSI_RA_IDLE;
+  hmsc->ra_wait = 0;
+}
+#endif
+
 /**
 * @brief  SCSI_ProcessWrite
 *         Handle Write Process
@@ -722,7 +933,7 @@ static int8_t SCSI_ProcessWrite (USBD_HandleTypeDef  *pdev, uint8_t lun)
   if(((USBD_StorageTypeDef *)pdev->pUserData)->Write(lun ,
                               hmsc->bot_data, 
                               hmsc->scsi_blk_addr / hmsc->scsi_blk_size, 
-                              len / hmsc->scsi_blk_size) < 0)
+                              len / hmsc->scsi_blk_size) != 0)
   {
     SCSI_SenseCode(pdev,
                    lun, 
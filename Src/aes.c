@@ -119,10 +119,12 @@ static const uint8_t rsbox[256] = {
 
 #endif
 
+#if !(defined(AES_CONST_ROUNDKEY) && (AES_CONST_ROUNDKEY == 1))
 // The round constant word array, Rcon[i], contains the values given by 
 // x to the power (i-1) being powers of x (x is denoted as {02}) in the field GF(2^8)
 static const uint8_t Rcon[11] = {
   0x8d, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+#endif
 
 /*
  * Jordan Goulder points out in PR #12 (https://github.com/kokke/tiny-AES-C/pull/12),
@@ -153,6 +155,7 @@ static uint8_t getSBoxInvert(uint8_t num)
 */
 #define getSBoxInvert(num) (rsbox[(num)])
 
+#if !(defined(AES_CONST_ROUNDKEY) && (AES_CONST_ROUNDKEY == 1))
 // This function produces Nb(Nr+1) round keys. The round keys are used in each round to decrypt the states. 
 static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key)
 {
@@ -237,6 +240,18 @@ void AES_init_ctx_iv(struct AES_ctx* ctx, const uint8_t* key, const uint8_t* iv)
   KeyExpansion(ctx->RoundKey, key);
   memcpy (ctx->Iv, iv, AES_BLOCKLEN);
 }
+#endif
+
+#else
+
+void AES_init_ctx_roundkey(struct AES_ctx* ctx, const uint8_t* RoundKey)
+{
+  ctx->RoundKey = RoundKey;
+}
+
+#endif // #if !(defined(AES_CONST_ROUNDKEY) && (AES_CONST_ROUNDKEY == 1))
+
+#if (defined(CBC) && (CBC == 1)) || (defined(CTR) && (CTR == 1))
 void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv)
 {
   memcpy (ctx->Iv, iv, AES_BLOCKLEN);
@@ -570,5 +585,10 @@ void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
   }
 }
 
+void AES_CTR_keystream(const struct AES_ctx* ctx, uint8_t* buf)
+{
+  Cipher((state_t*)buf, ctx->RoundKey);
+}
+
 #endif // #if defined(CTR) && (CTR == 1)
 
@@ -0,0 +1,130 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <stdint.h>
+
+#include "aes_ttable.h"
+
+//-------------------------------------------------------
+
+#define AES_TTABLE_ROUNDS       ((AES_keyExpSize / AES_BLOCKLEN) - 1)
+
+#define ROTR(x, n)              (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Te0[x] = {02*S[x], S[x], S[x], 03*S[x]}, Te1..Te3 are Te0 rotated by 8, 16, 24 bits
+#define TE0(x)                  aes_te0[(x)]
+#define TE1(x)                  ROTR(aes_te0[(x)], 8)
+#define TE2(x)                  ROTR(aes_te0[(x)], 16)
+#define TE3(x)                  ROTR(aes_te0[(x)], 24)
+#define SBOX(x)                 ((aes_te0[(x)] >> 16) & 0xFF)
+
+static const uint32_t aes_te0[256] =
+{
+    0xC66363A5ul, 0xF87C7C84ul, 0xEE777799ul, 0xF67B7B8Dul, 0xFFF2F20Dul, 0xD66B6BBDul,
+    0xDE6F6FB1ul, 0x91C5C554ul, 0x60303050ul, 0x02010103ul, 0xCE6767A9ul, 0x562B2B7Dul,
+    0xE7FEFE19ul, 0xB5D7D762ul, 0x4DABABE6ul, 0xEC76769Aul, 0x8FCACA45ul, 0x1F82829Dul,
+    0x89C9C940ul, 0xFA7D7D87ul, 0xEFFAFA15ul, 0xB25959EBul, 0x8E4747C9ul, 0xFBF0F00Bul,
+    0x41ADADECul, 0xB3D4D467ul, 0x5FA2A2FDul, 0x45AFAFEAul, 0x239C9CBFul, 0x53A4A4F7ul,
+    0xE4727296ul, 0x9BC0C05Bul, 0x75B7B7C2ul, 0xE1FDFD1Cul, 0x3D9393AEul, 0x4C26266Aul,
+    0x6C36365Aul, 0x7E3F3F41ul, 0xF5F7F702ul, 0x83CCCC4Ful, 0x6834345Cul, 0x51A5A5F4ul,
+    0xD1E5E534ul, 0xF9F1F108ul, 0xE2717193ul, 0xABD8D873ul, 0x62313153ul, 0x2A15153Ful,
+    0x0804040Cul, 0x95C7C752ul, 0x46232365ul, 0x9DC3C35Eul, 0x30181828ul, 0x379696A1ul,
+    0x0A05050Ful, 0x2F9A9AB5ul, 0x0E070709ul, 0x24121236ul, 0x1B80809Bul, 0xDFE2E23Dul,
+    0xCDEBEB26ul, 0x4E272769ul, 0x7FB2B2CDul, 0xEA75759Ful, 0x1209091Bul, 0x1D83839Eul,
+    0x582C2C74ul, 0x341A1A2Eul, 0x361B1B2Dul, 0xDC6E6EB2ul, 0xB45A5AEEul, 0x5BA0A0FBul,
+    0xA45252F6ul, 0x763B3B4Dul, 0xB7D6D661ul, 0x7DB3B3CEul, 0x5229297Bul, 0xDDE3E33Eul,
+    0x5E2F2F71ul, 0x13848497ul, 0xA65353F5ul, 0xB9D1D168ul, 0x00000000ul, 0xC1EDED2Cul,
+    0x40202060ul, 0xE3FCFC1Ful, 0x79B1B1C8ul, 0xB65B5BEDul, 0xD46A6ABEul, 0x8DCBCB46ul,
+    0x67BEBED9ul, 0x7239394Bul, 0x944A4ADEul, 0x984C4CD4ul, 0xB05858E8ul, 0x85CFCF4Aul,
+    0xBBD0D06Bul, 0xC5EFEF2Aul, 0x4FAAAAE5ul, 0xEDFBFB16ul, 0x864343C5ul, 0x9A4D4DD7ul,
+    0x66333355ul, 0x11858594ul, 0x8A4545CFul, 0xE9F9F910ul, 0x04020206ul, 0xFE7F7F81ul,
+    0xA05050F0ul, 0x783C3C44ul, 0x259F9FBAul, 0x4BA8A8E3ul, 0xA25151F3ul, 0x5DA3A3FEul,
+    0x804040C0ul, 0x058F8F8Aul, 0x3F9292ADul, 0x219D9DBCul, 0x70383848ul, 0xF1F5F504ul,
+    0x63BCBCDFul, 0x77B6B6C1ul, 0xAFDADA75ul, 0x42212163ul, 0x20101030ul, 0xE5FFFF1Aul,
+    0xFDF3F30Eul, 0xBFD2D26Dul, 0x81CDCD4Cul, 0x180C0C14ul, 0x26131335ul, 0xC3ECEC2Ful,
+    0xBE5F5FE1ul, 0x359797A2ul, 0x884444CCul, 0x2E171739ul, 0x93C4C457ul, 0x55A7A7F2ul,
+    0xFC7E7E82ul, 0x7A3D3D47ul, 0xC86464ACul, 0xBA5D5DE7ul, 0x3219192Bul, 0xE6737395ul,
+    0xC06060A0ul, 0x19818198ul, 0x9E4F4FD1ul, 0xA3DCDC7Ful, 0x44222266ul, 0x542A2A7Eul,
+    0x3B9090ABul, 0x0B888883ul, 0x8C4646CAul, 0xC7EEEE29ul, 0x6BB8B8D3ul, 0x2814143Cul,
+    0xA7DEDE79ul, 0xBC5E5EE2ul, 0x160B0B1Dul, 0xADDBDB76ul, 0xDBE0E03Bul, 0x64323256ul,
+    0x743A3A4Eul, 0x140A0A1Eul, 0x924949DBul, 0x0C06060Aul, 0x4824246Cul, 0xB85C5CE4ul,
+    0x9FC2C25Dul, 0xBDD3D36Eul, 0x43ACACEFul, 0xC46262A6ul, 0x399191A8ul, 0x319595A4ul,
+    0xD3E4E437ul, 0xF279798Bul, 0xD5E7E732ul, 0x8BC8C843ul, 0x6E373759ul, 0xDA6D6DB7ul,
+    0x018D8D8Cul, 0xB1D5D564ul, 0x9C4E4ED2ul, 0x49A9A9E0ul, 0xD86C6CB4ul, 0xAC5656FAul,
+    0xF3F4F407ul, 0xCFEAEA25ul, 0xCA6565AFul, 0xF47A7A8Eul, 0x47AEAEE9ul, 0x10080818ul,
+    0x6FBABAD5ul, 0xF0787888ul, 0x4A25256Ful, 0x5C2E2E72ul, 0x381C1C24ul, 0x57A6A6F1ul,
+    0x73B4B4C7ul, 0x97C6C651ul, 0xCBE8E823ul, 0xA1DDDD7Cul, 0xE874749Cul, 0x3E1F1F21ul,
+    0x964B4BDDul, 0x61BDBDDCul, 0x0D8B8B86ul, 0x0F8A8A85ul, 0xE0707090ul, 0x7C3E3E42ul,
+    0x71B5B5C4ul, 0xCC6666AAul, 0x904848D8ul, 0x06030305ul, 0xF7F6F601ul, 0x1C0E0E12ul,
+    0xC26161A3ul, 0x6A35355Ful, 0xAE5757F9ul, 0x69B9B9D0ul, 0x17868691ul, 0x99C1C158ul,
+    0x3A1D1D27ul, 0x279E9EB9ul, 0xD9E1E138ul, 0xEBF8F813ul, 0x2B9898B3ul, 0x22111133ul,
+    0xD26969BBul, 0xA9D9D970ul, 0x078E8E89ul, 0x339494A7ul, 0x2D9B9BB6ul, 0x3C1E1E22ul,
+    0x15878792ul, 0xC9E9E920ul, 0x87CECE49ul, 0xAA5555FFul, 0x50282878ul, 0xA5DFDF7Aul,
+    0x038C8C8Ful, 0x59A1A1F8ul, 0x09898980ul, 0x1A0D0D17ul, 0x65BFBFDAul, 0xD7E6E631ul,
+    0x844242C6ul, 0xD06868B8ul, 0x824141C3ul, 0x299999B0ul, 0x5A2D2D77ul, 0x1E0F0F11ul,
+    0x7BB0B0CBul, 0xA85454FCul, 0x6DBBBBD6ul, 0x2C16163Aul,
+};
+
+//-------------------------------------------------------
+
+static uint32_t _aes_get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void _aes_put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+//-------------------------------------------------------
+
+void aes_ttable_encrypt(const uint8_t *round_key, uint8_t *block)
+{
+    const uint8_t *rk = round_key;
+    uint32_t s0, s1, s2, s3;
+    uint32_t t0, t1, t2, t3;
+    uint8_t round;
+    
+    s0 = _aes_get_be32(&block[0]) ^ _aes_get_be32(&rk[0]);
+    s1 = _aes_get_be32(&block[4]) ^ _aes_get_be32(&rk[4]);
+    s2 = _aes_get_be32(&block[8]) ^ _aes_get_be32(&rk[8]);
+    s3 = _aes_get_be32(&block[12]) ^ _aes_get_be32(&rk[12]);
+    
+    for(round = 1; round < AES_TTABLE_ROUNDS; round++)
+    {
+        rk += AES_BLOCKLEN;
+        t0 = TE0(s0 >> 24) ^ TE1((s1 >> 16) & 0xFF) ^ TE2((s2 >> 8) & 0xFF) ^ TE3(s3 & 0xFF) ^ _aes_get_be32(&rk[0]);
+        t1 = TE0(s1 >> 24) ^ TE1((s2 >> 16) & 0xFF) ^ TE2((s3 >> 8) & 0xFF) ^ TE3(s0 & 0xFF) ^ _aes_get_be32(&rk[4]);
+        t2 = TE0(s2 >> 24) ^ TE1((s3 >> 16) & 0xFF) ^ TE2((s0 >> 8) & 0xFF) ^ TE3(s1 & 0xFF) ^ _aes_get_be32(&rk[8]);
+        t3 = TE0(s3 >> 24) ^ TE1((s0 >> 16) & 0xFF) ^ TE2((s1 >> 8) & 0xFF) ^ TE3(s2 & 0xFF) ^ _aes_get_be32(&rk[12]);
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+    
+    // Last round without MixColumns
+    rk += AES_BLOCKLEN;
+    t0 = (SBOX(s0 >> 24) << 24) | (SBOX((s1 >> 16) & 0xFF) << 16) | (SBOX((s2 >> 8) & 0xFF) << 8) | SBOX(s3 & 0xFF);
+    t1 = (SBOX(s1 >> 24) << 24) | (SBOX((s2 >> 16) & 0xFF) << 16) | (SBOX((s3 >> 8) & 0xFF) << 8) | SBOX(s0 & 0xFF);
+    t2 = (SBOX(s2 >> 24) << 24) | (SBOX((s3 >> 16) & 0xFF) << 16) | (SBOX((s0 >> 8) & 0xFF) << 8) | SBOX(s1 & 0xFF);
+    t3 = (SBOX(s3 >> 24) << 24) | (SBOX((s0 >> 16) & 0xFF) << 16) | (SBOX((s1 >> 8) & 0xFF) << 8) | SBOX(s2 & 0xFF);
+    
+    _aes_put_be32(&block[0], t0 ^ _aes_get_be32(&rk[0]));
+    _aes_put_be32(&block[4], t1 ^ _aes_get_be32(&rk[4]));
+    _aes_put_be32(&block[8], t2 ^ _aes_get_be32(&rk[8]));
+    _aes_put_be32(&block[12], t3 ^ _aes_get_be32(&rk[12]));
+}
@@ -0,0 +1,116 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "btldr_config.h"
+#include "btldr_services.h"
+#include "flash_sink.h"
+#include "ihex_parser.h"
+#include "uf2.h"
+#include "crypt.h"
+#include "crc.h"
+
+//-------------------------------------------------------
+
+#ifndef MIN
+  #define MIN(a,b) (((a)<(b))?(a):(b))
+#endif
+
+//-------------------------------------------------------
+
+// Erase the staging pages of the whole image, gaps in the image read back as 0xFF
+bool btldr_stage_open(flash_sink_t *s, uint32_t image_size)
+{
+    flash_sink_init(s);
+    
+    if(image_size == 0 || image_size > STAGE_SIZE)
+    {
+        return false;
+    }
+    return flash_sink_erase(s, STAGE_ADDR, image_size);
+}
+
+bool btldr_stage_write(flash_sink_t *s, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    if(addr < APP_ADDR || size > STAGE_SIZE || (addr - APP_ADDR) > (STAGE_SIZE - size))
+    {
+        return false;
+    }
+    return flash_sink_write(s, STAGE_ADDR + (addr - APP_ADDR), buf, size);
+}
+
+bool btldr_app_validate(uint32_t addr, uint32_t size)
+{
+    const uint32_t *vector = (const uint32_t *)addr;
+    uint32_t reset;
+    
+    if(size < 8)
+    {
+        return false;
+    }
+    
+    reset = vector[1];
+    
+    return (vector[0] > SRAM_BASE) && (vector[0] <= (SRAM_BASE + DEV_SRAM_SIZE)) &&
+           (reset & 1) && ((reset & ~1ul) >= APP_ADDR) && ((reset & ~1ul) < (APP_ADDR + size));
+}
+
+// Runs in the bootloader at reset. Page 0 of the application is erased first and
+// programmed last, if the power fails in between there is no vector table and the
+// bootloader starts the USB drive.
+bool btldr_stage_install(flash_sink_t *s, uint32_t image_size)
+{
+    flash_sink_init(s);
+    
+    if(!flash_sink_erase(s, APP_ADDR, 1))
+    {
+        return false;
+    }
+    
+    if(image_size > FLASH_SINK_PAGE_SIZE &&
+       !flash_sink_write(s, APP_ADDR + FLASH_SINK_PAGE_SIZE, (const uint8_t *)(STAGE_ADDR + FLASH_SINK_PAGE_SIZE), image_size - FLASH_SINK_PAGE_SIZE))
+    {
+        return false;
+    }
+    
+    return flash_sink_write(s, APP_ADDR, (const uint8_t *)STAGE_ADDR, MIN(image_size, FLASH_SINK_PAGE_SIZE));
+}
+
+//-------------------------------------------------------
+
+__attribute__((section(".btldr_services"), used))
+const btldr_services_t btldr_services =
+{
+    .magic          = BTLDR_SERVICES_MAGIC,
+    .version        = BTLDR_SERVICES_VERSION,
+    .size           = sizeof(btldr_services_t),
+    .app_addr       = APP_ADDR,
+    .stage_addr     = STAGE_ADDR,
+    .stage_size     = STAGE_SIZE,
+    
+    .stage_open     = btldr_stage_open,
+    .stage_write    = btldr_stage_write,
+    
+    .ihex_init      = ihex_ctx_init,
+    .ihex_parse     = ihex_ctx_parse,
+    .uf2_decode     = uf2_block_decode,
+    
+#if (CONFIG_SUPPORT_CRYPT_MODE > 0u)
+    .ctr_xcrypt     = crypt_xcrypt,
+#else
+    .ctr_xcrypt     = 0,
+#endif
+    .crc32_update   = crc32_update,
+    .app_validate   = btldr_app_validate,
+};
@@ -0,0 +1,241 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "stm32f1xx_hal.h"
+#include "btldr_config.h"
+#include "btldr_status.h"
+#include "crypt.h"
+#include "fat32.h"
+#include "raw_lun.h"
+#include "btldr_mailbox.h"
+#include "pipeline.h"
+
+//-------------------------------------------------------
+
+#define STATUS_SECTOR_SIZE      512
+
+// No printf here, newlib formatted output costs several KB of flash.
+// The text is rendered from the start for every sector, only the characters that fall
+// into the requested sector are stored.
+typedef struct
+{
+    uint8_t *b;
+    uint32_t pos;           // position in the file
+    uint32_t start;         // file offset of b[0]
+}status_writer_t;
+
+static void _status_put_char(status_writer_t *w, char c)
+{
+    if(w->pos >= w->start && w->pos < (w->start + STATUS_SECTOR_SIZE))
+    {
+        w->b[w->pos - w->start] = c;
+    }
+    ++w->pos;
+}
+
+static void _status_put_str(status_writer_t *w, const char *str)
+{
+    while(*str)
+    {
+        _status_put_char(w, *str++);
+    }
+}
+
+static void _status_put_dec(status_writer_t *w, uint32_t value)
+{
+    uint8_t digit[10];
+    uint8_t n = 0;
+    
+    do
+    {
+        digit[n++] = '0' + (value % 10);
+        value /= 10;
+    }while(value);
+    
+    while(n)
+    {
+        _status_put_char(w, digit[--n]);
+    }
+}
+
+static void _status_put_line(status_writer_t *w, const char *name, uint32_t value)
+{
+    _status_put_str(w, name);
+    _status_put_dec(w, value);
+    _status_put_str(w, "\r\n");
+}
+
+static const char * const status_ts_name[STATUS_TS_NBR] =
+{
+    "boot us hal init: ",
+    "boot us clock: ",
+    "boot us gpio: ",
+    "boot us usb start: ",
+    "boot us deferred init: ",
+    "boot us usb reset: ",
+    "boot us read capacity: ",
+    "boot us boot sector: ",
+    "boot us root dir: ",
+};
+
+static uint32_t status_ts[STATUS_TS_NBR];
+
+// The core runs from the 8MHz HSI until the PLL is selected
+static uint32_t _status_cycles_to_us(uint32_t cycles)
+{
+    uint32_t pll = status_ts[STATUS_TS_CLOCK];
+    
+    if(cycles <= pll)
+    {
+        return cycles / (HSI_VALUE / 1000000);
+    }
+    return pll / (HSI_VALUE / 1000000) + (cycles - pll) / 48;
+}
+
+//-------------------------------------------------------
+
+void status_init(void)
+{
+#if (CONFIG_STATUS_FILE > 0u)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+uint32_t status_elapsed_us(void)
+{
+    return _status_cycles_to_us(STATUS_CYCCNT());
+}
+
+void status_timestamp(status_ts_t ts)
+{
+#if (CONFIG_STATUS_FILE > 0u)
+    if(status_ts[ts] == 0)
+    {
+        status_ts[ts] = DWT->CYCCNT;
+    }
+#endif
+}
+
+// Each line is at most ~40 chars. The default config fills most of STATUS_FILE_SIZE,
+// text past the end of the file is cut off.
+void status_render(uint8_t *b, uint32_t offset)
+{
+    status_writer_t w = {b, 0, offset};
+    
+    memset(b, ' ', STATUS_SECTOR_SIZE);
+    
+    _status_put_str(&w, "STM32 bootloader status\r\n");
+    
+    {
+        uint8_t i;
+        
+        for(i=0; i<STATUS_TS_NBR; i++)
+        {
+            _status_put_line(&w, status_ts_name[i], _status_cycles_to_us(status_ts[i]));
+        }
+    }
+    
+    {
+        const flash_sink_t *fs = fat32_get_flash_stats();
+        
+        _status_put_line(&w, "flash page erase: ", fs->page_erase);
+        _status_put_line(&w, "flash page erase skipped: ", fs->page_erase_skip);
+        _status_put_line(&w, "flash erase errors: ", fs->page_erase_err);
+        _status_put_line(&w, "flash halfwords programmed: ", fs->prog_halfword);
+        _status_put_line(&w, "flash program errors: ", fs->prog_err);
+        _status_put_line(&w, "flash halfwords same: ", fs->prog_same);
+        _status_put_line(&w, "flash halfwords all-ones: ", fs->prog_ones);
+        _status_put_line(&w, "flash halfwords conflicting: ", fs->prog_conflict);
+    }
+    
+    {
+        fat32_hex_stats_t hs;
+        
+        fat32_get_hex_stats(&hs);
+        _status_put_line(&w, "hex files: ", hs.files);
+        _status_put_line(&w, "hex files complete: ", hs.files_done);
+        _status_put_line(&w, "hex files rejected: ", hs.rejected);
+#if (CONFIG_IHEX_RESYNC > 0u)
+        _status_put_line(&w, "hex bytes skipped: ", hs.skipped_bytes);
+        _status_put_line(&w, "hex records dropped: ", hs.records_dropped);
+        _status_put_line(&w, "hex sectors quarantined: ", hs.quarantined);
+        _status_put_line(&w, "hex session failed: ", hs.failed);
+#endif
+#if (CONFIG_SECTOR_FP_NBR > 0u)
+        _status_put_line(&w, "sectors duplicate: ", hs.sectors_duplicate);
+        _status_put_line(&w, "sectors rewritten: ", hs.sectors_rewritten);
+#endif
+    }
+    
+    _status_put_line(&w, "pipe records dropped: ", pipe_stats_dropped.records);
+    _status_put_line(&w, "pipe cycles decode: ", pipe_stats_decode.cycles);
+    _status_put_line(&w, "pipe cycles transform: ", pipe_stats_transform.cycles);
+    _status_put_line(&w, "pipe cycles sink: ", pipe_stats_sink.cycles);
+#if (CONFIG_PIPE_SINK == PIPE_SINK_VERIFY)
+    _status_put_line(&w, "pipe verify mismatches: ", pipe_stats_sink.errors);
+#endif
+#if (CONFIG_PIPE_HASH > 0u)
+    _status_put_line(&w, "pipe crc32: ", pipe_crc32_value());
+#endif
+    
+#if (CONFIG_RAW_LUN > 0u)
+    {
+        const flash_sink_t *fs = raw_lun_get_flash_stats();
+        
+        _status_put_line(&w, "raw lun pages programmed: ", fs->page_erase);
+        _status_put_line(&w, "raw lun program errors: ", fs->page_erase_err + fs->prog_err);
+    }
+#endif
+    
+#if (CONFIG_SELF_UPDATE > 0u)
+    if(btldr_mailbox_is_valid(BTLDR_MAILBOX))
+    {
+        _status_put_line(&w, "bootloader update result: ", BTLDR_MAILBOX->btldr_update_result);
+        _status_put_line(&w, "bootloader update us: ", BTLDR_MAILBOX->btldr_update_us);
+    }
+#endif
+    
+#if (CONFIG_READ_FLASH > 0u)
+    {
+        const fat32_readback_stats_t *rb = fat32_get_readback_stats();
+        
+        _status_put_line(&w, "readback cycles per sector: ", rb->sectors ? (rb->cycles / rb->sectors) : 0);
+        _status_put_line(&w, "readback KB/s: ", rb->run_ms ? (rb->run_sectors * 500 / rb->run_ms) : 0);
+    }
+#endif
+    
+#if (CONFIG_SUPPORT_CRYPT_MODE > 0u)
+    {
+        const crypt_stats_t *cs = crypt_get_stats();
+        uint32_t hit_avg = cs->ks_hit ? (cs->ks_hit_cycles / cs->ks_hit) : 0;
+        uint32_t miss_avg = cs->ks_miss ? (cs->ks_miss_cycles / cs->ks_miss) : 0;
+        
+        _status_put_line(&w, "crypt keystream hit: ", cs->ks_hit);
+        _status_put_line(&w, "crypt keystream miss: ", cs->ks_miss);
+        _status_put_line(&w, "crypt cycles per hit: ", hit_avg);
+        _status_put_line(&w, "crypt cycles per miss: ", miss_avg);
+        _status_put_line(&w, "crypt cycles saved: ", (miss_avg > hit_avg) ? (miss_avg - hit_avg) * cs->ks_hit : 0);
+    }
+#endif
+    
+    if(offset + STATUS_SECTOR_SIZE >= STATUS_FILE_SIZE)
+    {
+        b[STATUS_SECTOR_SIZE - 2] = '\r';
+        b[STATUS_SECTOR_SIZE - 1] = '\n';
+    }
+}
@@ -13,6 +13,32 @@ static inline uint32_t swap_uint32(uint32_t value)
 }
 
 
+/*
+ * Nibble table, 64 bytes of flash instead of the 1KB byte table
+ */
+static const uint32_t crc32_nibble_tab[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+	0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+uint32_t crc32_update(uint32_t crc, const unsigned char *data, size_t len)
+{
+	crc = ~crc;
+	while (len--) {
+		crc ^= *data++;
+		crc = (crc >> 4) ^ crc32_nibble_tab[crc & 0x0F];
+		crc = (crc >> 4) ^ crc32_nibble_tab[crc & 0x0F];
+	}
+	return ~crc;
+}
+
+uint32_t crc32_finish(uint32_t crc)
+{
+	return swap_uint32(crc);
+}
+
+
 /***************************************
  * This part of the functionality uses STM32F1 CRC Hardware
  ***************************************/
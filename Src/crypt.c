@@ -1,11 +1,26 @@
+#include <stdbool.h>
 #include <string.h>
 #include "crypt.h"
 #include "aes.h"
+#include "btldr_status.h"
+#if (CONFIG_CRYPT_TTABLE > 0u)
+#include "aes_ttable.h"
+#endif
 
 
 static const uint8_t AES_INIT_IV[AES_IVLEN]    =    {0x84, 0x5E, 0xF4, 0x23, 0x36, 0x83, 0x40, 0x8E, 0x83, 0x22, 0x74, 0xCF, 0xF1, 0xF0, 0x07, 0xCC};
+#if (AES_CONST_ROUNDKEY > 0u)
+// Key schedule of AES_KEY expanded at build time, see tools/hex-crypt (hex_crypt -g / hex_crypt -t)
+#include "aes_roundkey.h"
+#else
 static const uint8_t AES_KEY[AES_KEYLEN]       =    {0x29, 0x76, 0xDE, 0xF0, 0x2A, 0xF4, 0x4E, 0xD7, 0xBE, 0x87, 0x1E, 0xA9, 0xDA, 0xB2, 0x5B, 0x24, \
                                                      0x3A, 0xCA, 0x66, 0x38, 0xA7, 0xF6, 0x44, 0x45, 0xB1, 0x2C, 0x5E, 0x86, 0xCB, 0x73, 0xBA, 0x2F};
+#endif
+
+// 100 steps of the 128-bit LFSR (taps 0, 34, 67, 71, 101, shift right, feedback into bit 127).
+// The feedback of step j is only tapped again 27 steps later, so 27 steps are done at once.
+#define LFSR_STEPS          100
+#define LFSR_BATCH          27
 
 static void gen_iv_by_lfsr(uint8_t *iv, uint32_t addr)
 {
@@ -19,30 +34,138 @@ static void gen_iv_by_lfsr(uint8_t *iv, uint32_t addr)
       iv[i+3] = ((addr >> 24) & 0xff) ^ AES_INIT_IV[i+3];
     }
     
-    uint32_t bit;     // Must be 32-bit to allow bit<<31 later in the code
-    uint8_t loop = 100;
+    uint32_t fb;
+    uint8_t n, k;
 
     uint32_t iv32[AES_IVLEN>>2];
     memcpy(iv32, iv, AES_IVLEN);
 
-    while (loop--)
+    for (n = LFSR_STEPS; n; n -= k)
     {
-        bit = ((iv32[0] >> 0) ^ (iv32[1] >> 2) ^ (iv32[2] >> 3) ^ (iv32[2] >> 7) ^ (iv32[3] >> 5)) & 1;
+        k = (n < LFSR_BATCH) ? n : LFSR_BATCH;
+        
+        fb = iv32[0] ^ ((iv32[1] >> 2) | (iv32[2] << 30)) ^ ((iv32[2] >> 3) | (iv32[3] << 29)) ^
+             ((iv32[2] >> 7) | (iv32[3] << 25)) ^ (iv32[3] >> 5);
+        fb &= (1ul << k) - 1;
     
-        iv32[0] = (iv32[0] >> 1) | (iv32[1] << 31);
-        iv32[1] = (iv32[1] >> 1) | (iv32[2] << 31);
-        iv32[2] = (iv32[2] >> 1) | (iv32[3] << 31);
-        iv32[3] = (iv32[3] >> 1) | (bit << 31);
-    };
+        iv32[0] = (iv32[0] >> k) | (iv32[1] << (32 - k));
+        iv32[1] = (iv32[1] >> k) | (iv32[2] << (32 - k));
+        iv32[2] = (iv32[2] >> k) | (iv32[3] << (32 - k));
+        iv32[3] = (iv32[3] >> k) | (fb << (32 - k));
+    }
     
     memcpy(iv, iv32, AES_IVLEN);
 }
 
 static struct AES_ctx ctx;
+static crypt_stats_t stats;
+
+// Keystream block of a 16 byte aligned address, AES(LFSR(INIT_IV ^ addr)), c->Iv is not used
+static void _crypt_keystream(const struct AES_ctx *c, uint8_t *ks, uint32_t addr)
+{
+    gen_iv_by_lfsr(ks, addr);
+#if (CONFIG_CRYPT_TTABLE > 0u)
+    aes_ttable_encrypt(c->RoundKey, ks);
+#else
+    AES_CTR_keystream(c, ks);
+#endif
+}
+
+#if (CONFIG_CRYPT_KEYSTREAM_AHEAD > 0u)
+
+#if (CONFIG_CRYPT_KEYSTREAM_AHEAD & (CONFIG_CRYPT_KEYSTREAM_AHEAD - 1))
+    #error "CONFIG_CRYPT_KEYSTREAM_AHEAD must be a power of 2"
+#endif
+
+// Encrypted hex is written in ascending address order, so the keystream of the next blocks is predictable.
+// The main loop fills the ring (producer), crypt_decrypt consumes it from the USB interrupt.
+// Entry is direct mapped by block address, valid is cleared before and set after the entry is written.
+typedef struct
+{
+    uint32_t addr;
+    uint8_t keystream[AES_BLOCKLEN];
+    volatile bool valid;
+}ks_entry_t;
+
+static ks_entry_t ks_ring[CONFIG_CRYPT_KEYSTREAM_AHEAD];
+static volatile uint32_t ks_next_addr;      // address of the block expected by the next crypt_decrypt
+
+#define KS_ENTRY(addr)      (&ks_ring[((addr) / AES_BLOCKLEN) & (CONFIG_CRYPT_KEYSTREAM_AHEAD - 1)])
+
+#endif
 
 void crypt_init()
 {
+#if (AES_CONST_ROUNDKEY > 0u)
+    AES_init_ctx_roundkey(&ctx, AES_ROUNDKEY);
+#else
     AES_init_ctx(&ctx, AES_KEY);
+#endif
+    memset(&stats, 0, sizeof(stats));
+#if (CONFIG_CRYPT_KEYSTREAM_AHEAD > 0u)
+    memset(ks_ring, 0, sizeof(ks_ring));
+#endif
+}
+
+void crypt_keystream_fill(void)
+{
+#if (CONFIG_CRYPT_KEYSTREAM_AHEAD > 0u)
+    uint32_t base = ks_next_addr;
+    uint32_t i;
+    
+    for(i=0; i<CONFIG_CRYPT_KEYSTREAM_AHEAD; i++)
+    {
+        uint32_t addr = base + i * AES_BLOCKLEN;
+        ks_entry_t *e = KS_ENTRY(addr);
+        
+        if(e->valid && e->addr == addr)
+        {
+            continue;
+        }
+        
+        e->valid = false;
+        __DMB();
+        e->addr = addr;
+        _crypt_keystream(&ctx, e->keystream, addr);
+        __DMB();
+        e->valid = true;
+        
+        if(base != ks_next_addr)    // consumer moved on, restart from the new position
+        {
+            break;
+        }
+    }
+#endif
+}
+
+const crypt_stats_t *crypt_get_stats(void)
+{
+    return &stats;
+}
+
+// Stateless variant for the service table, the context lives on the caller's stack.
+// Every 16 byte block gets the keystream of its own address like hex_crypt, not the
+// incremented counter of the first block.
+void crypt_xcrypt(uint8_t *buf, uint32_t size, uint32_t addr)
+{
+    struct AES_ctx c;
+    uint8_t ks[AES_BLOCKLEN];
+    uint32_t i;
+    uint8_t j;
+    
+#if (AES_CONST_ROUNDKEY > 0u)
+    AES_init_ctx_roundkey(&c, AES_ROUNDKEY);
+#else
+    AES_init_ctx(&c, AES_KEY);
+#endif
+    for(i=0; i<size; i+=AES_BLOCKLEN)
+    {
+        _crypt_keystream(&c, ks, addr + i);
+        for(j=0; j<AES_BLOCKLEN && i+j<size; j++)
+        {
+            buf[i+j] ^= ks[j];
+        }
+    }
 }
 
 inline void crypt_encrypt(uint8_t *buf, uint32_t size, uint32_t addr)
@@ -53,9 +176,69 @@ inline void crypt_encrypt(uint8_t *buf, uint32_t size, uint32_t addr)
 
 void crypt_decrypt(uint8_t *buf, uint32_t size, uint32_t addr)
 {
-    uint8_t new_iv[AES_IVLEN];
-    gen_iv_by_lfsr(new_iv, addr);
+    uint32_t start = STATUS_CYCCNT();
+    
+#if (CONFIG_CRYPT_KEYSTREAM_AHEAD > 0u)
+    if(size == AES_BLOCKLEN)
+    {
+        ks_entry_t *e = KS_ENTRY(addr);
+        
+        ks_next_addr = addr + AES_BLOCKLEN;
+        
+        if(e->valid && e->addr == addr)
+        {
+            uint8_t i;
+            for(i=0; i<AES_BLOCKLEN; i++)
+            {
+                buf[i] ^= e->keystream[i];
+            }
+            e->valid = false;
+            
+            stats.ks_hit++;
+            stats.ks_hit_cycles += STATUS_CYCCNT() - start;
+            return;
+        }
+    }
+#endif
+    
+    if(size == AES_BLOCKLEN)
+    {
+        uint8_t ks[AES_BLOCKLEN];
+        uint8_t i;
+        
+        _crypt_keystream(&ctx, ks, addr);
+        for(i=0; i<AES_BLOCKLEN; i++)
+        {
+            buf[i] ^= ks[i];
+        }
+    }
+    else
+    {
+        uint8_t new_iv[AES_IVLEN];
+        gen_iv_by_lfsr(new_iv, addr);
+        
+        AES_ctx_set_iv(&ctx, new_iv);
+        AES_CTR_xcrypt_buffer(&ctx, buf, size);
+    }
+    
+    stats.ks_miss++;
+    stats.ks_miss_cycles += STATUS_CYCCNT() - start;
+}
+
+// FIRMWARE.BIN readback, every 16 byte block is encrypted with the keystream of its flash
+// address like hex_crypt does, so "hex_crypt -r" gets the plain image back
+void crypt_readback(uint8_t *buf, uint32_t size, uint32_t addr)
+{
+    uint8_t ks[AES_BLOCKLEN];
+    uint32_t i;
+    uint8_t j;
     
-    AES_ctx_set_iv(&ctx, new_iv);
-    AES_CTR_xcrypt_buffer(&ctx, buf, size);
+    for(i=0; i<size; i+=AES_BLOCKLEN)
+    {
+        _crypt_keystream(&ctx, ks, addr + i);
+        for(j=0; j<AES_BLOCKLEN; j++)
+        {
+            buf[i+j] ^= ks[j];
+        }
+    }
 }
@@ -0,0 +1,147 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32f1xx.h"
+#include "btldr_config.h"
+#include "btldr_mailbox.h"
+#include "fast_boot.h"
+#include "flash_ll.h"
+#include "main.h"
+
+// Runs before the scatter loading: no RW/ZI variables, no HAL, the core runs from the
+// 8MHz HSI and all peripheral clocks are off.
+
+//-------------------------------------------------------
+
+#define APP_TOKEN_ERASED        0xFFFFFFFFul
+
+// Token = ~CRC32, written once the bootloader has verified the CRC32. 0 = invalidated,
+// the next erase of the last page makes it writable again.
+bool app_token_valid(void)
+{
+    return *(const uint32_t *)APP_TOKEN_ADDR == ~(*(const uint32_t *)CRC_ADDR);
+}
+
+void app_token_set(void)
+{
+#if (CONFIG_FAST_BOOT > 0u) && (BTLDR_ACT_CksNotVld > 0u)
+    uint32_t token = ~(*(const uint32_t *)CRC_ADDR);
+    bool was_locked;
+    
+    if(*(const uint32_t *)APP_TOKEN_ADDR != APP_TOKEN_ERASED)
+    {
+        return;
+    }
+    
+    was_locked = flash_ll_unlock();
+    flash_ll_program_halfword(APP_TOKEN_ADDR, (uint16_t)token);
+    flash_ll_program_halfword(APP_TOKEN_ADDR + 2, (uint16_t)(token >> 16));
+    if(was_locked)
+    {
+        flash_ll_lock();
+    }
+#endif
+}
+
+void app_token_clear(void)
+{
+#if (CONFIG_FAST_BOOT > 0u) && (BTLDR_ACT_CksNotVld > 0u)
+    uint32_t token = *(const uint32_t *)APP_TOKEN_ADDR;
+    bool was_locked;
+    
+    if(token == APP_TOKEN_ERASED || token == 0)
+    {
+        return;
+    }
+    
+    was_locked = flash_ll_unlock();
+    flash_ll_program_halfword(APP_TOKEN_ADDR, 0);           // 0 can be programmed over any value
+    flash_ll_program_halfword(APP_TOKEN_ADDR + 2, 0);
+    if(was_locked)
+    {
+        flash_ll_lock();
+    }
+#endif
+}
+
+#if (CONFIG_FAST_BOOT > 0u)
+
+#if (BTLDR_ACT_ButtonPress > 0u)
+// PA0 (BTLDR_EN) with the internal pull-up, GPIOA is put back to its reset state
+static bool _fast_boot_button_down(void)
+{
+    bool down;
+    uint8_t i;
+    
+    RCC->APB2ENR |= RCC_APB2ENR_IOPAEN;
+    (void)RCC->APB2ENR;
+    
+    GPIOA->BSRR = GPIO_BSRR_BS0;                                        // pull-up
+    GPIOA->CRL = (GPIOA->CRL & ~(GPIO_CRL_MODE0 | GPIO_CRL_CNF0)) | GPIO_CRL_CNF0_1;  // input pull-up/down
+    
+    for(i=0; i<40; i++)         // ~5us at 8MHz for the pin to settle
+    {
+        __NOP();
+    }
+    down = (GPIOA->IDR & GPIO_IDR_IDR0) == 0;
+    
+    GPIOA->CRL = (GPIOA->CRL & ~(GPIO_CRL_MODE0 | GPIO_CRL_CNF0)) | GPIO_CRL_CNF0_0;  // floating input
+    GPIOA->BRR = GPIO_BRR_BR0;
+    RCC->APB2ENR &= ~RCC_APB2ENR_IOPAEN;
+    
+    return down;
+}
+#endif
+
+void fast_boot(void)
+{
+#if (BTLDR_ACT_BootkeyDet > 0u)
+    if(bootkey_detected())
+    {
+        return;
+    }
+#endif
+#if (BTLDR_ACT_NoAppExist > 0u)
+    if(!is_appcode_exist())
+    {
+        return;
+    }
+#endif
+#if (BTLDR_ACT_CksNotVld > 0u)
+    if(!app_token_valid())      // the slow path verifies the CRC32 and sets the token
+    {
+        return;
+    }
+#endif
+#if (BTLDR_ACT_ButtonPress > 0u)
+    if(_fast_boot_button_down())
+    {
+        return;
+    }
+#endif
+    
+#if (CONFIG_STATUS_FILE > 0u)
+    BTLDR_MAILBOX->boot_us = DWT->CYCCNT / (HSI_VALUE / 1000000);
+#endif
+    jump_to_app();
+}
+
+#else
+
+void fast_boot(void)
+{
+}
+
+#endif
@@ -17,6 +17,13 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include "btldr_config.h"
 #include "fat32.h"
 #include "ihex_parser.h"
+#include "btldr_status.h"
+#include "flash_sink.h"
+#include "crc.h"
+#include "selfupdate.h"
+#include "ram_app.h"
+#include "pipeline.h"
+#include "uf2.h"
 #include "crypt.h"
 
 //-------------------------------------------------------
@@ -105,17 +112,85 @@ typedef struct
 
 //-------------------------------------------------------
 
-typedef union
-{
-  uint8_t buf[4];
-  uint32_t value32;
-}uint32x_t;               // used for flash align write
-
-//-------------------------------------------------------
-
 #define FAT32_DIR_ENTRY_ADDR         0x00400000
+#define FAT32_STATUS_TXT_ADDR        0x00500200      // cluster 0x803-0x804, tail of the FAT chain
 #define FAT32_README_TXT_ADDR        0x00400600
 #define FAT32_FIRMWARE_BIN_ADDR      0x00400800
+#define FAT32_PAGES_CRC_ADDR         0x00500000      // cluster 0x802
+
+#define FAT32_PAGES_CRC_SIZE         ((APP_SIZE / FLASH_SINK_PAGE_SIZE) * 4)
+#if (CONFIG_PAGES_CRC_FILE > 0u) && (FAT32_PAGES_CRC_SIZE > FAT32_SECTOR_SIZE)
+#error "PAGES.CRC is one sector"
+#endif
+
+//-------------------------------------------------------
+
+static flash_sink_t fat32_flash;
+static bool fat32_flash_dirty;
+static bool fat32_app_written;          // appcode records in this session
+static uint32_t fat32_erase_addr = APP_ADDR;
+static uint32_t fat32_erase_size = APP_SIZE;
+static uint32_t fat32_quarantined;      // written sectors that are not part of a hex file
+static uint32_t fat32_hex_rejected;     // hex files without a free stream, the session fails
+static uint32_t fat32_hex_rejected_next;    // sector following the last rejected one
+
+// One parser context per hex file of the session, a file is found by its directory entry
+// (first cluster, size) or by the sector following the last one it received
+typedef struct
+{
+    ihex_ctx_t ihex;
+    uint32_t first_addr;        // first sector of the file
+    uint32_t end_addr;          // 0 until the directory entry with the file size is seen
+    uint32_t next_addr;         // sector expected next in the stream
+    bool used;
+    bool data_seen;             // a data record was written, the image does not start here
+}fat32_hex_file_t;
+
+static fat32_hex_file_t fat32_hex_files[CONFIG_HEX_FILE_NBR];
+static fat32_hex_file_t *fat32_hex_cur;     // file being parsed, for the write callback
+static bool *fat32_data_seen;               // data_seen of the stream being decoded (hex or UF2)
+static uint32_t fat32_last_write;           // HAL tick of the last data sector
+static bool fat32_ejected;
+
+#if (CONFIG_SECTOR_FP_NBR > 0u)
+#if (CONFIG_SECTOR_FP_NBR & (CONFIG_SECTOR_FP_NBR - 1))
+    #error "CONFIG_SECTOR_FP_NBR must be a power of 2"
+#endif
+
+// Fingerprint of the data sectors written last, direct mapped by LBA
+typedef struct
+{
+    uint32_t addr;              // 0: empty
+    uint32_t hash;
+    fat32_hex_file_t *file;     // stream which parsed the sector, 0 if none
+}fat32_fp_t;
+
+static fat32_fp_t fat32_fp[CONFIG_SECTOR_FP_NBR];
+static uint32_t fat32_sector_dup;
+static uint32_t fat32_sector_rewrite;
+#endif
+
+#if (CONFIG_READ_FLASH > 0u)
+static fat32_readback_stats_t fat32_readback;
+static uint32_t fat32_readback_next;        // sector following the current sequential read
+static uint32_t fat32_readback_run;
+static uint32_t fat32_readback_run_tick;
+#endif
+
+#if (CONFIG_UF2 > 0u)
+#define FAT32_UF2_BLOCK_MAX         512     // blocks tracked one by one, 128KB with 256 byte payloads
+
+// A UF2 file is complete when numBlocks different blocks are received
+typedef struct
+{
+    uint32_t seen[FAT32_UF2_BLOCK_MAX / 32];
+    uint32_t blocks;
+    uint32_t total;
+    bool data_seen;
+}fat32_uf2_t;
+
+static fat32_uf2_t fat32_uf2;
+#endif
 
 //-------------------------------------------------------
 
@@ -285,6 +360,40 @@ static void _fat32_read_dir_entry(uint8_t *b)
     dir->DIR_FstClusLO = 0x0005;
     dir->DIR_FileSize = strlen(btldr_desc);
 
+#if (CONFIG_STATUS_FILE > 0u)
+    ++dir;
+
+    memcpy(dir->DIR_Name, "STATUS  TXT", 11);
+    dir->DIR_Attr = FAT32_ATTR_ARCHIVE | FAT32_ATTR_READ_ONLY;
+    dir->DIR_NTRes = 0x18;
+    dir->DIR_CrtTimeTenth = 0x00;
+    dir->DIR_CrtTime = FAT32_MAKE_TIME(0,0);
+    dir->DIR_CrtDate = FAT32_MAKE_DATE(28,04,2020);
+    dir->DIR_LstAccDate = FAT32_MAKE_DATE(28,04,2020);
+    dir->DIR_FstClusHI = 0x0000;
+    dir->DIR_WrtTime = FAT32_MAKE_TIME(0,0);
+    dir->DIR_WrtDate = FAT32_MAKE_DATE(28,04,2020);
+    dir->DIR_FstClusLO = 0x0803;
+    dir->DIR_FileSize = STATUS_FILE_SIZE;
+#endif
+
+#if (CONFIG_PAGES_CRC_FILE > 0u)
+    ++dir;
+
+    memcpy(dir->DIR_Name, "PAGES   CRC", 11);
+    dir->DIR_Attr = FAT32_ATTR_ARCHIVE | FAT32_ATTR_READ_ONLY;
+    dir->DIR_NTRes = 0x18;
+    dir->DIR_CrtTimeTenth = 0x00;
+    dir->DIR_CrtTime = FAT32_MAKE_TIME(0,0);
+    dir->DIR_CrtDate = FAT32_MAKE_DATE(28,04,2020);
+    dir->DIR_LstAccDate = FAT32_MAKE_DATE(28,04,2020);
+    dir->DIR_FstClusHI = 0x0000;
+    dir->DIR_WrtTime = FAT32_MAKE_TIME(0,0);
+    dir->DIR_WrtDate = FAT32_MAKE_DATE(28,04,2020);
+    dir->DIR_FstClusLO = 0x0802;
+    dir->DIR_FileSize = FAT32_PAGES_CRC_SIZE;
+#endif
+
 #if (CONFIG_READ_FLASH > 0u)
     ++dir;
     
@@ -316,109 +425,525 @@ static void _fat32_read_firmware(uint8_t *b, uint32_t addr)
     uint32_t offset = addr - FAT32_FIRMWARE_BIN_ADDR;
     uint32_t addr_end = MIN(offset + FAT32_SECTOR_SIZE, APP_SIZE);
     int32_t total_size = addr_end - offset;
+    uint32_t start = STATUS_CYCCNT();
+    uint32_t now = HAL_GetTick();
     
     memcpy(b, (void*)(APP_ADDR + offset), total_size);
+#if (CONFIG_SUPPORT_CRYPT_MODE > 0u) && (CONFIG_READ_FLASH_CRYPT > 0u)
+    crypt_readback(b, total_size, APP_ADDR + offset);
+#endif
+    
+    fat32_readback.sectors++;
+    fat32_readback.cycles += STATUS_CYCCNT() - start;
+    
+    // Line rate of the longest sequential read
+    if(addr != fat32_readback_next)
+    {
+        fat32_readback_run = 0;
+        fat32_readback_run_tick = now;
+    }
+    fat32_readback_next = addr + FAT32_SECTOR_SIZE;
+    if(++fat32_readback_run > fat32_readback.run_sectors)
+    {
+        fat32_readback.run_sectors = fat32_readback_run;
+        fat32_readback.run_ms = now - fat32_readback_run_tick;
+    }
 #else
     memset(b, 0x00, FAT32_SECTOR_SIZE);
 #endif
 }
 
-static bool _fat32_write_firmware(uint32_t phy_addr, const uint8_t *buf, uint8_t size)
+#if (CONFIG_PAGES_CRC_FILE > 0u)
+// Addr : 0x0050_0000
+// One CRC32 per 1KB page of the appcode area, stored as crc32_calculate() returns it
+// (the zlib CRC32 in big endian byte order in the file). Computed by the CRC unit, ~4ms.
+static void _fat32_read_pages_crc(uint8_t *b)
 {
-    bool return_status = true;
-  
-    HAL_StatusTypeDef status;
+    uint32_t i, crc;
     
-    HAL_FLASH_Unlock();
+    memset(b, 0x00, FAT32_SECTOR_SIZE);
+    for(i=0; i<(APP_SIZE / FLASH_SINK_PAGE_SIZE); i++)
+    {
+        crc = crc32_calculate((const uint8_t *)(APP_ADDR + i * FLASH_SINK_PAGE_SIZE), FLASH_SINK_PAGE_SIZE);
+        memcpy(&b[i * 4], &crc, 4);
+    }
+}
+#endif
+
+#if (CONFIG_SELF_UPDATE > 0u)
+// Bootloader records after appcode records: a mixed image, rejected
+static bool _fat32_write_btldr(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    if(fat32_app_written)
+    {
+        return false;
+    }
+    return selfupdate_write(addr, buf, size);
+}
+#endif
+
+#if (CONFIG_RAM_APP > 0u)
+static bool _fat32_write_ram(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+#if (CONFIG_SELF_UPDATE > 0u)
+    if(selfupdate_pending())
+    {
+        selfupdate_reject();
+        return false;
+    }
+#endif
+    return ram_app_write(addr, buf, size);      // false below the window (bootloader RAM)
+}
+#endif
+
+static bool _fat32_write_app(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+#if (CONFIG_SELF_UPDATE > 0u)
+    if(selfupdate_pending())
+    {
+        selfupdate_reject();    // appcode records after bootloader records: mixed image
+        return false;
+    }
+#endif
+    
+    if(addr == APP_ADDR && !*fat32_data_seen)
+    {
+        // A new image, erase the announced area (whole APPCODE area by default).
+        // Pages already erased by the mailbox pre-erase or written by another file of the
+        // session are skipped. APP_ADDR written a second time is a new copy of the image.
+        // A file which does not start at APP_ADDR (sparse update) only erases the pages it writes.
+        if(fat32_flash_dirty)
+        {
+            flash_sink_init(&fat32_flash);
+        }
+        
+        if(!flash_sink_erase(&fat32_flash, fat32_erase_addr, fat32_erase_size))
+        {
+            return false;
+        }
+        fat32_flash_dirty = true;
+    }
     
+    *fat32_data_seen = true;
+    fat32_app_written = true;
+    return flash_sink_write(&fat32_flash, addr, buf, size);
+}
+
+#if (CONFIG_SELF_UPDATE > 0u)
+static const pipe_sink_t fat32_btldr_sink = {FLASH_BASE, APP_OFFSET, _fat32_write_btldr, &pipe_stats_sink};
+#endif
+#if (CONFIG_RAM_APP > 0u)
+static const pipe_sink_t fat32_ram_sink = {SRAM_BASE, DEV_SRAM_SIZE, _fat32_write_ram, &pipe_stats_sink};
+#endif
+static const pipe_sink_t fat32_app_sink = {APP_ADDR, APP_SIZE, _fat32_write_app, &pipe_stats_sink};
+
+#if (CONFIG_PIPE_SINK == PIPE_SINK_VERIFY)
+static const pipe_sink_t * const fat32_sinks[] = {&pipe_verify_sink};
+#elif (CONFIG_PIPE_SINK == PIPE_SINK_NULL)
+static const pipe_sink_t * const fat32_sinks[] = {&pipe_null_sink};
+#else
+static const pipe_sink_t * const fat32_sinks[] =
+{
+#if (CONFIG_SELF_UPDATE > 0u)
+    &fat32_btldr_sink,
+#endif
+#if (CONFIG_RAM_APP > 0u)
+    &fat32_ram_sink,
+#endif
+    &fat32_app_sink,
+};
+#endif
+
+#if (CONFIG_PIPE_HASH > 0u)
+static const pipe_transform_t * const fat32_plain_transforms[] = {&pipe_crc32};
+static const pipe_t fat32_pipe = {fat32_plain_transforms, PIPE_NBR(fat32_plain_transforms), fat32_sinks, PIPE_NBR(fat32_sinks)};
+#else
+static const pipe_t fat32_pipe = {0, 0, fat32_sinks, PIPE_NBR(fat32_sinks)};
+#endif
+
+#if (CONFIG_SUPPORT_CRYPT_MODE > 0u)
+static const pipe_transform_t * const fat32_crypt_transforms[] =
+{
+    &pipe_decrypt,
+#if (CONFIG_PIPE_HASH > 0u)
+    &pipe_crc32,
+#endif
+};
+static const pipe_t fat32_crypt_pipe = {fat32_crypt_transforms, PIPE_NBR(fat32_crypt_transforms), fat32_sinks, PIPE_NBR(fat32_sinks)};
+#endif
+
+// Hex parser callback
+static bool _fat32_write_firmware(uint32_t phy_addr, const uint8_t *buf, uint8_t size)
+{
 #if (CONFIG_SUPPORT_CRYPT_MODE > 0u)
+    if(fat32_hex_cur->ihex.crypt_mode)
+    {
+        return pipe_push(&fat32_crypt_pipe, phy_addr, buf, size);
+    }
+#endif
+    return pipe_push(&fat32_pipe, phy_addr, buf, size);
+}
+
+#if (CONFIG_UF2 > 0u)
+static void _fat32_uf2_track(const uf2_block_t *blk)
+{
+    uint32_t n = blk->blockNo;
     
-    if(ihex_is_crypt_mode())
+    fat32_uf2.total = blk->numBlocks;
+    if(n >= FAT32_UF2_BLOCK_MAX)
+    {
+        fat32_uf2.blocks++;
+    }
+    else if(!(fat32_uf2.seen[n >> 5] & (1ul << (n & 31))))
     {
-      if(size != AES_BLOCKLEN)
-      {
-          return false;
-      }
-      
-      crypt_decrypt((uint8_t*)buf, size, phy_addr);
+        fat32_uf2.seen[n >> 5] |= 1ul << (n & 31);
+        fat32_uf2.blocks++;
     }
+}
 #endif
+
+static fat32_hex_file_t *_fat32_hex_file_new(uint32_t first_addr)
+{
+    uint8_t i;
+    fat32_hex_file_t *f = 0;
     
-    if(phy_addr == APP_ADDR)
+    for(i=0; i<CONFIG_HEX_FILE_NBR; i++)
     {
-        // Erase the APPCODE area
-        uint32_t PageError = 0;
-        FLASH_EraseInitTypeDef eraseinitstruct;
-        
-        eraseinitstruct.TypeErase = FLASH_TYPEERASE_PAGES;
-        eraseinitstruct.PageAddress = APP_ADDR;
-        eraseinitstruct.NbPages = APP_SIZE / FLASH_PAGE_SIZE;
-        status = HAL_FLASHEx_Erase(&eraseinitstruct, &PageError);
-        
-        if(status != HAL_OK)
+        if(!fat32_hex_files[i].used)
         {
-            return_status = false;
-            goto EXIT;
+            f = &fat32_hex_files[i];
+            break;
         }
     }
-      
-    if((phy_addr >= APP_ADDR) && ((phy_addr+size) <= (APP_ADDR + APP_SIZE)) )
+    
+    if(f == 0)
+    {
+        return 0;
+    }
+    
+    ihex_ctx_init(&f->ihex, _fat32_write_firmware);
+    f->first_addr = first_addr;
+    f->end_addr = 0;
+    f->next_addr = first_addr;
+    f->used = true;
+    f->data_seen = false;
+    return f;
+}
+
+// Announced by its directory entry, the data may come before or after it
+static void _fat32_hex_file_announce(uint32_t first_addr, uint32_t size)
+{
+    uint8_t i;
+    fat32_hex_file_t *f = 0;
+    
+    for(i=0; i<CONFIG_HEX_FILE_NBR; i++)
     {
-        uint8_t unalign = phy_addr & 0x03;    // support unalign write
-        uint32x_t content;
-      
-        if(unalign)
+        if(fat32_hex_files[i].used && fat32_hex_files[i].first_addr == first_addr)
         {
-            uint32_t prog_addr = phy_addr & ~(0x03);
-            uint8_t prog_size = MIN(size, 4-unalign);
-            
-            content.buf[0] = 0xFF;
-            content.buf[1] = 0xFF;
-            content.buf[2] = 0xFF;
-            content.buf[3] = 0xFF;
-        
-            uint8_t i;
-            for(i=0; i<prog_size; i++)
+            f = &fat32_hex_files[i];
+            break;
+        }
+#if (CONFIG_IHEX_SECTOR_ALIGNED > 0u)
+        // Aligned stream opened by a sector from the middle of the file
+        if(fat32_hex_files[i].used && fat32_hex_files[i].ihex.aligned && fat32_hex_files[i].end_addr == 0 &&
+           fat32_hex_files[i].first_addr > first_addr && fat32_hex_files[i].first_addr < first_addr + size)
+        {
+            f = &fat32_hex_files[i];
+            f->first_addr = first_addr;
+            break;
+        }
+#endif
+    }
+    
+    if(f == 0 && (f = _fat32_hex_file_new(first_addr)) == 0)
+    {
+        return;
+    }
+    
+    f->end_addr = first_addr + ((size + FAT32_SECTOR_SIZE - 1) & ~(FAT32_SECTOR_SIZE - 1));
+}
+
+#if (CONFIG_IHEX_SECTOR_ALIGNED > 0u)
+static bool _fat32_is_aligned_sector(const uint8_t *b)
+{
+    return memcmp(b, ":0100000F", 9) == 0;
+}
+#endif
+
+// No record of the sector spans into the next one
+static bool _fat32_is_whole_records(const uint8_t *b)
+{
+#if (CONFIG_IHEX_SECTOR_ALIGNED > 0u)
+    return _fat32_is_aligned_sector(b);
+#else
+    (void)b;
+    return false;
+#endif
+}
+
+static fat32_hex_file_t *_fat32_hex_file_find(const uint8_t *b, uint32_t addr)
+{
+    uint8_t i;
+    fat32_hex_file_t *f;
+    
+    for(i=0; i<CONFIG_HEX_FILE_NBR; i++)
+    {
+        f = &fat32_hex_files[i];
+        if(f->used && addr >= f->first_addr && addr < f->end_addr)
+        {
+            return f;
+        }
+    }
+    
+    for(i=0; i<CONFIG_HEX_FILE_NBR; i++)
+    {
+        f = &fat32_hex_files[i];
+        if(f->used && f->end_addr == 0 && !f->ihex.eof && addr == f->next_addr)
+        {
+            return f;
+        }
+    }
+    
+#if (CONFIG_IHEX_SECTOR_ALIGNED > 0u)
+    // Sectors of an aligned file not announced yet come in any order, all of them go to its stream
+    if(_fat32_is_aligned_sector(b))
+    {
+        for(i=0; i<CONFIG_HEX_FILE_NBR; i++)
+        {
+            f = &fat32_hex_files[i];
+            if(f->used && f->end_addr == 0 && f->ihex.aligned)
             {
-                content.buf[i+unalign] = *buf++;
-                ++phy_addr;
-                --size;
+                return f;
             }
-            HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, prog_addr, content.value32);
         }
-      
-        while(size >= 4)
+    }
+#endif
+    
+    // Start of a file not announced yet, otherwise same stream as the previous sector.
+    // Once a file was rejected, a sector without a stream may belong to it and is not guessed.
+    if(fat32_hex_rejected != 0 && addr == fat32_hex_rejected_next)
+    {
+        fat32_hex_rejected_next += FAT32_SECTOR_SIZE;
+        return 0;
+    }
+    if(b[0] == ':')
+    {
+        if((f = _fat32_hex_file_new(addr)) == 0)
         {
-            content.buf[0] = buf[0];
-            content.buf[1] = buf[1];
-            content.buf[2] = buf[2];
-            content.buf[3] = buf[3];
-            
-            HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, phy_addr, content.value32);
-            phy_addr += 4;
-            buf += 4;
-            size -= 4;
+            fat32_hex_rejected++;
+            fat32_hex_rejected_next = addr + FAT32_SECTOR_SIZE;
         }
-        
-        if(size)  // write remaining byte
+        return f;
+    }
+    return (fat32_hex_rejected == 0) ? fat32_hex_cur : 0;
+}
+
+#if (CONFIG_IHEX_RESYNC > 0u)
+// Only ':', CR, LF, hex digits and the zero padding after the end of the file
+static bool _fat32_is_hex_sector(const uint8_t *b)
+{
+    uint32_t i;
+    uint8_t c;
+    
+    for(i=0; i<FAT32_SECTOR_SIZE; i++)
+    {
+        c = b[i];
+        if(!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f') ||
+             c == ':' || c == '\r' || c == '\n' || c == '\0'))
         {
-            content.buf[0] = 0xFF;
-            content.buf[1] = 0xFF;
-            content.buf[2] = 0xFF;
-            content.buf[3] = 0xFF;
-            
-            uint8_t i;
-            for(i=0; i<size; i++)
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+#if (CONFIG_SECTOR_FP_NBR > 0u)
+// FNV-1a on 32-bit words, a few cycles per word
+static uint32_t _fat32_sector_hash(const uint8_t *b)
+{
+    const uint32_t *w = (const uint32_t *)b;
+    uint32_t h = 2166136261ul;
+    uint32_t i;
+    
+    for(i=0; i<FAT32_SECTOR_SIZE/4; i++)
+    {
+        h = (h ^ w[i]) * 16777619ul;
+    }
+    return h;
+}
+#endif
+
+// Data area sector. *file is the stream of a rewritten sector on entry (0 otherwise) and
+// the stream which parsed the sector on return.
+static bool _fat32_write_sector(const uint8_t *b, uint32_t addr, fat32_hex_file_t **file)
+{
+    fat32_hex_file_t *rewrite = *file;
+    bool ok;
+    
+    *file = 0;
+    
+#if (CONFIG_UF2 > 0u)
+    if(uf2_is_block(b))
+    {
+        _fat32_uf2_track((const uf2_block_t *)b);
+        fat32_data_seen = &fat32_uf2.data_seen;
+        fat32_last_write = HAL_GetTick();
+        return pipe_decode(&pipe_uf2_decoder, (void *)&fat32_pipe, b, FAT32_SECTOR_SIZE);
+    }
+#endif
+#if (CONFIG_IHEX_RESYNC > 0u)
+    // Metadata or other files written to the data area are not fed to the parser,
+    // the parser state is kept so a record split across this sector still completes
+    if(!_fat32_is_hex_sector(b))
+    {
+        fat32_quarantined++;
+        return true;
+    }
+#endif
+    if(rewrite != 0)
+    {
+        if((addr + FAT32_SECTOR_SIZE) != rewrite->next_addr && !_fat32_is_whole_records(b))
+        {
+            // Not the last sector of the stream: the record spanning into the next sector
+            // cannot be parsed again, fail the stream instead of losing it
+            rewrite->ihex.failed = true;
+            *file = rewrite;
+            return false;
+        }
+        // Parsed again from its first line, the flash sink skips the half-words which
+        // already hold the same value
+        fat32_hex_cur = rewrite;
+        ihex_ctx_rewind(&rewrite->ihex, b[0] == ':');
+    }
+    else
+    {
+        fat32_hex_cur = _fat32_hex_file_find(b, addr);
+        if(fat32_hex_cur == 0)
+        {
+            if(fat32_hex_rejected != 0)
             {
-                content.buf[i] = *buf++;
+                return false;           // more files than CONFIG_HEX_FILE_NBR
             }
-            HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, phy_addr, content.value32);
+            fat32_quarantined++;
+            return true;
+        }
+        fat32_hex_cur->next_addr = addr + FAT32_SECTOR_SIZE;
+#if (CONFIG_IHEX_SECTOR_ALIGNED > 0u)
+        if(_fat32_is_aligned_sector(b))
+        {
+            // No record spans the sector boundary, drop what the previous sector left
+            ihex_ctx_rewind(&fat32_hex_cur->ihex, true);
+        }
+#endif
+    }
+    
+    fat32_data_seen = &fat32_hex_cur->data_seen;
+    fat32_last_write = HAL_GetTick();
+    ok = pipe_decode(&pipe_hex_decoder, &fat32_hex_cur->ihex, b, FAT32_SECTOR_SIZE);
+    
+    if(rewrite != 0 && (addr + FAT32_SECTOR_SIZE) != rewrite->next_addr)
+    {
+        // Aligned sector in the middle of the stream, the one at next_addr starts a line as well
+        ihex_ctx_rewind(&rewrite->ihex, true);
+    }
+    
+    *file = fat32_hex_cur;
+    return ok;
+}
+
+//-------------------------------------------------------
+
+// Area erased when the image starts at APP_ADDR, set from the mailbox
+void fat32_set_erase_region(uint32_t addr, uint32_t size)
+{
+    fat32_erase_addr = addr;
+    fat32_erase_size = size;
+}
+
+// Called from the main loop, one page per call so the USB interrupt keeps running
+bool fat32_pre_erase_page(uint32_t addr)
+{
+    return flash_sink_erase(&fat32_flash, addr, 1);
+}
+
+const flash_sink_t *fat32_get_flash_stats(void)
+{
+    return &fat32_flash;
+}
+
+void fat32_get_hex_stats(fat32_hex_stats_t *st)
+{
+    uint8_t i;
+    const fat32_hex_file_t *f;
+    
+    memset(st, 0, sizeof(fat32_hex_stats_t));
+    st->quarantined = fat32_quarantined;
+    st->rejected = fat32_hex_rejected;
+    st->failed = (fat32_hex_rejected != 0);
+#if (CONFIG_SECTOR_FP_NBR > 0u)
+    st->sectors_duplicate = fat32_sector_dup;
+    st->sectors_rewritten = fat32_sector_rewrite;
+#endif
+    
+    for(i=0; i<CONFIG_HEX_FILE_NBR; i++)
+    {
+        f = &fat32_hex_files[i];
+        if(f->used)
+        {
+            st->files++;
+            st->files_done += f->ihex.eof;
+            st->failed |= f->ihex.failed;
+            st->skipped_bytes += f->ihex.skipped_bytes;
+            st->records_dropped += f->ihex.resync_nbr;
         }
     }
     
-EXIT:
-    HAL_FLASH_Lock();
-    return return_status;
+#if (CONFIG_UF2 > 0u)
+    if(fat32_uf2.total != 0)
+    {
+        st->files++;
+        st->files_done += (fat32_uf2.blocks >= fat32_uf2.total);
+    }
+#endif
+}
+
+bool fat32_is_crypt_mode(void)
+{
+    return (fat32_hex_cur != 0) && fat32_hex_cur->ihex.crypt_mode;
+}
+
+// Every file of the session reached its EOF record and the host stopped writing, or the
+// host ejected the drive after at least one complete file. A failed or rejected file keeps
+// the bootloader in USB mode, the reset would start a broken image and lose STATUS.TXT.
+bool fat32_session_is_done(void)
+{
+    fat32_hex_stats_t st;
+    
+    fat32_get_hex_stats(&st);
+    if(st.files_done == 0 || st.failed || st.rejected != 0)
+    {
+        return false;
+    }
+    
+    if(fat32_ejected)
+    {
+        return true;
+    }
+    
+    return (st.files_done == st.files) && ((HAL_GetTick() - fat32_last_write) >= CONFIG_HEX_SESSION_IDLE_MS);
+}
+
+#if (CONFIG_READ_FLASH > 0u)
+const fat32_readback_stats_t *fat32_get_readback_stats(void)
+{
+    return &fat32_readback;
+}
+#endif
+
+void fat32_eject(void)
+{
+    fat32_ejected = true;
 }
 
 //-------------------------------------------------------
@@ -434,6 +959,7 @@ bool fat32_read(uint8_t *b, uint32_t addr)
     
     if(addr == 0x0000 || addr == 0x0C00)
     {
+        status_timestamp(STATUS_TS_BOOT_SECTOR);
         _fat32_read_bpb(b);
     }
     else if(addr == 0x0200 || addr == 0x0E00)
@@ -450,8 +976,21 @@ bool fat32_read(uint8_t *b, uint32_t addr)
     }
     else if(addr == FAT32_DIR_ENTRY_ADDR)
     {
+        status_timestamp(STATUS_TS_ROOT_DIR);
         _fat32_read_dir_entry(b);
     }
+#if (CONFIG_STATUS_FILE > 0u)
+    else if(addr >= FAT32_STATUS_TXT_ADDR && addr < (FAT32_STATUS_TXT_ADDR+STATUS_FILE_SIZE))
+    {
+        status_render(b, addr - FAT32_STATUS_TXT_ADDR);
+    }
+#endif
+#if (CONFIG_PAGES_CRC_FILE > 0u)
+    else if(addr == FAT32_PAGES_CRC_ADDR)
+    {
+        _fat32_read_pages_crc(b);
+    }
+#endif
     else if(addr >= FAT32_README_TXT_ADDR && addr < (FAT32_README_TXT_ADDR+FAT32_SECTOR_SIZE))
     {
         _fat32_read_btldr_desc(b, addr);
@@ -489,21 +1028,48 @@ bool fat32_write(const uint8_t *b, uint32_t addr)
             
             uint8_t *filename = entry->DIR_Name;
 
-            if(filename[8] == 'H' && filename[9] == 'E' && filename[10] == 'X')
+            if(filename[8] == 'H' && filename[9] == 'E' && filename[10] == 'X' &&
+               filename[0] != 0xE5 && entry->DIR_Attr != FAT32_ATTR_LONG_NAME)     // not deleted
             {
-                ihex_reset_state();
+                uint32_t clus = (((uint32_t)(entry->DIR_FstClusHI)) << 16) | entry->DIR_FstClusLO;
                 
-                // uint32_t clus = (((uint32_t)(entry->DIR_FstClusHI)) << 16) | entry->DIR_FstClusLO;
-              
-                // fw_addr_range.begin = ((clus-2) + 0x2000 ) * FAT32_SECTOR_SIZE;
-                // fw_addr_range.end = fw_addr_range.begin + entry->DIR_FileSize;       // don't know the size of HEX file
+                if(clus >= 2 && entry->DIR_FileSize != 0)       // clusters allocated
+                {
+                    _fat32_hex_file_announce(FAT32_DIR_ENTRY_ADDR + (clus - 2) * FAT32_SECTOR_SIZE, entry->DIR_FileSize);
+                }
             }
         }
     }
     else
     {
-        ihex_set_callback_func(_fat32_write_firmware);
-        ihex_parser(b, FAT32_SECTOR_SIZE);
+        fat32_hex_file_t *file = 0;
+#if (CONFIG_SECTOR_FP_NBR > 0u)
+        // Hosts retry WRITE10 after a timeout or rewrite the last partial cluster of a file.
+        // The same content again is skipped, other content is parsed again by its stream.
+        fat32_fp_t *fp = &fat32_fp[(addr / FAT32_SECTOR_SIZE) & (CONFIG_SECTOR_FP_NBR - 1)];
+        uint32_t hash = _fat32_sector_hash(b);
+        bool ok;
+        
+        if(fp->addr == addr)
+        {
+            if(fp->hash == hash)
+            {
+                fat32_sector_dup++;
+                fat32_last_write = HAL_GetTick();
+                return true;
+            }
+            fat32_sector_rewrite++;
+            file = fp->file;
+        }
+        
+        ok = _fat32_write_sector(b, addr, &file);
+        fp->addr = ok ? addr : 0;       // a failed sector is not skipped when it is retried
+        fp->hash = hash;
+        fp->file = file;
+        return ok;
+#else
+        return _fat32_write_sector(b, addr, &file);
+#endif
     }
     
     return true;
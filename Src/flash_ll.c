@@ -0,0 +1,77 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32f1xx.h"
+#include "flash_ll.h"
+
+//-------------------------------------------------------
+
+static bool _flash_ll_wait(void)
+{
+    uint32_t sr;
+    
+    while(FLASH->SR & FLASH_SR_BSY)
+    {
+    }
+    
+    sr = FLASH->SR;
+    FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;     // write 1 to clear
+    
+    return (sr & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR)) == 0;
+}
+
+//-------------------------------------------------------
+
+// Returns true if the flash was locked before the call
+bool flash_ll_unlock(void)
+{
+    if(FLASH->CR & FLASH_CR_LOCK)
+    {
+        FLASH->KEYR = FLASH_KEY1;
+        FLASH->KEYR = FLASH_KEY2;
+        return true;
+    }
+    return false;
+}
+
+void flash_ll_lock(void)
+{
+    FLASH->CR |= FLASH_CR_LOCK;
+}
+
+bool flash_ll_erase_page(uint32_t addr)
+{
+    bool ok;
+    
+    FLASH->CR |= FLASH_CR_PER;
+    FLASH->AR = addr;
+    FLASH->CR |= FLASH_CR_STRT;
+    ok = _flash_ll_wait();
+    FLASH->CR &= ~FLASH_CR_PER;
+    
+    return ok;
+}
+
+bool flash_ll_program_halfword(uint32_t addr, uint16_t value)
+{
+    bool ok;
+    
+    FLASH->CR |= FLASH_CR_PG;
+    *(volatile uint16_t*)addr = value;
+    ok = _flash_ll_wait();
+    FLASH->CR &= ~FLASH_CR_PG;
+    
+    return ok;
+}
@@ -0,0 +1,257 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "stm32f1xx.h"
+#include "btldr_config.h"
+#include "flash_ll.h"
+#include "flash_sink.h"
+#include "fast_boot.h"
+
+//-------------------------------------------------------
+
+#define PAGE_INDEX(addr)            (((addr) - FLASH_BASE) / FLASH_SINK_PAGE_SIZE)
+
+static bool _flash_sink_test(const flash_sink_t *s, uint32_t page)
+{
+    return (s->erased[page >> 5] & (1ul << (page & 31))) != 0;
+}
+
+// Pages are erased from the main loop (pre-erase) and from the USB interrupt (lazy erase
+// on first write), the check-erase-mark sequence must not be split by the interrupt.
+static bool _flash_sink_erase_page(flash_sink_t *s, uint32_t page)
+{
+    bool ok = true;
+    bool was_locked;
+    uint32_t primask = __get_PRIMASK();
+    
+    __disable_irq();
+    
+    if(_flash_sink_test(s, page))
+    {
+        ++s->page_erase_skip;
+    }
+    else
+    {
+        ++s->page_erase;
+        app_token_clear();          // before the first change, an interrupted update must not fast boot
+        was_locked = flash_ll_unlock();
+        ok = flash_ll_erase_page(FLASH_BASE + page * FLASH_SINK_PAGE_SIZE);
+        if(was_locked)
+        {
+            flash_ll_lock();
+        }
+        if(ok)
+        {
+            s->erased[page >> 5] |= 1ul << (page & 31);
+        }
+        else
+        {
+            ++s->page_erase_err;
+        }
+    }
+    
+    __set_PRIMASK(primask);
+    return ok;
+}
+
+// A half-word can only be programmed once after the erase (PGERR otherwise). Data written
+// twice (host rewrites a sector, overlapping records with the same content) is skipped.
+// mask: bytes of the half-word that belong to the write, the other one is 0xFF padding.
+// A half-word already programmed with other data fails the write, the hex stream is failed.
+static bool _flash_sink_program(flash_sink_t *s, uint32_t addr, uint16_t value, uint16_t mask)
+{
+    uint16_t current = *(volatile const uint16_t *)addr;
+    
+    if(((current ^ value) & mask) == 0)
+    {
+        if((value & mask) == mask)
+        {
+            ++s->prog_ones;     // all-ones on an erased cell, nothing to program
+        }
+        else
+        {
+            ++s->prog_same;
+        }
+        return true;
+    }
+    if(current != 0xFFFF)
+    {
+        ++s->prog_conflict;
+        return false;
+    }
+    
+    ++s->prog_halfword;
+    if(!flash_ll_program_halfword(addr, value))
+    {
+        ++s->prog_err;
+        return false;
+    }
+    return true;
+}
+
+// Length of the all-ones run at buf in whole half-words whose flash cells at addr are still
+// erased, compared a word at a time. Fill patterns (srec_cat -fill 0xFF, hex_crypt padding)
+// skip the program loop this way. A programmed cell ends the run, _flash_sink_program flags it.
+static uint32_t _flash_sink_ones(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    uint32_t n = 0;
+    uint32_t word, cell;
+    
+    while(n + 4 <= size)
+    {
+        memcpy(&word, buf + n, 4);
+        memcpy(&cell, (const void *)(addr + n), 4);
+        if((word & cell) != 0xFFFFFFFFul)
+        {
+            break;
+        }
+        n += 4;
+    }
+    if(n + 2 <= size && buf[n] == 0xFF && buf[n + 1] == 0xFF && *(volatile const uint16_t *)(addr + n) == 0xFFFF)
+    {
+        n += 2;
+    }
+    return n;
+}
+
+//-------------------------------------------------------
+
+void flash_sink_init(flash_sink_t *s)
+{
+    memset(s, 0, sizeof(flash_sink_t));
+}
+
+bool flash_sink_is_erased(const flash_sink_t *s, uint32_t addr)
+{
+    return _flash_sink_test(s, PAGE_INDEX(addr));
+}
+
+bool flash_sink_erase(flash_sink_t *s, uint32_t addr, uint32_t size)
+{
+    bool ok = true;
+    uint32_t page;
+    
+    if(size == 0)
+    {
+        return true;
+    }
+    
+    for(page = PAGE_INDEX(addr); page <= PAGE_INDEX(addr + size - 1); page++)
+    {
+        if(!_flash_sink_erase_page(s, page))
+        {
+            ok = false;
+            break;
+        }
+    }
+    
+    return ok;
+}
+
+// Erase the page even if it was erased in this session and program it
+bool flash_sink_program_page(flash_sink_t *s, uint32_t addr, const uint8_t *buf)
+{
+    uint32_t page = PAGE_INDEX(addr);
+    
+    s->erased[page >> 5] &= ~(1ul << (page & 31));
+    
+    if(!_flash_sink_erase_page(s, page))
+    {
+        return false;
+    }
+    return flash_sink_write(s, FLASH_BASE + page * FLASH_SINK_PAGE_SIZE, buf, FLASH_SINK_PAGE_SIZE);
+}
+
+// Unaligned bytes are padded with 0xFF. Pages not erased in this session are erased
+// before the first write. Called from the USB interrupt only.
+bool flash_sink_write(flash_sink_t *s, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    bool ok = true;
+    uint32_t page_end = 0;
+    bool was_locked;
+    
+    app_token_clear();              // sparse updates and raw LUN pages change the image as well
+    was_locked = flash_ll_unlock();
+    
+    while(size)
+    {
+        uint16_t value = 0xFFFF;
+        uint16_t mask = 0xFFFF;
+        uint32_t prog_addr = addr & ~1ul;
+        
+        if(addr >= page_end)
+        {
+            uint32_t page = PAGE_INDEX(addr);
+            
+            if(!_flash_sink_test(s, page) && !_flash_sink_erase_page(s, page))
+            {
+                ok = false;
+                break;
+            }
+            page_end = FLASH_BASE + (page + 1) * FLASH_SINK_PAGE_SIZE;
+        }
+        
+        if(!(addr & 1))
+        {
+            // The page is erased at this point, the run stops at its end so the next page is erased too
+            uint32_t run = _flash_sink_ones(addr, buf, (size < page_end - addr) ? size : (page_end - addr));
+            
+            if(run)
+            {
+                s->prog_ones += run >> 1;
+                buf += run;
+                addr += run;
+                size -= run;
+                continue;
+            }
+        }
+        
+        if(addr & 1)
+        {
+            value = 0x00FF | ((uint16_t)buf[0] << 8);
+            mask = 0xFF00;
+            ++buf;
+            ++addr;
+            --size;
+        }
+        else if(size == 1)
+        {
+            value = 0xFF00 | buf[0];
+            mask = 0x00FF;
+            ++buf;
+            ++addr;
+            --size;
+        }
+        else
+        {
+            value = buf[0] | ((uint16_t)buf[1] << 8);
+            buf += 2;
+            addr += 2;
+            size -= 2;
+        }
+        
+        if(!_flash_sink_program(s, prog_addr, value, mask))
+        {
+            ok = false;
+            break;
+        }
+    }
+    
+    if(was_locked)
+    {
+        flash_ll_lock();
+    }
+    return ok;
+}
@@ -36,6 +36,7 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEAL
 #define DATA_STATE              9
 #define CHECKSUM_0_STATE        10
 #define CHECKSUM_1_STATE        11
+#define RESYNC_STATE            12      // discard up to the next '\n'
 
 //-------------------------------------------------------
 
@@ -46,11 +47,11 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEAL
 #define RECORD_TYPE_EX_LIN_ADDR     0x04
 #define RECORD_TYPE_START_LIN_ADDR  0x05
 #define RECORD_TYPE_CRYPT_MODE      0x0E
+#define RECORD_TYPE_SECTOR_HDR      0x0F        // first record of each sector of a sector aligned file, data[0] bit0: crypt mode
 
 //-------------------------------------------------------
 
 #define INVALID_HEX_CHAR        'x'
-#define IHEX_DATA_SIZE          255
 
 //-------------------------------------------------------
 
@@ -66,53 +67,58 @@ static uint8_t HexToDec(uint8_t h)
         return INVALID_HEX_CHAR;
 }
 
-static uint8_t state;
-static uint8_t byte_count;
-static uint16_t address_lo;
-static uint16_t address_hi;
-static bool ex_segment_addr_mode = false;
-static uint8_t record_type;
-static uint8_t data[IHEX_DATA_SIZE];
-static uint16_t data_size_in_nibble;
+#define TRANSFORM_ADDR(ctx)     ((ctx)->ex_segment_addr_mode) ?                                      \
+                                ( (((uint32_t)((ctx)->address_hi)) << 4) + ((uint32_t)((ctx)->address_lo)) ): \
+                                ( (((uint32_t)((ctx)->address_hi)) << 16) | ((uint32_t)((ctx)->address_lo)) )
 
-static uint8_t temp_cs;         // save checksum high byte
-static uint8_t calc_cs;         // calculate checksum
-static bool calc_cs_toogle = false;
 
-static ihex_callback_fp callback_fp = 0;
-static bool crypt_mode = false;     // extend the intex hex file format to support encryption
-static bool ihex_eof_trig = false;
-
-#define TRANSFORM_ADDR(addr_hi, addr_lo)       (ex_segment_addr_mode) ?                                  \
-                                                ( (((uint32_t)(addr_hi)) << 4) + ((uint32_t)(addr_lo)) ): \
-                                                ( (((uint32_t)(addr_hi)) << 16) | ((uint32_t)(addr_lo)) )
-
-
-void ihex_reset_state()
+void ihex_ctx_init(ihex_ctx_t *ctx, ihex_callback_fp fp)
 {
-    state = 0;
-    address_lo = 0;
-    address_hi = 0;
-    ex_segment_addr_mode = false;
-    crypt_mode = false;
-    ihex_eof_trig = false;
+    ctx->state = 0;
+    ctx->address_lo = 0;
+    ctx->address_hi = 0;
+    ctx->ex_segment_addr_mode = false;
+    ctx->crypt_mode = false;
+    ctx->eof = false;
+    ctx->aligned = false;
+    ctx->callback_fp = fp;
+    ctx->resync = (CONFIG_IHEX_RESYNC > 0u);
+    ctx->failed = false;
+    ctx->skipped_bytes = 0;
+    ctx->resync_nbr = 0;
 }
 
-void ihex_set_callback_func(ihex_callback_fp fp)
+// The next sector is a rewrite of one already parsed: the record in progress is dropped,
+// the sector is parsed from its first line start
+void ihex_ctx_rewind(ihex_ctx_t *ctx, bool line_start)
 {
-    callback_fp = fp;
+    ctx->state = line_start ? START_CODE_STATE : RESYNC_STATE;
 }
 
-bool ihex_is_crypt_mode()
+// Broken record: wait for the next line, or stop if resync is disabled
+static bool _ihex_record_error(ihex_ctx_t *ctx, uint8_t c)
 {
-    return crypt_mode;
+    if(!ctx->resync)
+    {
+        return false;
+    }
+    
+    ++ctx->resync_nbr;
+    ctx->state = (c == '\n') ? START_CODE_STATE : RESYNC_STATE;
+    return true;
 }
 
-bool ihex_parser(const uint8_t *steambuf, uint32_t size)
+// No global state, the bootloader service table exports this to the application
+bool ihex_ctx_parse(ihex_ctx_t *ctx, const uint8_t *steambuf, uint32_t size)
 {
     uint32_t i;
     uint8_t c, hc;
     
+    if (ctx->failed)
+    {
+        return false;
+    }
+    
     for (i = 0; i<size; i++)
     {
         c = steambuf[i];
@@ -122,30 +128,44 @@ bool ihex_parser(const uint8_t *steambuf, uint32_t size)
             return true;
         }
 
-        if (state == START_CODE_STATE)
+        if (ctx->state == RESYNC_STATE)
+        {
+            ++ctx->skipped_bytes;
+            if (c == '\n')
+            {
+                ctx->state = START_CODE_STATE;
+            }
+            continue;
+        }
+
+        if (ctx->state == START_CODE_STATE)
         {
-            calc_cs = 0x00;
-            calc_cs_toogle = false;
+            ctx->calc_cs = 0x00;
+            ctx->calc_cs_toogle = false;
         }
-        else if (state >= BYTE_COUNT_0_STATE && state <= CHECKSUM_1_STATE)
+        else if (ctx->state >= BYTE_COUNT_0_STATE && ctx->state <= CHECKSUM_1_STATE)
         {
             if ((hc = HexToDec(c)) == INVALID_HEX_CHAR)
             {
-                return false;
+                if (!_ihex_record_error(ctx, c))
+                {
+                    return false;
+                }
+                continue;
             }
 
-            if (!calc_cs_toogle)
+            if (!ctx->calc_cs_toogle)
             {
-                temp_cs = hc;
+                ctx->temp_cs = hc;
             }
             else
             {
-                calc_cs += (temp_cs << 4) | hc;
+                ctx->calc_cs += (ctx->temp_cs << 4) | hc;
             }
-            calc_cs_toogle = !calc_cs_toogle;
+            ctx->calc_cs_toogle = !ctx->calc_cs_toogle;
         }
 
-        switch (state)
+        switch (ctx->state)
         {
         case START_CODE_STATE:
             if (c == '\r' || c == '\n')
@@ -154,23 +174,27 @@ bool ihex_parser(const uint8_t *steambuf, uint32_t size)
             }
             else if (c == ':')
             {
-                byte_count = 0;
-                record_type = RECORD_TYPE_DATA;
-                address_lo = 0x0000;
-                memset(data, 0, sizeof(data));
-                data_size_in_nibble = 0;
-                ++state;
+                ctx->byte_count = 0;
+                ctx->record_type = RECORD_TYPE_DATA;
+                ctx->address_lo = 0x0000;
+                memset(ctx->data, 0, sizeof(ctx->data));
+                ctx->data_size_in_nibble = 0;
+                ++ctx->state;
             }
             else
             {
-                return false;
+                if (!_ihex_record_error(ctx, c))
+                {
+                    return false;
+                }
+                ++ctx->skipped_bytes;
             }
             break;
 
         case BYTE_COUNT_0_STATE:
         case BYTE_COUNT_1_STATE:
-            byte_count = (byte_count << 4) | hc;
-            ++state;
+            ctx->byte_count = (ctx->byte_count << 4) | hc;
+            ++ctx->state;
             break;
 
         case ADDR_0_STATE:
@@ -178,99 +202,117 @@ bool ihex_parser(const uint8_t *steambuf, uint32_t size)
         case ADDR_2_STATE:
         case ADDR_3_STATE:
         {
-            address_lo = ((address_lo << 4) | hc);   // only alter lower 16-bit address
-            ++state;
+            ctx->address_lo = ((ctx->address_lo << 4) | hc);   // only alter lower 16-bit address
+            ++ctx->state;
             break;
         }
         
         case RECORD_TYPE_0_STATE:
             if (hc != 0)
             {
-                return false;
+                if (!_ihex_record_error(ctx, c))
+                {
+                    return false;
+                }
+                continue;
             }
-            ++state;
+            ++ctx->state;
             break;
 
         case RECORD_TYPE_1_STATE:
-            if ( !(hc <= RECORD_TYPE_START_LIN_ADDR || hc == RECORD_TYPE_CRYPT_MODE) )
+            if ( !(hc <= RECORD_TYPE_START_LIN_ADDR || hc == RECORD_TYPE_CRYPT_MODE || hc == RECORD_TYPE_SECTOR_HDR) )
             {
-                return false;
+                if (!_ihex_record_error(ctx, c))
+                {
+                    return false;
+                }
+                continue;
             }
             
-            record_type = hc;
+            ctx->record_type = hc;
 
-            if (byte_count == 0)
+            if (ctx->byte_count == 0)
             {
-                state = CHECKSUM_0_STATE;
-            }
-            else if (byte_count > sizeof(data))
-            {
-                return false;
+                ctx->state = CHECKSUM_0_STATE;
             }
             else
             {
-                ++state;
+                ++ctx->state;
             }
 
             break;
 
         case DATA_STATE:
         {
-            uint8_t b_index = data_size_in_nibble >> 1;
-            data[b_index] = (data[b_index] << 4) | hc;
+            uint8_t b_index = ctx->data_size_in_nibble >> 1;
+            ctx->data[b_index] = (ctx->data[b_index] << 4) | hc;
 
-            ++data_size_in_nibble;
-            if ((data_size_in_nibble >> 1) >= byte_count)
+            ++ctx->data_size_in_nibble;
+            if ((ctx->data_size_in_nibble >> 1) >= ctx->byte_count)
             {
-                ++state;
+                ++ctx->state;
             }
             break;
         }
         
         case CHECKSUM_0_STATE:
-            ++state;
+            ++ctx->state;
             break;
 
         case CHECKSUM_1_STATE:
-            if((byte_count<<1) != data_size_in_nibble)  // Check whether byte count field match the data size 
+            if((ctx->byte_count<<1) != ctx->data_size_in_nibble)  // Check whether byte count field match the data size 
             {
-                return false;
+                if (!_ihex_record_error(ctx, c))
+                {
+                    return false;
+                }
+                continue;
             }
             
-            if (calc_cs != 0x00)
+            if (ctx->calc_cs != 0x00)
             {
-                return false;
+                if (!_ihex_record_error(ctx, c))
+                {
+                    return false;
+                }
+                continue;
             }
 
-            if (record_type == RECORD_TYPE_EX_SEG_ADDR)           // Set extended segment addresss
+            if (ctx->record_type == RECORD_TYPE_EX_SEG_ADDR)           // Set extended segment addresss
             {
-                address_hi = ((uint16_t)data[0] << 8) | (data[1]);
-                ex_segment_addr_mode = true;
+                ctx->address_hi = ((uint16_t)ctx->data[0] << 8) | (ctx->data[1]);
+                ctx->ex_segment_addr_mode = true;
             }
-            else if (record_type == RECORD_TYPE_EX_LIN_ADDR)      // Set linear addresss
+            else if (ctx->record_type == RECORD_TYPE_EX_LIN_ADDR)      // Set linear addresss
             {
-                address_hi = ((uint16_t)data[0] << 8) | (data[1]);
-                ex_segment_addr_mode = false;
+                ctx->address_hi = ((uint16_t)ctx->data[0] << 8) | (ctx->data[1]);
+                ctx->ex_segment_addr_mode = false;
             }
 
-            if (record_type == RECORD_TYPE_DATA && callback_fp != 0)
+            if (ctx->record_type == RECORD_TYPE_DATA && ctx->callback_fp != 0)
             {
-                uint32_t address = TRANSFORM_ADDR(address_hi, address_lo);
-                if(!callback_fp(address, data, data_size_in_nibble>>1))
+                uint32_t address = TRANSFORM_ADDR(ctx);
+                if(!ctx->callback_fp(address, ctx->data, ctx->data_size_in_nibble>>1))
                 {
+                    ctx->failed = true;             // valid record not written: program error or conflict with the flash content
                     return false;
                 }
             }
-            else if(record_type == RECORD_TYPE_CRYPT_MODE)
+            else if(ctx->record_type == RECORD_TYPE_CRYPT_MODE)
+            {
+                ctx->crypt_mode = true;
+            }
+            else if(ctx->record_type == RECORD_TYPE_SECTOR_HDR && ctx->byte_count != 0)
             {
-                crypt_mode = true;
+                ctx->aligned = true;
+                ctx->crypt_mode = (ctx->data[0] & 0x01) != 0;
             }
-            else if(record_type == RECORD_TYPE_EOF)
+            else if(ctx->record_type == RECORD_TYPE_EOF)
             {
-                ihex_eof_trig = true;
+                ctx->eof = true;
             }
 
-            state = START_CODE_STATE;
+            ctx->state = START_CODE_STATE;
             break;
 
         default:
@@ -280,7 +322,3 @@ bool ihex_parser(const uint8_t *steambuf, uint32_t size)
     return true;
 }
 
-bool ihex_is_eof() {
-    return ihex_eof_trig;
-}
-
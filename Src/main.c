@@ -42,6 +42,14 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include "crypt.h"
 #include "ihex_parser.h"
 #include "crc.h"
+#include "btldr_status.h"
+#include "btldr_mailbox.h"
+#include "btldr_services.h"
+#include "fat32.h"
+#include "fast_boot.h"
+#include "raw_lun.h"
+#include "selfupdate.h"
+#include "ram_app.h"
 
 /* USER CODE END Includes */
 
@@ -99,8 +107,8 @@ bool app_cks_valid(void)
 {
 	uint32_t app_crc32 = 0;
 
-	/* calculate CRC32 checksum from start of main application until CRC32 location */
-	app_crc32 = crc32_calculate((const uint8_t *)APP_ADDR, (CRC_ADDR-APP_ADDR));
+	/* calculate CRC32 checksum from start of main application until the fast boot token */
+	app_crc32 = crc32_calculate((const uint8_t *)APP_ADDR, (APP_TOKEN_ADDR-APP_ADDR));
 
 	/* compare self calculated CRC32 with CRC32 stored in flash */
 	return (app_crc32 == *((uint32_t*)(CRC_ADDR)));
@@ -116,10 +124,124 @@ bool is_button_down(void)
 
 #if (BTLDR_ACT_BootkeyDet > 0u)
 
-volatile __attribute__((section("._bootkey_section.btldr_act_req_key"))) uint32_t btldr_act_req_key;
+// The key is the last word of the mailbox, still at 0x20004FFC
+volatile __attribute__((section("._bootkey_section.btldr_mailbox"))) btldr_mailbox_t btldr_mailbox;
+
+static uint32_t pre_erase_addr;
+static uint32_t pre_erase_end;
+
+// CRC32 of an image region, the fast boot token reads as erased like in the hex file
+static uint32_t mailbox_region_crc32(uint32_t addr, uint32_t size){
+#if (CONFIG_FAST_BOOT > 0u) && (BTLDR_ACT_CksNotVld > 0u)
+    static const uint8_t erased[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+    uint32_t crc;
+    
+    if(addr <= APP_TOKEN_ADDR && (addr + size) >= (APP_TOKEN_ADDR + 4)) {
+        crc = crc32_update(0, (const uint8_t *)addr, APP_TOKEN_ADDR - addr);
+        crc = crc32_update(crc, erased, 4);
+        crc = crc32_update(crc, (const uint8_t *)(APP_TOKEN_ADDR + 4), addr + size - (APP_TOKEN_ADDR + 4));
+        return crc32_finish(crc);
+    }
+#endif
+    return crc32_calculate((const uint8_t *)addr, size);
+}
 
 bool bootkey_detected(void){
-    return(btldr_act_req_key == BOOTKEY);
+    return(btldr_mailbox.key == BOOTKEY);
+}
+
+static bool mailbox_update_requested(void){
+    return bootkey_detected() && btldr_mailbox_is_valid(&btldr_mailbox) &&
+           (btldr_mailbox.action == BTLDR_MB_ACTION_UPDATE);
+}
+
+static void mailbox_finish(btldr_mb_result_t result){
+    btldr_mailbox.result = result;
+    btldr_mailbox.action = BTLDR_MB_ACTION_NONE;
+}
+
+// Install the image staged by the application through the service table
+static void mailbox_commit(void){
+    uint32_t size = btldr_mailbox.image_size;
+    flash_sink_t sink;
+    
+    if(btldr_mailbox.image_addr != STAGE_ADDR || size == 0 || size > STAGE_SIZE) {
+        mailbox_finish(BTLDR_MB_RESULT_INVALID_REQUEST);
+        return;
+    }
+    
+    btldr_mailbox.result_crc = crc32_calculate((const uint8_t *)STAGE_ADDR, size);
+    if(btldr_mailbox.result_crc != btldr_mailbox.image_crc || !btldr_app_validate(STAGE_ADDR, size)) {
+        mailbox_finish(BTLDR_MB_RESULT_CRC_MISMATCH);       // the running application is untouched
+        return;
+    }
+    
+    if(crc32_calculate((const uint8_t *)APP_ADDR, size) == btldr_mailbox.image_crc) {
+        mailbox_finish(BTLDR_MB_RESULT_UP_TO_DATE);
+        return;
+    }
+    
+    if(!btldr_stage_install(&sink, size)) {
+        mailbox_finish(BTLDR_MB_RESULT_ERASE_FAILED);
+        return;
+    }
+    
+    btldr_mailbox.result_crc = crc32_calculate((const uint8_t *)APP_ADDR, size);
+    mailbox_finish((btldr_mailbox.result_crc == btldr_mailbox.image_crc) ? BTLDR_MB_RESULT_DONE : BTLDR_MB_RESULT_CRC_MISMATCH);
+}
+
+// Runs before the activation check, an up to date image is started without enumerating
+static void mailbox_check(void){
+    uint32_t addr = btldr_mailbox.image_addr;
+    uint32_t size = btldr_mailbox.image_size;
+    
+    if(bootkey_detected() && btldr_mailbox_is_valid(&btldr_mailbox) &&
+       btldr_mailbox.action == BTLDR_MB_ACTION_COMMIT) {
+        mailbox_commit();
+        btldr_mailbox.key = 0;
+        return;
+    }
+    
+    if(!mailbox_update_requested()) {
+        return;
+    }
+    
+    if(addr < APP_ADDR || size == 0 || size > (APP_ADDR + APP_SIZE - addr)) {
+        mailbox_finish(BTLDR_MB_RESULT_INVALID_REQUEST);      // stay in the bootloader, manual update
+        return;
+    }
+    
+    btldr_mailbox.result_crc = mailbox_region_crc32(addr, size);
+    if(btldr_mailbox.result_crc == btldr_mailbox.image_crc) {
+        mailbox_finish(BTLDR_MB_RESULT_UP_TO_DATE);
+        btldr_mailbox.key = 0;
+        return;
+    }
+    
+    btldr_mailbox.result = BTLDR_MB_RESULT_PENDING;
+    pre_erase_addr = addr & ~(FLASH_SINK_PAGE_SIZE - 1);
+    pre_erase_end = addr + size;
+    fat32_set_erase_region(addr, size);
+}
+
+// One page per call from the main loop, the first image record erases whatever is left
+static void mailbox_pre_erase(void){
+    if(pre_erase_addr < pre_erase_end) {
+        if(!fat32_pre_erase_page(pre_erase_addr)) {
+            mailbox_finish(BTLDR_MB_RESULT_ERASE_FAILED);
+            pre_erase_end = 0;
+        }
+        pre_erase_addr += FLASH_SINK_PAGE_SIZE;
+    }
+}
+
+static void mailbox_report(void){
+    if(!mailbox_update_requested()) {
+        return;
+    }
+    
+    btldr_mailbox.result_crc = mailbox_region_crc32(btldr_mailbox.image_addr, btldr_mailbox.image_size);
+    mailbox_finish((btldr_mailbox.result_crc == btldr_mailbox.image_crc) ? BTLDR_MB_RESULT_DONE : BTLDR_MB_RESULT_CRC_MISMATCH);
 }
 #endif
 
@@ -138,9 +260,47 @@ void SystemReset(void){
 
     LL_mDelay(1000);
 
+#if (CONFIG_SELF_UPDATE > 0u)
+    if(selfupdate_pending()) {
+        selfupdate_run();       // does not return if the new bootloader was written
+    }
+#endif
+#if (CONFIG_RAM_APP > 0u)
+    if(ram_app_pending()) {
+        ram_app_run();          // does not return if the vector table is valid
+    }
+#endif
+
     NVIC_SystemReset();
 }
 
+static uint32_t jump_addr;
+
+// Also used by fast_boot() before the C runtime init, jump_addr must survive __set_MSP
+void jump_to_app(void){
+	jump_to_image(APP_ADDR);
+}
+
+// Appcode in flash or an image in the RAM window (ram_app.h)
+void jump_to_image(uint32_t vector){
+	jump_addr = *((__IO uint32_t*)(vector+4u));
+
+	// Disable all interrupts
+	NVIC->ICER[0] = 0xFFFFFFFF;
+	NVIC->ICER[1] = 0xFFFFFFFF;
+	NVIC->ICER[2] = 0xFFFFFFFF;
+
+	NVIC->ICPR[0] = 0xFFFFFFFF;
+	NVIC->ICPR[1] = 0xFFFFFFFF;
+	NVIC->ICPR[2] = 0xFFFFFFFF;
+
+	/* Change the main stack pointer. */
+	SCB->VTOR = vector;
+	__set_MSP((*(__IO uint32_t*)vector));
+
+	((void (*) (void)) (jump_addr)) ();
+}
+
 /* USER CODE END 0 */
 
 /**
@@ -148,12 +308,10 @@ void SystemReset(void){
   * @retval int
   */
   
-static uint32_t jump_addr;
-  
 int main(void)
 {
   /* USER CODE BEGIN 1 */
-
+  // status_init() and fast_boot() already ran in SystemInit()
   /* USER CODE END 1 */
   
 
@@ -163,20 +321,25 @@ int main(void)
   HAL_Init();
 
   /* USER CODE BEGIN Init */
-
+  status_timestamp(STATUS_TS_HAL_INIT);
   /* USER CODE END Init */
 
   /* Configure the system clock */
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
-
+  status_timestamp(STATUS_TS_CLOCK);
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
   
   /* USER CODE BEGIN 2 */
+  status_timestamp(STATUS_TS_GPIO);
+
+#if (BTLDR_ACT_BootkeyDet > 0u)
+  mailbox_check();
+#endif
 
  if(	/* Check for configured activation options */
     #if (BTLDR_ACT_NoAppExist > 0u)
@@ -193,16 +356,32 @@ int main(void)
     #endif
 	 )
   {
+    // Start the USB first, the host enumerates while the rest is initialised
+    MX_USB_DEVICE_Init();
+    status_timestamp(STATUS_TS_USB_START);
 #if(CONFIG_SUPPORT_CRYPT_MODE > 0u)
     crypt_init();
 #endif
-    MX_USB_DEVICE_Init();
+    status_timestamp(STATUS_TS_DEFERRED_INIT);
     while(1)
     {
-#if (CONFIG_SOFT_RESET_AFTER_IHEX_EOF > 0u)
-      if(ihex_is_eof()) {
+      usb_device_poll();
+#if (BTLDR_ACT_BootkeyDet > 0u)
+      mailbox_pre_erase();
+#endif
+#if (CONFIG_RAW_LUN > 0u)
+      raw_lun_poll();
+#endif
+#if (CONFIG_SUPPORT_CRYPT_MODE > 0u)
+      if(fat32_is_crypt_mode()) {
+        crypt_keystream_fill();
+      }
+#endif
+#if (CONFIG_SOFT_RESET_AFTER_IHEX_EOF > 0u) && (CONFIG_PIPE_SINK == PIPE_SINK_FLASH)
+      if(fat32_session_is_done()) {
         #if (BTLDR_ACT_BootkeyDet > 0u)
-         btldr_act_req_key = 0;
+         mailbox_report();
+         btldr_mailbox.key = 0;
         #endif
          SystemReset();
       }
@@ -211,24 +390,14 @@ int main(void)
   }
   else
   {
-    // Jump to the app code
-	jump_addr = *((__IO uint32_t*)(APP_ADDR+4u));
+#if (BTLDR_ACT_CksNotVld > 0u)
+    app_token_set();            // CRC32 verified above, the next boots take the fast path
+#endif
+#if (CONFIG_STATUS_FILE > 0u)
+    BTLDR_MAILBOX->boot_us = status_elapsed_us();
+#endif
 	HAL_DeInit();
-
-	// Disable all interrupts
-	NVIC->ICER[0] = 0xFFFFFFFF;
-	NVIC->ICER[1] = 0xFFFFFFFF;
-	NVIC->ICER[2] = 0xFFFFFFFF;
-
-	NVIC->ICPR[0] = 0xFFFFFFFF;
-	NVIC->ICPR[1] = 0xFFFFFFFF;
-	NVIC->ICPR[2] = 0xFFFFFFFF;
-
-	/* Change the main stack pointer. */
-	SCB->VTOR = APP_ADDR;
-	__set_MSP((*(__IO uint32_t*)APP_ADDR));
-
-	((void (*) (void)) (jump_addr)) ();
+	jump_to_app();
   }
 
   /* USER CODE END 2 */
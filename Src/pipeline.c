@@ -0,0 +1,189 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "stm32f1xx_hal.h"
+#include "btldr_config.h"
+#include "pipeline.h"
+#include "ihex_parser.h"
+#include "uf2.h"
+#include "crypt.h"
+#include "crc.h"
+#include "btldr_status.h"
+
+//-------------------------------------------------------
+
+pipe_stats_t pipe_stats_decode;
+pipe_stats_t pipe_stats_transform;
+pipe_stats_t pipe_stats_sink;
+pipe_stats_t pipe_stats_dropped;
+
+static uint32_t pipe_push_cycles;       // total time in pipe_push(), taken out of the decoder time
+static const pipe_t *pipe_uf2_out;
+static uint32_t pipe_crc;
+
+//-------------------------------------------------------
+
+static void _pipe_count(pipe_stats_t *st, uint32_t size, uint32_t cycles, bool ok)
+{
+    st->records++;
+    st->bytes += size;
+    st->cycles += cycles;
+    st->errors += !ok;
+}
+
+static bool _pipe_in_window(const pipe_sink_t *s, uint32_t addr, uint32_t size)
+{
+    return ((addr - s->base) < s->size) && (size <= (s->size - (addr - s->base)));
+}
+
+static bool _pipe_push(const pipe_t *p, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    uint8_t i;
+    uint32_t start;
+    bool ok;
+    
+    for(i=0; i<p->transform_nbr; i++)
+    {
+        start = STATUS_CYCCNT();
+        ok = p->transforms[i]->apply(addr, buf, size);
+        _pipe_count(p->transforms[i]->stats, size, STATUS_CYCCNT() - start, ok);
+        if(!ok)
+        {
+            return false;
+        }
+    }
+    
+    for(i=0; i<p->sink_nbr; i++)
+    {
+        if(_pipe_in_window(p->sinks[i], addr, size))
+        {
+            start = STATUS_CYCCNT();
+            ok = p->sinks[i]->write(addr, buf, size);
+            _pipe_count(p->sinks[i]->stats, size, STATUS_CYCCNT() - start, ok);
+            return ok;
+        }
+    }
+    
+    _pipe_count(&pipe_stats_dropped, size, 0, true);
+    return true;
+}
+
+//-------------------------------------------------------
+// Decoders
+
+static bool _pipe_hex_decode(void *ctx, const uint8_t *b, uint32_t size)
+{
+    return ihex_ctx_parse((ihex_ctx_t *)ctx, b, size);
+}
+
+static bool _pipe_uf2_record(uint32_t addr, const uint8_t *buf, uint8_t size)
+{
+    return pipe_push(pipe_uf2_out, addr, buf, size);
+}
+
+static bool _pipe_uf2_decode(void *ctx, const uint8_t *b, uint32_t size)
+{
+    if(size != UF2_BLOCK_SIZE)
+    {
+        return false;
+    }
+    
+    pipe_uf2_out = (const pipe_t *)ctx;
+    return uf2_block_decode(b, _pipe_uf2_record);
+}
+
+const pipe_decoder_t pipe_hex_decoder = {_pipe_hex_decode, &pipe_stats_decode};
+const pipe_decoder_t pipe_uf2_decoder = {_pipe_uf2_decode, &pipe_stats_decode};
+
+//-------------------------------------------------------
+// Transforms
+
+#if (CONFIG_SUPPORT_CRYPT_MODE > 0u)
+// The record buffer belongs to the decoder (parser context), decrypted in place
+static bool _pipe_decrypt(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    if(size != AES_BLOCKLEN)
+    {
+        return false;
+    }
+    
+    crypt_decrypt((uint8_t *)buf, size, addr);
+    return true;
+}
+
+const pipe_transform_t pipe_decrypt = {_pipe_decrypt, &pipe_stats_transform};
+#endif
+
+static bool _pipe_crc32(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    (void)addr;
+    pipe_crc = crc32_update(pipe_crc, buf, size);
+    return true;
+}
+
+const pipe_transform_t pipe_crc32 = {_pipe_crc32, &pipe_stats_transform};
+
+uint32_t pipe_crc32_value(void)
+{
+    return crc32_finish(pipe_crc);
+}
+
+//-------------------------------------------------------
+// Sinks
+
+// A mismatch is counted, the stream goes on so the whole image is checked
+static bool _pipe_verify(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    if(memcmp((const void *)addr, buf, size) != 0)
+    {
+        pipe_stats_sink.errors++;
+    }
+    return true;
+}
+
+static bool _pipe_null(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    (void)addr;
+    (void)buf;
+    (void)size;
+    return true;
+}
+
+const pipe_sink_t pipe_verify_sink = {FLASH_BASE, DEV_FLASH_SIZE, _pipe_verify, &pipe_stats_sink};
+const pipe_sink_t pipe_null_sink = {0, 0xFFFFFFFFul, _pipe_null, &pipe_stats_sink};
+
+//-------------------------------------------------------
+
+// The decoder time is its own, the records it pushed are accounted to the other stages
+bool pipe_decode(const pipe_decoder_t *d, void *ctx, const uint8_t *b, uint32_t size)
+{
+    uint32_t start = STATUS_CYCCNT();
+    uint32_t pushed = pipe_push_cycles;
+    bool ok;
+    
+    ok = d->decode(ctx, b, size);
+    _pipe_count(d->stats, size, (STATUS_CYCCNT() - start) - (pipe_push_cycles - pushed), ok);
+    return ok;
+}
+
+bool pipe_push(const pipe_t *p, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    uint32_t start = STATUS_CYCCNT();
+    bool ok;
+    
+    ok = _pipe_push(p, addr, buf, size);
+    pipe_push_cycles += STATUS_CYCCNT() - start;
+    return ok;
+}
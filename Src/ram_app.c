@@ -0,0 +1,61 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stm32f1xx_hal.h"
+#include "btldr_config.h"
+#include "main.h"
+#include "ram_app.h"
+
+//-------------------------------------------------------
+
+static bool ram_app_loaded;
+
+//-------------------------------------------------------
+
+// Hex records of the RAM window, USB interrupt
+bool ram_app_write(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    if(!RAM_APP_IN_WINDOW(addr, size))
+    {
+        return false;
+    }
+    
+    memcpy((void *)addr, buf, size);
+    ram_app_loaded = true;
+    return true;
+}
+
+bool ram_app_pending(void)
+{
+    return ram_app_loaded;
+}
+
+// Stack pointer in SRAM, reset handler in the window (thumb)
+void ram_app_run(void)
+{
+    const uint32_t *vector = (const uint32_t *)RAMAPP_ADDR;
+    
+    ram_app_loaded = false;
+    
+    if((vector[0] <= SRAM_BASE) || (vector[0] > (SRAM_BASE + DEV_SRAM_SIZE)) ||
+       !(vector[1] & 1) || !RAM_APP_IN_WINDOW(vector[1] & ~1ul, 2))
+    {
+        return;
+    }
+    
+    HAL_DeInit();
+    jump_to_image(RAMAPP_ADDR);
+}
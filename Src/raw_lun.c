@@ -0,0 +1,155 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stm32f1xx_hal.h"
+#include "btldr_config.h"
+#include "raw_lun.h"
+#include "flash_sink.h"
+
+//-------------------------------------------------------
+
+#define RAW_LUN_SECTOR_PER_PAGE     (FLASH_SINK_PAGE_SIZE / RAW_LUN_BLK_SIZE)
+#define RAW_LUN_IDLE_FLUSH_MS       100
+
+// The host writes 512 byte sectors, the flash page is 1KB. Sectors are collected in a
+// page buffer, the page is erased and programmed once. Missing sectors are read back
+// from flash before the erase.
+static uint8_t raw_page[FLASH_SINK_PAGE_SIZE];
+static uint32_t raw_page_addr;
+static uint8_t raw_page_valid;          // bit n: sector n of the page is in raw_page
+static uint32_t raw_last_write;
+static flash_sink_t raw_flash;
+static bool raw_flush_err;              // a page was lost since the last SYNCHRONIZE CACHE
+
+//-------------------------------------------------------
+
+static bool _raw_lun_flush(void)
+{
+    uint8_t i;
+    bool ok;
+    
+    if(raw_page_valid == 0)
+    {
+        return true;
+    }
+    
+    for(i=0; i<RAW_LUN_SECTOR_PER_PAGE; i++)
+    {
+        if(!(raw_page_valid & (1u << i)))
+        {
+            memcpy(&raw_page[i * RAW_LUN_BLK_SIZE], (const void *)(raw_page_addr + i * RAW_LUN_BLK_SIZE), RAW_LUN_BLK_SIZE);
+        }
+    }
+    
+    ok = flash_sink_program_page(&raw_flash, raw_page_addr, raw_page);
+    raw_page_valid = 0;
+    if(!ok)
+    {
+        raw_flush_err = true;
+    }
+    return ok;
+}
+
+//-------------------------------------------------------
+
+bool raw_lun_read(uint8_t *b, uint32_t lba)
+{
+    uint32_t addr = APP_ADDR + lba * RAW_LUN_BLK_SIZE;
+    uint8_t sector = (addr & (FLASH_SINK_PAGE_SIZE - 1)) / RAW_LUN_BLK_SIZE;
+    
+    if(lba >= RAW_LUN_BLK_NBR)
+    {
+        return false;
+    }
+    
+#if (CONFIG_READ_FLASH > 0u)
+    if((addr & ~(FLASH_SINK_PAGE_SIZE - 1)) == raw_page_addr && (raw_page_valid & (1u << sector)))
+    {
+        memcpy(b, &raw_page[sector * RAW_LUN_BLK_SIZE], RAW_LUN_BLK_SIZE);
+    }
+    else
+    {
+        memcpy(b, (const void *)addr, RAW_LUN_BLK_SIZE);
+    }
+#else
+    (void)sector;
+    memset(b, 0x00, RAW_LUN_BLK_SIZE);      // same as FIRMWARE.BIN, no readout
+#endif
+    return true;
+}
+
+// USB interrupt. A failed page program (the previous page or this one) fails the WRITE10.
+bool raw_lun_write(const uint8_t *b, uint32_t lba)
+{
+    uint32_t addr = APP_ADDR + lba * RAW_LUN_BLK_SIZE;
+    uint32_t page_addr = addr & ~(FLASH_SINK_PAGE_SIZE - 1);
+    uint8_t sector = (addr - page_addr) / RAW_LUN_BLK_SIZE;
+    bool ok = true;
+    
+    if(lba >= RAW_LUN_BLK_NBR)
+    {
+        return false;
+    }
+    
+    if(page_addr != raw_page_addr)
+    {
+        ok = _raw_lun_flush();
+        raw_page_addr = page_addr;
+    }
+    
+    memcpy(&raw_page[sector * RAW_LUN_BLK_SIZE], b, RAW_LUN_BLK_SIZE);
+    raw_page_valid |= 1u << sector;
+    raw_last_write = HAL_GetTick();
+    
+    if(raw_page_valid == ((1u << RAW_LUN_SECTOR_PER_PAGE) - 1))
+    {
+        ok = _raw_lun_flush() && ok;
+    }
+    return ok;
+}
+
+// Also reports a page lost by an earlier flush (idle timeout, page change), the error is
+// cleared once it has been reported
+bool raw_lun_flush(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    bool ok;
+    
+    __disable_irq();
+    _raw_lun_flush();
+    ok = !raw_flush_err;
+    raw_flush_err = false;
+    __set_PRIMASK(primask);
+    return ok;
+}
+
+void raw_lun_poll(void)
+{
+    uint32_t primask;
+    
+    if(raw_page_valid && (HAL_GetTick() - raw_last_write) > RAW_LUN_IDLE_FLUSH_MS)
+    {
+        primask = __get_PRIMASK();
+        __disable_irq();
+        _raw_lun_flush();       // an error stays latched for the next SYNCHRONIZE CACHE
+        __set_PRIMASK(primask);
+    }
+}
+
+const flash_sink_t *raw_lun_get_flash_stats(void)
+{
+    return &raw_flash;
+}
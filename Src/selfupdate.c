@@ -0,0 +1,255 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32f1xx.h"
+#include "btldr_config.h"
+#include "btldr_mailbox.h"
+#include "btldr_services.h"
+#include "selfupdate.h"
+#include "flash_ll.h"
+#include "flash_sink.h"
+#include "crc.h"
+
+//-------------------------------------------------------
+
+#define SELFUPDATE_PAGE_NBR     (APP_OFFSET / FLASH_SINK_PAGE_SIZE)
+#define SELFUPDATE_RETRY        3u
+
+// Copier code runs from RAM while the bootloader pages are erased (.ramfunc in STM32_MSD_BTLDR.sct)
+#define SELFUPDATE_RAMFUNC      __attribute__((section(".ramfunc"), noinline))
+
+static flash_sink_t selfupdate_flash;
+static bool selfupdate_staged;
+static bool selfupdate_app_overlap;     // the staging area was not blank, the appcode is broken now
+static bool selfupdate_mixed;           // appcode records in the same session, nothing is installed
+
+//-------------------------------------------------------
+// RAM resident part, no call into flash from here. Private copy of the flash_ll
+// primitives, flash_ll itself stays in flash for the sink and the service table.
+
+SELFUPDATE_RAMFUNC static bool _selfupdate_wait(void)
+{
+    uint32_t sr;
+    
+    while(FLASH->SR & FLASH_SR_BSY)
+    {
+    }
+    
+    sr = FLASH->SR;
+    FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;     // write 1 to clear
+    
+    return (sr & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR)) == 0;
+}
+
+SELFUPDATE_RAMFUNC static bool _selfupdate_erase_page(uint32_t addr)
+{
+    bool ok;
+    
+    FLASH->CR |= FLASH_CR_PER;
+    FLASH->AR = addr;
+    FLASH->CR |= FLASH_CR_STRT;
+    ok = _selfupdate_wait();
+    FLASH->CR &= ~FLASH_CR_PER;
+    
+    return ok;
+}
+
+SELFUPDATE_RAMFUNC static bool _selfupdate_program_halfword(uint32_t addr, uint16_t value)
+{
+    bool ok;
+    
+    FLASH->CR |= FLASH_CR_PG;
+    *(volatile uint16_t*)addr = value;
+    ok = _selfupdate_wait();
+    FLASH->CR &= ~FLASH_CR_PG;
+    
+    return ok;
+}
+
+SELFUPDATE_RAMFUNC static bool _selfupdate_copy_page(uint32_t dst, const uint16_t *src)
+{
+    uint8_t retry;
+    uint32_t i;
+    bool ok = false;
+    
+    for(retry=0; retry<SELFUPDATE_RETRY && !ok; retry++)
+    {
+        ok = _selfupdate_erase_page(dst);
+        for(i=0; ok && i<(FLASH_SINK_PAGE_SIZE/2); i++)
+        {
+            ok = _selfupdate_program_halfword(dst + 2*i, src[i]);
+        }
+        for(i=0; ok && i<(FLASH_SINK_PAGE_SIZE/2); i++)
+        {
+            ok = ((volatile const uint16_t *)dst)[i] == src[i];
+        }
+    }
+    return ok;
+}
+
+SELFUPDATE_RAMFUNC static bool _selfupdate_copy(uint32_t src)
+{
+    uint32_t page;
+    
+    for(page=0; page<SELFUPDATE_PAGE_NBR; page++)
+    {
+        if(!_selfupdate_copy_page(FLASH_BASE + page*FLASH_SINK_PAGE_SIZE, (const uint16_t *)(src + page*FLASH_SINK_PAGE_SIZE)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Interrupts off, flash unlocked. The brick window is measured with the DWT cycle counter (48MHz).
+SELFUPDATE_RAMFUNC static void _selfupdate_install(bool erase_app)
+{
+    volatile btldr_mailbox_t *mb = BTLDR_MAILBOX;
+    uint32_t start = DWT->CYCCNT;
+    uint32_t result = BTLDR_MB_RESULT_DONE;
+    
+    if(!_selfupdate_copy(SELFUPDATE_NEW_ADDR))
+    {
+        result = _selfupdate_copy(SELFUPDATE_BACKUP_ADDR) ? BTLDR_MB_RESULT_RESTORED : BTLDR_MB_RESULT_ERASE_FAILED;
+    }
+    
+    // The staging area overwrote the top of the appcode, keep the new bootloader in USB drive mode
+    if(erase_app)
+    {
+        _selfupdate_erase_page(APP_ADDR);
+    }
+    
+    mb->btldr_update_us = (DWT->CYCCNT - start) / 48;
+    mb->btldr_update_result = result;
+    
+    __DSB();
+    SCB->AIRCR = (0x5FAUL << SCB_AIRCR_VECTKEY_Pos) | (SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk) | SCB_AIRCR_SYSRESETREQ_Msk;
+    __DSB();
+    while(1)
+    {
+    }
+}
+
+//-------------------------------------------------------
+
+static bool _selfupdate_blank(uint32_t addr, uint32_t size)
+{
+    const uint32_t *p = (const uint32_t *)addr;
+    
+    for(size /= 4; size; size--)
+    {
+        if(*p++ != 0xFFFFFFFF)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _selfupdate_valid(uint32_t addr)
+{
+    const uint32_t *vector = (const uint32_t *)addr;
+    const btldr_services_t *svc = (const btldr_services_t *)(addr + (BTLDR_SERVICES_ADDR - FLASH_BASE));
+    uint32_t crc = *(const uint32_t *)(addr + APP_OFFSET - 4);
+    
+    return (crc32_calculate((const uint8_t *)addr, APP_OFFSET - 4) == crc) &&
+           (vector[0] > SRAM_BASE) && (vector[0] <= (SRAM_BASE + DEV_SRAM_SIZE)) &&
+           ((vector[1] & ~1ul) >= FLASH_BASE) && ((vector[1] & ~1ul) < APP_ADDR) &&
+           (svc->magic == BTLDR_SERVICES_MAGIC);
+}
+
+// The staging area overwrote the top of the appcode: the application must not start after
+// a rejected or failed update either, its first page is erased (bootloader stays in USB drive mode)
+static void _selfupdate_drop_app(void)
+{
+    bool was_locked;
+    
+    if(selfupdate_app_overlap)
+    {
+        was_locked = flash_ll_unlock();
+        flash_ll_erase_page(APP_ADDR);
+        if(was_locked)
+        {
+            flash_ll_lock();
+        }
+    }
+}
+
+//-------------------------------------------------------
+
+// Hex records of the bootloader area, USB interrupt
+bool selfupdate_write(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    if(selfupdate_mixed)
+    {
+        return false;
+    }
+    if(!selfupdate_staged)
+    {
+        flash_sink_init(&selfupdate_flash);
+        selfupdate_app_overlap = !_selfupdate_blank(SELFUPDATE_NEW_ADDR, 2*APP_OFFSET);
+        selfupdate_staged = true;
+    }
+    return flash_sink_write(&selfupdate_flash, SELFUPDATE_NEW_ADDR + (addr - FLASH_BASE), buf, size);
+}
+
+bool selfupdate_pending(void)
+{
+    return selfupdate_staged;
+}
+
+void selfupdate_reject(void)
+{
+    selfupdate_mixed = true;
+}
+
+void selfupdate_run(void)
+{
+    flash_sink_t *s = &selfupdate_flash;
+    volatile btldr_mailbox_t *mb = BTLDR_MAILBOX;
+    
+    selfupdate_staged = false;
+    mb->magic = BTLDR_MAILBOX_MAGIC;        // the result is read by the new bootloader and the application
+    mb->version = BTLDR_MAILBOX_VERSION;
+    mb->btldr_update_us = 0;
+    
+    if(selfupdate_mixed)
+    {
+        selfupdate_mixed = false;
+        mb->btldr_update_result = BTLDR_MB_RESULT_MIXED_IMAGE;
+        _selfupdate_drop_app();
+        return;
+    }
+    if(!_selfupdate_valid(SELFUPDATE_NEW_ADDR))
+    {
+        mb->btldr_update_result = BTLDR_MB_RESULT_CRC_MISMATCH;
+        _selfupdate_drop_app();
+        return;
+    }
+    
+    // Backup of the running bootloader, verified before anything is erased
+    if(!flash_sink_erase(s, SELFUPDATE_BACKUP_ADDR, APP_OFFSET) ||
+       !flash_sink_write(s, SELFUPDATE_BACKUP_ADDR, (const uint8_t *)FLASH_BASE, APP_OFFSET) ||
+       crc32_calculate((const uint8_t *)SELFUPDATE_BACKUP_ADDR, APP_OFFSET) != crc32_calculate((const uint8_t *)FLASH_BASE, APP_OFFSET))
+    {
+        mb->btldr_update_result = BTLDR_MB_RESULT_ERASE_FAILED;
+        _selfupdate_drop_app();
+        return;
+    }
+    
+    __disable_irq();
+    flash_ll_unlock();
+    _selfupdate_install(selfupdate_app_overlap);
+}
@@ -75,6 +75,8 @@
   */
 
 #include "stm32f1xx.h"
+#include "btldr_status.h"
+#include "fast_boot.h"
 
 /**
   * @}
@@ -174,6 +176,10 @@ const uint8_t APBPrescTable[8U] =  {0, 0, 0, 0, 1, 2, 3, 4};
   */
 void SystemInit (void)
 {
+  /* Bootloader: count cycles from reset, take the fast path to the app if possible */
+  status_init();
+  fast_boot();
+
   /* Reset the RCC clock configuration to the default reset state(for debug purpose) */
   /* Set HSION bit */
   RCC->CR |= 0x00000001U;
@@ -0,0 +1,66 @@
+/*************************************************************************************
+# Released under MIT License
+
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "uf2.h"
+
+//-------------------------------------------------------
+
+// Payload is passed to the callback in chunks, the callback size is 8-bit and
+// crypt mode wants whole AES blocks
+#define UF2_CHUNK_SIZE          128
+
+//-------------------------------------------------------
+
+bool uf2_is_block(const uint8_t *block)
+{
+    const uf2_block_t *b = (const uf2_block_t *)block;
+    
+    return (b->magicStart0 == UF2_MAGIC_START0) && (b->magicStart1 == UF2_MAGIC_START1) && (b->magicEnd == UF2_MAGIC_END);
+}
+
+// Stateless, every block carries its own address
+bool uf2_block_decode(const uint8_t *block, ihex_callback_fp fp)
+{
+    const uf2_block_t *b = (const uf2_block_t *)block;
+    uint32_t offset = 0;
+    
+    if(!uf2_is_block(block) || b->payloadSize > sizeof(b->data))
+    {
+        return false;
+    }
+    
+    if(b->flags & UF2_FLAG_NOT_MAIN_FLASH)
+    {
+        return true;
+    }
+    
+    while(offset < b->payloadSize)
+    {
+        uint32_t size = b->payloadSize - offset;
+        
+        if(size > UF2_CHUNK_SIZE)
+        {
+            size = UF2_CHUNK_SIZE;
+        }
+        
+        if(!fp(b->targetAddr + offset, &b->data[offset], (uint8_t)size))
+        {
+            return false;
+        }
+        offset += size;
+    }
+    
+    return true;
+}
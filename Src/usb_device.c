@@ -28,7 +28,7 @@
 #include "usbd_storage_if.h"
 
 /* USER CODE BEGIN Includes */
-
+#include "usbd_msc_scsi.h"
 /* USER CODE END Includes */
 
 /* USER CODE BEGIN PV */
@@ -49,6 +49,14 @@ USBD_HandleTypeDef hUsbDeviceFS;
  */
 /* USER CODE BEGIN 0 */
 
+// Deferred USB work, called from the main loop
+void usb_device_poll(void)
+{
+#if (MSC_READ_AHEAD > 0)
+  SCSI_ReadAhead(&hUsbDeviceFS);
+#endif
+}
+
 /* USER CODE END 0 */
 
 /*
@@ -27,7 +27,7 @@
 #include "usbd_msc.h"
 
 /* USER CODE BEGIN Includes */
-
+#include "btldr_status.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -176,6 +176,8 @@ void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd)
 { 
   USBD_SpeedTypeDef speed = USBD_SPEED_FULL;
 
+  status_timestamp(STATUS_TS_USB_RESET);
+
   if ( hpcd->Init.speed != PCD_SPEED_FULL)
   {
     Error_Handler();
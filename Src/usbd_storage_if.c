@@ -24,6 +24,8 @@
 
 /* USER CODE BEGIN INCLUDE */
 #include "fat32.h"
+#include "btldr_status.h"
+#include "raw_lun.h"
 /* USER CODE END INCLUDE */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -75,6 +77,11 @@
 #if (STORAGE_BLK_SIZ != 0x200)
 	#error "Please change STORAGE_BLK_SIZ to 0x200"
 #endif
+
+/* LUN 0: FAT32 volume, LUN 1: raw appcode area */
+#undef STORAGE_LUN_NBR
+#define STORAGE_LUN_NBR                  (1 + CONFIG_RAW_LUN)
+#define STORAGE_LUN_RAW                  1
 /* USER CODE END PRIVATE_DEFINES */
 
 /**
@@ -115,7 +122,22 @@ const int8_t STORAGE_Inquirydata_FS[] = {/* 36 */
   'S', 'T', 'M', ' ', ' ', ' ', ' ', ' ', /* Manufacturer : 8 bytes */
   'P', 'r', 'o', 'd', 'u', 'c', 't', ' ', /* Product      : 16 Bytes */
   ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+  '0', '.', '0' ,'1',                     /* Version      : 4 Bytes */
+#if (CONFIG_RAW_LUN > 0u)
+  /* LUN 1 */
+  0x00,
+  0x80,
+  0x02,
+  0x02,
+  (STANDARD_INQUIRY_DATA_LEN - 5),
+  0x00,
+  0x00,	
+  0x00,
+  'S', 'T', 'M', ' ', ' ', ' ', ' ', ' ', /* Manufacturer : 8 bytes */
+  'R', 'a', 'w', ' ', 'a', 'p', 'p', ' ', /* Product      : 16 Bytes */
+  'f', 'l', 'a', 's', 'h', ' ', ' ', ' ',
   '0', '.', '0' ,'1'                      /* Version      : 4 Bytes */
+#endif
 }; 
 /* USER CODE END INQUIRY_DATA_FS */
 
@@ -154,6 +176,9 @@ static int8_t STORAGE_IsWriteProtected_FS(uint8_t lun);
 static int8_t STORAGE_Read_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
 static int8_t STORAGE_Write_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
 static int8_t STORAGE_GetMaxLun_FS(void);
+static int8_t STORAGE_IsWriteCached_FS(uint8_t lun);
+static int8_t STORAGE_SyncCache_FS(uint8_t lun);
+static int8_t STORAGE_Eject_FS(uint8_t lun);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
 static void _STORAGE_ReadBlocks(uint32_t *buf, uint64_t readAddr, uint32_t blockSize, uint32_t numOfBlocks)
@@ -169,17 +194,22 @@ static void _STORAGE_ReadBlocks(uint32_t *buf, uint64_t readAddr, uint32_t block
   }
 }
 
-static void _STORAGE_WriteBlocks(uint32_t *buf, uint64_t writeAddr, uint32_t blockSize, uint32_t numOfBlocks)
+// Stops at the first block the hex stream rejects (program error, conflict, rejected file)
+static bool _STORAGE_WriteBlocks(uint32_t *buf, uint64_t writeAddr, uint32_t blockSize, uint32_t numOfBlocks)
 {
   uint32_t iBlock;
   uint8_t* buf8 = (uint8_t*)buf;
   
   for(iBlock=0; iBlock<numOfBlocks; iBlock++)
   {
-    fat32_write(buf8, (uint32_t)writeAddr);
+    if(!fat32_write(buf8, (uint32_t)writeAddr))
+    {
+      return false;
+    }
     writeAddr += blockSize;
     buf8 += blockSize;
   }
+  return true;
 }
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -196,7 +226,10 @@ USBD_StorageTypeDef USBD_Storage_Interface_fops_FS =
   STORAGE_Read_FS,
   STORAGE_Write_FS,
   STORAGE_GetMaxLun_FS,
-  (int8_t *)STORAGE_Inquirydata_FS
+  (int8_t *)STORAGE_Inquirydata_FS,
+  STORAGE_IsWriteCached_FS,
+  STORAGE_SyncCache_FS,
+  STORAGE_Eject_FS
 };
 
 /* Private functions ---------------------------------------------------------*/
@@ -222,6 +255,15 @@ int8_t STORAGE_Init_FS(uint8_t lun)
 int8_t STORAGE_GetCapacity_FS(uint8_t lun, uint32_t *block_num, uint16_t *block_size)
 {
   /* USER CODE BEGIN 3 */
+  status_timestamp(STATUS_TS_READ_CAPACITY);
+#if (CONFIG_RAW_LUN > 0u)
+  if(lun == STORAGE_LUN_RAW)
+  {
+    *block_num  = RAW_LUN_BLK_NBR;
+    *block_size = RAW_LUN_BLK_SIZE;
+    return (USBD_OK);
+  }
+#endif
   *block_num  = STORAGE_BLK_NBR;
   *block_size = STORAGE_BLK_SIZ;
   return (USBD_OK);
@@ -260,6 +302,20 @@ int8_t STORAGE_IsWriteProtected_FS(uint8_t lun)
 int8_t STORAGE_Read_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len)
 {
   /* USER CODE BEGIN 6 */
+#if (CONFIG_RAW_LUN > 0u)
+  if(lun == STORAGE_LUN_RAW)
+  {
+    while(blk_len--)
+    {
+      if(!raw_lun_read(buf, blk_addr++))
+      {
+        return (USBD_FAIL);
+      }
+      buf += RAW_LUN_BLK_SIZE;
+    }
+    return (USBD_OK);
+  }
+#endif
   _STORAGE_ReadBlocks((uint32_t *)buf, (uint64_t)(blk_addr * STORAGE_BLK_SIZ), STORAGE_BLK_SIZ, blk_len);
   return (USBD_OK);
   /* USER CODE END 6 */
@@ -273,7 +329,24 @@ int8_t STORAGE_Read_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t bl
 int8_t STORAGE_Write_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len)
 {
   /* USER CODE BEGIN 7 */
-  _STORAGE_WriteBlocks((uint32_t *)buf, (uint64_t)(blk_addr * STORAGE_BLK_SIZ), STORAGE_BLK_SIZ, blk_len);
+#if (CONFIG_RAW_LUN > 0u)
+  if(lun == STORAGE_LUN_RAW)
+  {
+    while(blk_len--)
+    {
+      if(!raw_lun_write(buf, blk_addr++))
+      {
+        return (USBD_FAIL);
+      }
+      buf += RAW_LUN_BLK_SIZE;
+    }
+    return (USBD_OK);
+  }
+#endif
+  if(!_STORAGE_WriteBlocks((uint32_t *)buf, (uint64_t)(blk_addr * STORAGE_BLK_SIZ), STORAGE_BLK_SIZ, blk_len))
+  {
+    return (USBD_FAIL);
+  }
   return (USBD_OK);
   /* USER CODE END 7 */
 }
@@ -292,6 +365,56 @@ int8_t STORAGE_GetMaxLun_FS(void)
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
+/**
+  * @brief  Write-back cache of the LUN, reported in the caching mode page (WCE).
+  *         The raw LUN keeps a flash page in RAM, LUN 0 writes through.
+  * @param  lun: .
+  * @retval 1 if writes are buffered
+  */
+static int8_t STORAGE_IsWriteCached_FS(uint8_t lun)
+{
+#if (CONFIG_RAW_LUN > 0u)
+  if(lun == STORAGE_LUN_RAW)
+  {
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+/**
+  * @brief  SYNCHRONIZE CACHE, the buffered data is in flash when it returns.
+  * @param  lun: .
+  * @retval USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t STORAGE_SyncCache_FS(uint8_t lun)
+{
+#if (CONFIG_RAW_LUN > 0u)
+  if(lun == STORAGE_LUN_RAW)
+  {
+    return raw_lun_flush() ? (USBD_OK) : (USBD_FAIL);
+  }
+#endif
+  return (USBD_OK);
+}
+
+/**
+  * @brief  The host ejected the drive, the hex files written so far are committed.
+  * @param  lun: .
+  * @retval USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t STORAGE_Eject_FS(uint8_t lun)
+{
+#if (CONFIG_RAW_LUN > 0u)
+  if(lun == STORAGE_LUN_RAW)
+  {
+    return raw_lun_flush() ? (USBD_OK) : (USBD_FAIL);
+  }
+#endif
+  fat32_eject();
+  return (USBD_OK);
+}
+
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**
@@ -0,0 +1,436 @@
+/*************************************************************************************
+# Released under MIT License
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+Permission is hereby granted, free of charge, to any person obtaining a copy of this
+software and associated documentation files (the "Software"), to deal in the Software
+without restriction, including without limitation the rights to use, copy, modify, merge,
+publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or
+substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+// Image layout analyser: shows how a hex or ELF file falls onto the 1KB flash pages and predicts
+// the erase/program work and the update time on the bootloader. The report is JSON for CI.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <elf.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+
+#include "../hex-crypt/ihex_parser.h"
+
+}
+
+#define FLASH_PAGE_SIZE         0x400u
+#define DEFAULT_APP_ADDR        0x08006000u     // APP_ADDR in btldr_config.h
+#define DEFAULT_APP_SIZE        (112u * 1024u)  // APP_SIZE of a 128KB device
+#define HEX_RECORD_SIZE         16u             // data bytes per record written for an ELF file
+#define UF2_PAYLOAD_SIZE        256u            // uf2conv.py payload per 512 byte block
+#define UF2_BLOCK_SIZE          512u
+#define RAW_SECTOR_SIZE         512u            // raw LUN (CONFIG_RAW_LUN), LBA 0 = APP_ADDR
+
+// Timing model of the update, same as btldr-plan: STM32F103 datasheet (typ) and a full speed MSC drive
+#define T_PAGE_ERASE_MS         20.0            // tERASE
+#define T_HALFWORD_PROG_US      52.5            // tPROG
+#define T_USB_BYTE_US           2.0             // ~500KB/s over USB FS
+#define T_SESSION_IDLE_MS       1000.0          // CONFIG_HEX_SESSION_IDLE_MS before the reset
+
+using namespace std;
+
+typedef struct
+{
+    uint32_t addr;
+    uint32_t len;
+}record_t;
+
+typedef struct
+{
+    const char *name;
+    uint64_t bytes;                 // over USB
+    uint32_t erase;
+    uint32_t program;
+    double ms;
+}cost_t;
+
+static uint32_t app_addr = DEFAULT_APP_ADDR;
+static uint32_t app_size = DEFAULT_APP_SIZE;
+static vector<record_t> records;    // data records in file order
+static vector<uint8_t> image;       // appcode area, unwritten bytes are 0xFF
+static vector<uint8_t> written;     // times each byte is written by the file
+static uint64_t outside_bytes;
+
+static bool collect_record(uint32_t addr, const uint8_t *buf, uint8_t bufsize)
+{
+    uint32_t i;
+    
+    records.push_back({addr, bufsize});
+    for (i = 0; i < bufsize; i++, addr++)
+    {
+        if (addr >= app_addr && addr < app_addr + app_size)
+        {
+            image[addr - app_addr] = buf[i];
+            if (written[addr - app_addr] < 0xFF)
+            {
+                written[addr - app_addr]++;
+            }
+        }
+        else
+        {
+            outside_bytes++;
+        }
+    }
+    return true;
+}
+
+static bool read_file(const string &filename, string &content)
+{
+    ifstream f(filename, ios::binary);
+    if (!f)
+    {
+        return false;
+    }
+    ostringstream ss;
+    ss << f.rdbuf();
+    content = ss.str();
+    return true;
+}
+
+static bool load_hex(const string &content)
+{
+    ihex_reset_state();
+    ihex_set_callback_func(collect_record);
+    return ihex_parser((const uint8_t *)content.data(), (uint32_t)content.size());
+}
+
+// PT_LOAD segments at their load address, cut into records like objcopy -O ihex
+static bool load_elf(const string &content)
+{
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr *)content.data();
+    uint32_t i;
+    
+    if (content.size() < sizeof(Elf32_Ehdr) || eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+        eh->e_ident[EI_DATA] != ELFDATA2LSB || (uint64_t)eh->e_phoff + (uint64_t)eh->e_phnum * sizeof(Elf32_Phdr) > content.size())
+    {
+        printf("Not a 32-bit little endian ELF file\n");
+        return false;
+    }
+    
+    for (i = 0; i < eh->e_phnum; i++)
+    {
+        const Elf32_Phdr *ph = (const Elf32_Phdr *)(content.data() + eh->e_phoff + i * sizeof(Elf32_Phdr));
+        uint32_t offset = 0;
+        
+        if (ph->p_type != PT_LOAD || ph->p_filesz == 0)
+        {
+            continue;
+        }
+        if ((uint64_t)ph->p_offset + ph->p_filesz > content.size())
+        {
+            printf("Segment %u outside the file\n", i);
+            return false;
+        }
+        while (offset < ph->p_filesz)
+        {
+            uint32_t addr = ph->p_paddr + offset;
+            uint32_t len = min(HEX_RECORD_SIZE, ph->p_filesz - offset);
+            
+            // a record does not cross a 64KB boundary (extended linear address record)
+            len = min(len, 0x10000u - (addr & 0xFFFFu));
+            collect_record(addr, (const uint8_t *)content.data() + ph->p_offset + offset, (uint8_t)len);
+            offset += len;
+        }
+    }
+    return true;
+}
+
+// Size of the hex text for the records: 04 record per 64KB, 16 byte data records, EOF
+static uint64_t hex_size(void)
+{
+    uint64_t size = 12;             // :00000001FF\n
+    uint32_t ext = 0xFFFFFFFF;
+    
+    for (const record_t &r : records)
+    {
+        if ((r.addr >> 16) != ext)
+        {
+            ext = r.addr >> 16;
+            size += 16;             // :02000004xxxxcc\n
+        }
+        size += 12 + 2 * r.len;
+    }
+    return size;
+}
+
+// Blocks of UF2_PAYLOAD_SIZE bytes aligned like uf2conv.py, or raw LUN sectors, that hold data
+static uint32_t chunks_written(uint32_t chunk)
+{
+    uint32_t nbr = 0, i, j;
+    
+    for (i = 0; i < app_size; i += chunk)
+    {
+        for (j = i; j < i + chunk && j < app_size; j++)
+        {
+            if (written[j])
+            {
+                nbr++;
+                break;
+            }
+        }
+    }
+    return nbr;
+}
+
+static string json_escape(const string &s)
+{
+    string out;
+    
+    for (char ch : s)
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            out += '\\';
+        }
+        out += ch;
+    }
+    return out;
+}
+
+static double cost_ms(cost_t &c)
+{
+    c.ms = c.erase * T_PAGE_ERASE_MS + c.program * T_HALFWORD_PROG_US / 1000.0 + c.bytes * T_USB_BYTE_US / 1000.0;
+    return c.ms;
+}
+
+static void print_usage(void)
+{
+    printf("Usage: btldr_layout -i app.hex|app.elf [-j report.json] [-a app_addr] [-z app_size] [-l max_ms]\n");
+    printf("  -j   write the JSON report to a file, '-' for stdout\n");
+    printf("  -l   exit code 3 if the predicted update (hex file, current policy) takes longer\n");
+}
+
+int main(int argc, char *argv[])
+{
+    string input, json;
+    double max_ms = 0;
+    int i;
+    
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc)
+            input = argv[++i];
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            json = argv[++i];
+        else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+            app_addr = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-z") && i + 1 < argc)
+            app_size = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+            max_ms = strtod(argv[++i], NULL);
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+    
+    if (input.empty() || (app_size % FLASH_PAGE_SIZE) != 0)
+    {
+        print_usage();
+        return 1;
+    }
+    
+    string content;
+    bool elf;
+    
+    if (!read_file(input, content))
+    {
+        printf("Cannot read %s\n", input.c_str());
+        return 1;
+    }
+    image.assign(app_size, 0xFF);
+    written.assign(app_size, 0);
+    elf = content.size() >= SELFMAG && !memcmp(content.data(), ELFMAG, SELFMAG);
+    if (!(elf ? load_elf(content) : load_hex(content)) || records.empty())
+    {
+        printf("Cannot parse %s\n", input.c_str());
+        return 1;
+    }
+    
+    // Extents: runs of written bytes in the appcode area
+    vector<pair<uint32_t, uint32_t>> extents;
+    uint32_t a, page, nbr = app_size / FLASH_PAGE_SIZE;
+    
+    for (a = 0; a < app_size; a++)
+    {
+        if (!written[a])
+        {
+            continue;
+        }
+        if (!extents.empty() && extents.back().second == app_addr + a)
+        {
+            extents.back().second++;
+        }
+        else
+        {
+            extents.push_back({app_addr + a, app_addr + a + 1});
+        }
+    }
+    
+    // Pages: touched, partially filled (the rest stays 0xFF)
+    uint32_t pages_touched = 0, pages_partial = 0;
+    
+    for (page = 0; page < nbr; page++)
+    {
+        uint32_t n = 0;
+        
+        for (a = page * FLASH_PAGE_SIZE; a < (page + 1) * FLASH_PAGE_SIZE; a++)
+        {
+            n += (written[a] != 0);
+        }
+        pages_touched += (n != 0);
+        pages_partial += (n != 0 && n != FLASH_PAGE_SIZE);
+    }
+    
+    // Records: the flash sink programs half-words per record. A record starting or ending at an
+    // odd address programs half a half-word, the neighbour record then finds it already programmed.
+    uint32_t odd_start = 0, odd_end = 0, straddle = 0, overlap = 0, split = 0;
+    vector<uint8_t> half(app_size / 2, 0);
+    
+    for (const record_t &r : records)
+    {
+        if (r.len == 0)
+        {
+            continue;
+        }
+        odd_start += (r.addr & 1);
+        odd_end += ((r.addr + r.len) & 1);
+        straddle += ((r.addr / FLASH_PAGE_SIZE) != ((r.addr + r.len - 1) / FLASH_PAGE_SIZE));
+        if ((r.addr & 1) && r.addr > app_addr && r.addr < app_addr + app_size)
+        {
+            split += (half[(r.addr - app_addr) / 2]++ == 1);
+        }
+        if (((r.addr + r.len) & 1) && r.addr + r.len - 1 >= app_addr && r.addr + r.len - 1 < app_addr + app_size)
+        {
+            split += (half[(r.addr + r.len - 1 - app_addr) / 2]++ == 1);
+        }
+    }
+    for (a = 0; a < app_size; a++)
+    {
+        overlap += (written[a] > 1);
+    }
+    
+    // Half-words to program: all-ones half-words already read 0xFFFF after the erase
+    uint32_t hw_written = 0, hw_ones = 0;
+    
+    for (a = 0; a < app_size; a += 2)
+    {
+        if (written[a] || written[a + 1])
+        {
+            hw_written++;
+            hw_ones += (image[a] == 0xFF && image[a + 1] == 0xFF);
+        }
+    }
+    uint32_t program = hw_written - hw_ones;
+    
+    // The bootloader erases the whole appcode area when the first data record is APP_ADDR,
+    // otherwise each page is erased before its first write (sparse update)
+    bool whole_erase = records.front().addr == app_addr;
+    cost_t whole = {"whole_region", 0, nbr, program, 0};
+    cost_t lazy = {"page_lazy", 0, pages_touched, program, 0};
+    cost_t current = whole_erase ? whole : lazy;
+    uint64_t hex_bytes = elf ? hex_size() : content.size();
+    uint32_t raw_sectors = chunks_written(RAW_SECTOR_SIZE);
+    cost_t formats[3] = {
+        {"hex", hex_bytes, current.erase, program, 0},
+        {"uf2", (uint64_t)chunks_written(UF2_PAYLOAD_SIZE) * UF2_BLOCK_SIZE, current.erase, program, 0},
+        {"raw_lun", (uint64_t)raw_sectors * RAW_SECTOR_SIZE, pages_touched, program, 0},
+    };
+    
+    whole.bytes = lazy.bytes = current.bytes = hex_bytes;
+    cost_ms(whole);
+    cost_ms(lazy);
+    cost_ms(current);
+    for (cost_t &c : formats)
+    {
+        cost_ms(c);
+    }
+    
+    // The text summary is left out when the JSON goes to stdout
+    if (json != "-")
+    {
+        printf("%s: %zu records, %zu extents, %u/%u pages (%u partial)\n", input.c_str(), records.size(),
+               extents.size(), pages_touched, nbr, pages_partial);
+        printf("records: %u odd start, %u odd end, %u straddle pages, %u split half-words, %u bytes overlap, %llu bytes outside\n",
+               odd_start, odd_end, straddle, split, overlap, (unsigned long long)outside_bytes);
+        printf("program: %u half-words, %u all-ones\n", program, hw_ones);
+        printf("erase: whole region %u pages %.0f ms, page lazy %u pages %.0f ms, this file: %s\n",
+               whole.erase, whole.ms, lazy.erase, lazy.ms, whole_erase ? "whole region" : "page lazy");
+        for (const cost_t &c : formats)
+        {
+            printf("%-8s %8llu bytes %6.0f ms\n", c.name, (unsigned long long)c.bytes, c.ms);
+        }
+        printf("(+%.0f ms idle before the reset)\n", T_SESSION_IDLE_MS);
+    }
+    
+    if (!json.empty())
+    {
+        FILE *fp = (json == "-") ? stdout : fopen(json.c_str(), "w");
+        size_t k;
+        
+        if (!fp)
+        {
+            printf("Cannot open %s for writing\n", json.c_str());
+            return 1;
+        }
+        fprintf(fp, "{\n  \"input\": \"%s\",\n  \"format\": \"%s\",\n", json_escape(input).c_str(), elf ? "elf" : "hex");
+        fprintf(fp, "  \"app_addr\": %u,\n  \"app_size\": %u,\n  \"page_size\": %u,\n", app_addr, app_size, FLASH_PAGE_SIZE);
+        fprintf(fp, "  \"extents\": [");
+        for (k = 0; k < extents.size(); k++)
+        {
+            fprintf(fp, "%s\n    {\"start\": %u, \"end\": %u}", k ? "," : "", extents[k].first, extents[k].second);
+        }
+        fprintf(fp, "\n  ],\n");
+        fprintf(fp, "  \"pages\": {\"total\": %u, \"touched\": %u, \"partial\": %u},\n", nbr, pages_touched, pages_partial);
+        fprintf(fp, "  \"records\": {\"count\": %zu, \"odd_start\": %u, \"odd_end\": %u, \"straddle_pages\": %u, "
+                    "\"split_halfwords\": %u, \"overlap_bytes\": %u, \"outside_bytes\": %llu},\n",
+                records.size(), odd_start, odd_end, straddle, split, overlap, (unsigned long long)outside_bytes);
+        fprintf(fp, "  \"halfwords\": {\"written\": %u, \"all_ones\": %u, \"program\": %u},\n", hw_written, hw_ones, program);
+        fprintf(fp, "  \"policy\": \"%s\",\n  \"erase_policies\": {", whole_erase ? "whole_region" : "page_lazy");
+        for (const cost_t *c : {&whole, &lazy})
+        {
+            fprintf(fp, "%s\n    \"%s\": {\"erase\": %u, \"program\": %u, \"ms\": %.1f}", c == &whole ? "" : ",",
+                    c->name, c->erase, c->program, c->ms);
+        }
+        fprintf(fp, "\n  },\n  \"formats\": {");
+        for (k = 0; k < 3; k++)
+        {
+            fprintf(fp, "%s\n    \"%s\": {\"bytes\": %llu, \"erase\": %u, \"program\": %u, \"ms\": %.1f}", k ? "," : "",
+                    formats[k].name, (unsigned long long)formats[k].bytes, formats[k].erase, formats[k].program, formats[k].ms);
+        }
+        fprintf(fp, "\n  },\n  \"predicted_ms\": %.1f,\n  \"idle_ms\": %.1f\n}\n", current.ms, T_SESSION_IDLE_MS);
+        if (fp != stdout)
+        {
+            fclose(fp);
+        }
+    }
+    
+    if (max_ms > 0 && current.ms > max_ms)
+    {
+        fprintf(stderr, "Predicted %.0f ms exceeds %.0f ms\n", current.ms, max_ms);
+        return 3;
+    }
+    return 0;
+}
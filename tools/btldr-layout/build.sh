@@ -0,0 +1,3 @@
+#!/bin/sh
+gcc -c -o ihex_parser.o -O2 ../hex-crypt/ihex_parser.c
+g++ -std=c++17 -o btldr_layout -O2 btldr_layout.cpp ihex_parser.o
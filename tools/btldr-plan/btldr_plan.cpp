@@ -0,0 +1,297 @@
+/*************************************************************************************
+# Released under MIT License
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+Permission is hereby granted, free of charge, to any person obtaining a copy of this
+software and associated documentation files (the "Software"), to deal in the Software
+without restriction, including without limitation the rights to use, copy, modify, merge,
+publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or
+substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+// Sparse update planner: compares a new image with the device content (FIRMWARE.BIN or
+// PAGES.CRC) and writes a hex file with only the changed 1KB flash pages.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+extern "C" {
+
+#include "../hex-crypt/ihex_parser.h"
+
+}
+
+#define FLASH_PAGE_SIZE         0x400u
+#define DEFAULT_APP_ADDR        0x08006000u     // APP_ADDR in btldr_config.h
+#define DEFAULT_APP_SIZE        (112u * 1024u)  // APP_SIZE of a 128KB device
+
+// Timing model of the update, STM32F103 datasheet (typ) and a full speed MSC drive
+#define T_PAGE_ERASE_MS         20.0            // tERASE
+#define T_HALFWORD_PROG_US      52.5            // tPROG
+#define T_HEX_BYTE_US           2.0             // ~500KB/s of hex text over USB FS
+#define T_SESSION_IDLE_MS       1000.0          // CONFIG_HEX_SESSION_IDLE_MS before the reset
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static uint32_t app_addr = DEFAULT_APP_ADDR;
+static uint32_t app_size = DEFAULT_APP_SIZE;
+static vector<uint8_t> *load_image;
+
+static bool load_flash_data(uint32_t addr, const uint8_t *buf, uint8_t bufsize)
+{
+    uint8_t i;
+    
+    for (i = 0; i < bufsize; i++, addr++)
+    {
+        if (addr >= app_addr && addr < app_addr + app_size)
+        {
+            (*load_image)[addr - app_addr] = buf[i];
+        }
+    }
+    return true;
+}
+
+static bool read_file(const string &filename, string &content)
+{
+    ifstream f(filename, ios::binary);
+    if (!f)
+    {
+        return false;
+    }
+    ostringstream ss;
+    ss << f.rdbuf();
+    content = ss.str();
+    return true;
+}
+
+// Unwritten bytes are 0xFF like erased flash
+static bool load_hex(const string &filename, vector<uint8_t> &image)
+{
+    string content;
+    
+    if (!read_file(filename, content))
+    {
+        return false;
+    }
+    
+    image.assign(app_size, 0xFF);
+    load_image = &image;
+    ihex_reset_state();
+    ihex_set_callback_func(load_flash_data);
+    return ihex_parser((const uint8_t *)content.data(), (uint32_t)content.size());
+}
+
+// zlib CRC32, the bootloader returns it byte swapped (crc32_calculate)
+static uint32_t crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    int j;
+    
+    while (len--)
+    {
+        crc ^= *data++;
+        for (j = 0; j < 8; j++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// Device page CRCs from PAGES.CRC (big endian zlib CRC32 per page) or computed from FIRMWARE.BIN
+static bool load_device_crc(const string &filename, vector<uint32_t> &crc)
+{
+    string content;
+    uint32_t i, nbr = app_size / FLASH_PAGE_SIZE;
+    
+    if (!read_file(filename, content))
+    {
+        return false;
+    }
+    
+    crc.assign(nbr, 0);
+    if (fs::path(filename).extension() == ".CRC" || fs::path(filename).extension() == ".crc")
+    {
+        if (content.size() < nbr * 4)
+        {
+            printf("%s: %zu bytes, %u expected\n", filename.c_str(), content.size(), nbr * 4);
+            return false;
+        }
+        for (i = 0; i < nbr; i++)
+        {
+            const uint8_t *p = (const uint8_t *)&content[i * 4];
+            crc[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        }
+    }
+    else
+    {
+        content.resize(app_size, (char)0xFF);
+        for (i = 0; i < nbr; i++)
+        {
+            crc[i] = crc32((const uint8_t *)&content[i * FLASH_PAGE_SIZE], FLASH_PAGE_SIZE);
+        }
+    }
+    return true;
+}
+
+static void put_record(FILE *fp, uint8_t type, uint16_t addr, const uint8_t *data, uint8_t len)
+{
+    uint8_t cs = len + (addr >> 8) + (addr & 0xff) + type;
+    uint8_t i;
+    
+    fprintf(fp, ":%02X%04X%02X", len, addr, type);
+    for (i = 0; i < len; i++)
+    {
+        fprintf(fp, "%02X", data[i]);
+        cs += data[i];
+    }
+    fprintf(fp, "%02X\n", (uint8_t)(~cs + 1));
+}
+
+static void put_page(FILE *fp, const vector<uint8_t> &image, uint32_t page, uint32_t &ext_addr)
+{
+    uint32_t addr = app_addr + page * FLASH_PAGE_SIZE;
+    uint32_t i;
+    
+    if ((addr >> 16) != ext_addr)
+    {
+        uint8_t hi[2] = { (uint8_t)(addr >> 24), (uint8_t)(addr >> 16) };
+        ext_addr = addr >> 16;
+        put_record(fp, 0x04, 0, hi, 2);
+    }
+    for (i = 0; i < FLASH_PAGE_SIZE; i += 16)
+    {
+        put_record(fp, 0x00, (uint16_t)(addr + i), &image[page * FLASH_PAGE_SIZE + i], 16);
+    }
+}
+
+static void print_usage(void)
+{
+    printf("Usage: btldr_plan -i new.hex (-c PAGES.CRC | -b FIRMWARE.BIN) -o update.hex [-a app_addr] [-z app_size] [-m mount_dir]\n");
+    printf("  -m   copy update.hex to the drive and measure the update, the device must restart\n");
+}
+
+int main(int argc, char *argv[])
+{
+    string hex, device, out, mount;
+    vector<uint8_t> image;
+    vector<uint32_t> dev_crc;
+    int i;
+    
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc)
+            hex = argv[++i];
+        else if ((!strcmp(argv[i], "-c") || !strcmp(argv[i], "-b")) && i + 1 < argc)
+            device = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out = argv[++i];
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+            mount = argv[++i];
+        else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+            app_addr = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-z") && i + 1 < argc)
+            app_size = strtoul(argv[++i], NULL, 0);
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+    
+    if (hex.empty() || device.empty() || out.empty() || (app_size % FLASH_PAGE_SIZE) != 0)
+    {
+        print_usage();
+        return 1;
+    }
+    
+    if (!load_hex(hex, image))
+    {
+        printf("Cannot parse %s\n", hex.c_str());
+        return 1;
+    }
+    if (!load_device_crc(device, dev_crc))
+    {
+        printf("Cannot read %s\n", device.c_str());
+        return 1;
+    }
+    
+    FILE *fp = fopen(out.c_str(), "w");
+    if (!fp)
+    {
+        printf("Cannot open %s for writing\n", out.c_str());
+        return 1;
+    }
+    
+    // The first page is written last: the bootloader erases the whole appcode area when a
+    // file starts at APP_ADDR, and the vector table is only valid once the rest is in place.
+    uint32_t nbr = app_size / FLASH_PAGE_SIZE;
+    uint32_t changed = 0, page, ext_addr = 0xFFFFFFFF;
+    bool first_changed = crc32(&image[0], FLASH_PAGE_SIZE) != dev_crc[0];
+    
+    for (page = 1; page < nbr; page++)
+    {
+        if (crc32(&image[page * FLASH_PAGE_SIZE], FLASH_PAGE_SIZE) != dev_crc[page])
+        {
+            put_page(fp, image, page, ext_addr);
+            changed++;
+        }
+    }
+    if (first_changed)
+    {
+        put_page(fp, image, 0, ext_addr);
+        changed++;
+    }
+    put_record(fp, 0x01, 0, NULL, 0);
+    long hex_size = ftell(fp);
+    fclose(fp);
+    
+    double predicted_ms = changed * (T_PAGE_ERASE_MS + (FLASH_PAGE_SIZE / 2) * T_HALFWORD_PROG_US / 1000.0) +
+                          hex_size * T_HEX_BYTE_US / 1000.0;
+    
+    printf("%u/%u pages changed, %s: %ld bytes\n", changed, nbr, out.c_str(), hex_size);
+    printf("Predicted: %.0f ms (+%.0f ms idle before the reset)\n", predicted_ms, T_SESSION_IDLE_MS);
+    
+    if (!mount.empty() && changed)
+    {
+        // From the copy until the drive disappears (reset after the session idle time)
+        fs::path status = fs::path(mount) / "STATUS.TXT";
+        error_code ec;
+        auto t0 = chrono::steady_clock::now();
+        
+        if (!fs::copy_file(out, fs::path(mount) / fs::path(out).filename(), fs::copy_options::overwrite_existing, ec))
+        {
+            printf("Copy failed: %s\n", ec.message().c_str());
+            return 1;
+        }
+        sync();
+        double copy_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        
+        while (fs::exists(status, ec) && chrono::steady_clock::now() - t0 < chrono::seconds(30))
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        double total_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        
+        printf("Measured: copy+sync %.0f ms, until disconnect %.0f ms (%.0f ms without idle)\n",
+               copy_ms, total_ms, total_ms - T_SESSION_IDLE_MS);
+    }
+    return 0;
+}
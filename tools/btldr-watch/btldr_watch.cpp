@@ -0,0 +1,336 @@
+/*************************************************************************************
+# Released under MIT License
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+Permission is hereby granted, free of charge, to any person obtaining a copy of this
+software and associated documentation files (the "Software"), to deal in the Software
+without restriction, including without limitation the rights to use, copy, modify, merge,
+publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or
+substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+// Watch mode flasher for Linux: rebuilds of the hex file are written to the raw LUN
+// (CONFIG_RAW_LUN) of the bootloader, only the 1KB flash pages which changed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+extern "C" {
+
+#include "../hex-crypt/ihex_parser.h"
+
+}
+
+#define FLASH_PAGE_SIZE         0x400u
+#define DEFAULT_APP_ADDR        0x08006000u     // APP_ADDR in btldr_config.h
+#define DEFAULT_APP_SIZE        (112u * 1024u)  // APP_SIZE of a 128KB device
+#define DEBOUNCE_MS             50              // editors and linkers write the file in several steps
+
+using namespace std;
+namespace fs = std::filesystem;
+
+typedef chrono::steady_clock clk;
+
+static uint32_t app_addr = DEFAULT_APP_ADDR;
+static uint32_t app_size = DEFAULT_APP_SIZE;
+static vector<uint8_t> *load_image;            // destination of the parser callback
+static uint32_t load_outside;                  // bytes outside of the appcode area
+
+static double ms_since(clk::time_point t0)
+{
+    return chrono::duration<double, milli>(clk::now() - t0).count();
+}
+
+static bool load_flash_data(uint32_t addr, const uint8_t *buf, uint8_t bufsize)
+{
+    uint8_t i;
+    
+    for (i = 0; i < bufsize; i++, addr++)
+    {
+        if (addr >= app_addr && addr < app_addr + app_size)
+        {
+            (*load_image)[addr - app_addr] = buf[i];
+        }
+        else
+        {
+            load_outside++;
+        }
+    }
+    return true;
+}
+
+// Normalised image: appcode area, unwritten bytes are 0xFF like erased flash
+static bool load_hex(const string &filename, vector<uint8_t> &image)
+{
+    ifstream f(filename, ios::binary);
+    if (!f)
+    {
+        return false;
+    }
+    ostringstream ss;
+    ss << f.rdbuf();
+    string content = ss.str();
+    
+    image.assign(app_size, 0xFF);
+    load_image = &image;
+    load_outside = 0;
+    
+    ihex_reset_state();
+    ihex_set_callback_func(load_flash_data);
+    if (!ihex_parser((const uint8_t *)content.data(), (uint32_t)content.size()))
+    {
+        printf("Parse failed: %s\n", filename.c_str());
+        return false;
+    }
+    if (load_outside)
+    {
+        printf("Warning: %u bytes outside of %08X-%08X ignored\n", load_outside, app_addr, app_addr + app_size);
+    }
+    return true;
+}
+
+static bool load_bin(const string &filename, vector<uint8_t> &image)
+{
+    ifstream f(filename, ios::binary);
+    if (!f)
+    {
+        return false;
+    }
+    image.assign(app_size, 0xFF);
+    f.read((char *)image.data(), app_size);
+    return true;
+}
+
+static bool save_bin(const string &filename, const vector<uint8_t> &image)
+{
+    string tmp = filename + ".tmp";
+    ofstream f(tmp, ios::binary | ios::trunc);
+    if (!f || !f.write((const char *)image.data(), image.size()))
+    {
+        return false;
+    }
+    f.close();
+    error_code ec;
+    fs::rename(tmp, filename, ec);
+    return !ec;
+}
+
+// Changed pages are written with one pwrite per run of consecutive pages, fsync sends
+// SYNCHRONIZE CACHE: the bootloader programs its page buffer before it returns.
+static bool flash_pages(int fd, const vector<uint8_t> &image, const vector<uint8_t> &base, uint32_t &pages)
+{
+    uint32_t page, first;
+    uint32_t nbr = app_size / FLASH_PAGE_SIZE;
+    
+    pages = 0;
+    for (page = 0; page < nbr; )
+    {
+        if (!base.empty() && memcmp(&image[page * FLASH_PAGE_SIZE], &base[page * FLASH_PAGE_SIZE], FLASH_PAGE_SIZE) == 0)
+        {
+            page++;
+            continue;
+        }
+        
+        first = page;
+        while (page < nbr && (base.empty() || memcmp(&image[page * FLASH_PAGE_SIZE], &base[page * FLASH_PAGE_SIZE], FLASH_PAGE_SIZE) != 0))
+        {
+            page++;
+        }
+        
+        size_t len = (size_t)(page - first) * FLASH_PAGE_SIZE;
+        if (pwrite(fd, &image[first * FLASH_PAGE_SIZE], len, (off_t)first * FLASH_PAGE_SIZE) != (ssize_t)len)
+        {
+            printf("Write failed at %08X: %s\n", app_addr + first * FLASH_PAGE_SIZE, strerror(errno));
+            return false;
+        }
+        pages += page - first;
+    }
+    
+    if (fsync(fd) != 0)
+    {
+        printf("Sync failed: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool flash_once(const string &hex, const string &dev, const string &state, vector<uint8_t> &base)
+{
+    vector<uint8_t> image;
+    uint32_t pages = 0;
+    auto t0 = clk::now();
+    
+    if (!load_hex(hex, image))
+    {
+        return false;
+    }
+    double parse_ms = ms_since(t0);
+    
+    auto t1 = clk::now();
+    int fd = open(dev.c_str(), O_WRONLY);
+    if (fd < 0)
+    {
+        printf("Cannot open %s: %s\n", dev.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = flash_pages(fd, image, base, pages);
+    close(fd);
+    double write_ms = ms_since(t1);
+    
+    if (!ok)
+    {
+        base.clear();               // device content unknown, next iteration writes everything
+        return false;
+    }
+    
+    base.swap(image);
+    if (!state.empty() && !save_bin(state, base))
+    {
+        printf("Warning: cannot save %s\n", state.c_str());
+    }
+    
+    printf("%s: %u/%u pages, parse %.1f ms, write+sync %.1f ms, total %.1f ms\n",
+           fs::path(hex).filename().c_str(), pages, app_size / FLASH_PAGE_SIZE, parse_ms, write_ms, ms_since(t0));
+    fflush(stdout);
+    return true;
+}
+
+// Watch the directory, the build usually replaces the file (rename) instead of rewriting it
+static int watch(const string &hex, const string &dev, const string &state, vector<uint8_t> &base)
+{
+    fs::path p = fs::absolute(hex);
+    string dir = p.parent_path().string();
+    string name = p.filename().string();
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        printf("inotify on %s failed: %s\n", dir.c_str(), strerror(errno));
+        return 1;
+    }
+    
+    printf("Watching %s, Ctrl+C to stop\n", p.c_str());
+    fflush(stdout);
+    
+    while (true)
+    {
+        bool changed = false;
+        ssize_t len = read(fd, buf, sizeof(buf));
+        
+        if (len <= 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 1;
+        }
+        
+        do
+        {
+            for (char *e = buf; e < buf + len; e += sizeof(struct inotify_event) + ((struct inotify_event *)e)->len)
+            {
+                struct inotify_event *ev = (struct inotify_event *)e;
+                if (ev->len && name == ev->name)
+                {
+                    changed = true;
+                }
+            }
+            
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            len = (poll(&pfd, 1, DEBOUNCE_MS) > 0) ? read(fd, buf, sizeof(buf)) : 0;
+        } while (len > 0);
+        
+        if (changed)
+        {
+            flash_once(hex, dev, state, base);
+        }
+    }
+}
+
+static void print_usage(void)
+{
+    printf("Usage: btldr_watch -i app.hex -d /dev/sdX [-s state.bin] [-r FIRMWARE.BIN] [-a app_addr] [-z app_size] [-1]\n");
+    printf("  -d   raw LUN of the bootloader (CONFIG_RAW_LUN), e.g. /dev/disk/by-id/usb-STM32_Raw_app_flash*\n");
+    printf("  -s   last flashed image, kept between runs (default .btldr_watch.bin)\n");
+    printf("  -r   image the device holds now (FIRMWARE.BIN readback with CONFIG_READ_FLASH, or the raw LUN itself)\n");
+    printf("  -1   flash once and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+    string hex, dev, readback;
+    string state = ".btldr_watch.bin";
+    bool once = false;
+    int i;
+    
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc)
+            hex = argv[++i];
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+            dev = argv[++i];
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            state = argv[++i];
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            readback = argv[++i];
+        else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+            app_addr = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-z") && i + 1 < argc)
+            app_size = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-1"))
+            once = true;
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+    
+    if (hex.empty() || dev.empty() || (app_size % FLASH_PAGE_SIZE) != 0)
+    {
+        print_usage();
+        return 1;
+    }
+    
+    // Baseline for the diff: readback, then the state of the last run, else a full write
+    vector<uint8_t> base;
+    if (!readback.empty())
+    {
+        if (!load_bin(readback, base))
+        {
+            printf("Cannot read %s\n", readback.c_str());
+            return 1;
+        }
+    }
+    else if (!load_bin(state, base))
+    {
+        base.clear();
+    }
+    
+    if (!flash_once(hex, dev, state, base) && once)
+    {
+        return 1;
+    }
+    return once ? 0 : watch(hex, dev, state, base);
+}
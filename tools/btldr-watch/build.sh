@@ -0,0 +1,3 @@
+#!/bin/sh
+gcc -c -o ihex_parser.o -O2 ../hex-crypt/ihex_parser.c
+g++ -std=c++17 -o btldr_watch -O2 btldr_watch.cpp ihex_parser.o
@@ -1,5 +1,5 @@
 srec_cat.exe ..\..\example-hex\STM32F103_FlashPC13LED_FAST.hex -Intel ^
--fill 0xFF 0x08004000 0x0801FFFC ^
--crop 0x08004000 0x0801FFFC ^
+-fill 0xFF 0x08006000 0x0801FFF8 ^
+-crop 0x08006000 0x0801FFF8 ^
 -CRC32_Big_Endian 0x801FFFC ^
 -o ..\..\example-hex\STM32F103_FlashPC13LED_FAST_CRC32.hex -Intel
\ No newline at end of file
@@ -7,6 +7,11 @@ static const uint8_t AES_INIT_IV[AES_IVLEN]    =    {0x84, 0x5E, 0xF4, 0x23, 0x3
 static const uint8_t AES_KEY[AES_KEYLEN]       =    {0x29, 0x76, 0xDE, 0xF0, 0x2A, 0xF4, 0x4E, 0xD7, 0xBE, 0x87, 0x1E, 0xA9, 0xDA, 0xB2, 0x5B, 0x24, \
                                                      0x3A, 0xCA, 0x66, 0x38, 0xA7, 0xF6, 0x44, 0x45, 0xB1, 0x2C, 0x5E, 0x86, 0xCB, 0x73, 0xBA, 0x2F};
 
+// 100 steps of the 128-bit LFSR (taps 0, 34, 67, 71, 101, shift right, feedback into bit 127).
+// The feedback of step j is only tapped again 27 steps later, so 27 steps are done at once.
+#define LFSR_STEPS          100
+#define LFSR_BATCH          27
+
 static void gen_iv_by_lfsr(uint8_t *iv, uint32_t addr)
 {
     uint8_t i;
@@ -19,32 +24,58 @@ static void gen_iv_by_lfsr(uint8_t *iv, uint32_t addr)
       iv[i+3] = ((addr >> 24) & 0xff) ^ AES_INIT_IV[i+3];
     }
     
-    uint32_t bit;     // Must be 32-bit to allow bit<<31 later in the code
-    uint8_t loop = 100;
+    uint32_t fb;
+    uint8_t n, k;
 
     uint32_t iv32[AES_IVLEN>>2];
     memcpy(iv32, iv, AES_IVLEN);
 
-    while (loop--)
+    for (n = LFSR_STEPS; n; n -= k)
     {
-        bit = ((iv32[0] >> 0) ^ (iv32[1] >> 2) ^ (iv32[2] >> 3) ^ (iv32[2] >> 7) ^ (iv32[3] >> 5)) & 1;
+        k = (n < LFSR_BATCH) ? n : LFSR_BATCH;
+        
+        fb = iv32[0] ^ ((iv32[1] >> 2) | (iv32[2] << 30)) ^ ((iv32[2] >> 3) | (iv32[3] << 29)) ^
+             ((iv32[2] >> 7) | (iv32[3] << 25)) ^ (iv32[3] >> 5);
+        fb &= (1ul << k) - 1;
     
-        iv32[0] = (iv32[0] >> 1) | (iv32[1] << 31);
-        iv32[1] = (iv32[1] >> 1) | (iv32[2] << 31);
-        iv32[2] = (iv32[2] >> 1) | (iv32[3] << 31);
-        iv32[3] = (iv32[3] >> 1) | (bit << 31);
-    };
+        iv32[0] = (iv32[0] >> k) | (iv32[1] << (32 - k));
+        iv32[1] = (iv32[1] >> k) | (iv32[2] << (32 - k));
+        iv32[2] = (iv32[2] >> k) | (iv32[3] << (32 - k));
+        iv32[3] = (iv32[3] >> k) | (fb << (32 - k));
+    }
     
     memcpy(iv, iv32, AES_IVLEN);
 }
 
-static struct AES_ctx ctx;
+static _Thread_local struct AES_ctx ctx;      // per thread, see hex_crypt batch mode
 
 void crypt_init()
 {
     AES_init_ctx(&ctx, AES_KEY);
 }
 
+uint32_t crypt_key_id(void)
+{
+    // FNV-1a over key and initial IV, identifies the key in the batch mode cache
+    uint32_t h = 0x811C9DC5;
+    uint8_t i;
+    
+    for (i = 0; i < AES_KEYLEN; i++)
+    {
+        h = (h ^ AES_KEY[i]) * 0x01000193;
+    }
+    for (i = 0; i < AES_IVLEN; i++)
+    {
+        h = (h ^ AES_INIT_IV[i]) * 0x01000193;
+    }
+    return h;
+}
+
+const uint8_t *crypt_get_roundkey(void)
+{
+    return ctx.RoundKey;
+}
+
 inline void crypt_encrypt(uint8_t *buf, uint32_t size, uint32_t addr)
 {
     // AES CTR is used, hence encrypt = decrypt
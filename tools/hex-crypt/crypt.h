@@ -19,6 +19,8 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 void crypt_init(void);
 void crypt_encrypt(uint8_t *buf, uint32_t size, uint32_t addr);
 void crypt_decrypt(uint8_t *buf, uint32_t size, uint32_t addr);
+const uint8_t *crypt_get_roundkey(void);            // runtime expanded key schedule, AES_keyExpSize bytes
+uint32_t crypt_key_id(void);                        // hash of key and IV, does not reveal the key
 
 
 #endif
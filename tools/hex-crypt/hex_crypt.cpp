@@ -20,6 +20,14 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEAL
 #include <string.h>
 #include <map>
 #include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
 
 
 extern "C" {
@@ -29,13 +37,21 @@ extern "C" {
 
 }
 
+#include "hex_decode.h"
+
+// Key schedule compiled into the bootloader, generated by "hex_crypt -g"
+#include "../../Inc/aes_roundkey.h"
+
 
 #define CONFIG_DEBUG_OUTPUT        0u
 
 using namespace std;
 
 typedef vector<uint8_t> byte_array_t;
-static map<uint32_t, byte_array_t> mem_map;
+static thread_local map<uint32_t, byte_array_t> mem_map;     // legacy parser, used by the decode bench
+static bool verbose_output = true;
+static unsigned decode_threads = 0;                          // 0: one per core
+static bool sector_aligned = false;                          // -a: sector aligned output layout
 
 bool save_flash_data(uint32_t addr, const uint8_t *buf, uint8_t bufsize)
 {
@@ -55,56 +71,125 @@ bool save_flash_data(uint32_t addr, const uint8_t *buf, uint8_t bufsize)
     return true;
 }
 
+//-------------------------------------------------------
+// Sector aligned layout: every 512 byte sector of the output file starts with a 0F sector header
+// record (crypt flag) and an 04 record, holds whole records only and is padded with LF, so the
+// bootloader can parse each sector on its own whatever order the host writes them in
+
+#define SECTOR_SIZE             512u
+#define SECTOR_REC_LEN          44u     // ":10AAAA00" + 32 data digits + checksum + LF
+
+static void sector_begin(string &sector, uint32_t addr)
+{
+    uint8_t cs;
+    char line[32];
+
+    cs = 0x02 + 0x04 + ((addr >> 24) & 0xff) + ((addr >> 16) & 0xff);
+    cs = ~cs + 1;
+    snprintf(line, sizeof(line), ":02000004%04X%02X\n", (addr >> 16) & 0xffff, cs);
+
+    sector = ":0100000F01EF\n";         // 0F record type (self-defined record type), flags bit0: encrypted
+    sector += line;
+}
+
+static void sector_end(FILE *fp, string &sector, bool pad)
+{
+    if (pad)
+    {
+        sector.resize(SECTOR_SIZE, '\n');
+    }
+    fwrite(sector.data(), 1, sector.size(), fp);
+    sector.clear();
+}
+
+static void write_sector_aligned(FILE *fp, const uint8_t *phy_mem, uint32_t start_addr, uint32_t size)
+{
+    string sector;
+    char line[64];
+    uint32_t i, j;
+    uint8_t cs;
+    int n;
+
+    for (i = 0; i < size; i += 16)
+    {
+        uint32_t addr = start_addr + i;
+
+        // A sector covers one 64K segment, its 04 record is only valid up to the next boundary
+        if (!sector.empty() && (sector.size() + SECTOR_REC_LEN > SECTOR_SIZE || (addr & 0xffff) == 0))
+        {
+            sector_end(fp, sector, true);
+        }
+        if (sector.empty())
+        {
+            sector_begin(sector, addr);
+        }
+
+        cs = 0x10 + ((addr >> 8) & 0xff) + (addr & 0xff);
+        n = snprintf(line, sizeof(line), ":10%04X00", addr & 0xffff);
+        for (j = 0; j < 16; j++)
+        {
+            cs += phy_mem[i + j];
+            n += snprintf(line + n, sizeof(line) - n, "%02X", phy_mem[i + j]);
+        }
+        cs = ~cs + 1;
+        snprintf(line + n, sizeof(line) - n, "%02X\n", cs);
+        sector += line;
+    }
+
+    if (sector.size() + 12 > SECTOR_SIZE)
+    {
+        sector_end(fp, sector, true);
+    }
+    if (sector.empty())
+    {
+        sector_begin(sector, start_addr + size);
+    }
+    sector += ":00000001FF\n";              // EOF record type
+    sector_end(fp, sector, false);
+}
+
 bool encrypt_file(const char *dest_filename, const char *src_filename)
 {
-    /* Open HEX file, read per 512 byte block size */
     bool return_status = false;
     
-    map<uint32_t, byte_array_t>::iterator iter;
+    hex_image_t image;
+    string err;
     uint8_t *phy_mem = 0;
     uint32_t start_addr;
+    uint32_t end_addr;
     uint32_t size;
     
-    uint8_t fbuf[512];
-    size_t readcount = 0;
-    
     uint32_t i, j;
     uint8_t cs;
     
-    FILE *fp = fopen(src_filename, "r");
-    if (fp == NULL)
+    FILE *fp = NULL;
+    
+    if (!hex_decode(src_filename, decode_threads ? decode_threads : thread::hardware_concurrency(), image, err))
     {
-        printf("Cannot open hex file for reading\n");
+        printf("Parse failed: %s\n", err.c_str());
         goto EXIT;
     }
-
-    ihex_set_callback_func(save_flash_data);
-
-    while ((readcount = fread(fbuf, 1, sizeof(fbuf), fp)) > 0)
+    
+    if (!hex_image_range(image, start_addr, end_addr))
     {
-        if (readcount < sizeof(fbuf))
-        {
-            fbuf[readcount] = '\0';     // Add null teminated char
-        }
-        if (!ihex_parser(fbuf, sizeof(fbuf)))
-        {
-            printf("Parse failed\n");
-            goto EXIT;
-        }
+        printf("No data record in hex file\n");
+        goto EXIT;
     }
-    fclose(fp);
-    fp = NULL;
-    
-    start_addr = mem_map.begin()->first;
-    size = mem_map.rbegin()->first + mem_map.rbegin()->second.size() - start_addr;
+    size = end_addr - start_addr;
 
-    printf("Start address: %08X\n", start_addr);
-    printf("Size: %08X\n", size);
+    if (verbose_output)
+    {
+        printf("Start address: %08X\n", start_addr);
+        printf("Size: %08X\n", size);
+    }
 
-    if (size & AES_BLOCKLEN)
+    if (size & (AES_BLOCKLEN - 1))
     {
         size = (size & ~(AES_BLOCKLEN-1)) + AES_BLOCKLEN;
-        printf("Size after align: %08X\n", size);
+        if (verbose_output)
+        {
+            printf("Size after align: %08X\n", size);
+        }
     }
 
     phy_mem = (uint8_t*)malloc(size);
@@ -113,13 +198,7 @@ bool encrypt_file(const char *dest_filename, const char *src_filename)
         printf("Failed to allocate memory\n");
         goto EXIT;
     }
-    memset(phy_mem, 0xFF, size);
-
-    for (iter = mem_map.begin(); iter != mem_map.end(); iter++)
-    {
-        uint32_t offs = iter->first - start_addr;
-        memcpy(phy_mem + offs, iter->second.data(), iter->second.size());
-    }
+    hex_image_flatten(image, start_addr, phy_mem, size);
 
 #if (CONFIG_DEBUG_OUTPUT > 0u)
     printf("Dump mem before encrypt\n");
@@ -160,31 +239,38 @@ bool encrypt_file(const char *dest_filename, const char *src_filename)
         goto EXIT;
     }
 
-    fprintf(fp, ":0000000EF2\n");       // 0E record type (self-defined record type), this file is encrypted
+    if (sector_aligned)
+    {
+        write_sector_aligned(fp, phy_mem, start_addr, size);
+    }
+    else
+    {
+        fprintf(fp, ":0000000EF2\n");       // 0E record type (self-defined record type), this file is encrypted
 
-    cs = 0x02;                          // generate checksum
-    cs += 0x04;
-    cs += (start_addr >> 24) & 0xff;
-    cs += (start_addr >> 16) & 0xff;
-    cs = ~cs + 1;
-    fprintf(fp, ":02000004%04X%02X\n", (start_addr >> 16) & 0xffff, cs);
+        cs = 0x02;                          // generate checksum
+        cs += 0x04;
+        cs += (start_addr >> 24) & 0xff;
+        cs += (start_addr >> 16) & 0xff;
+        cs = ~cs + 1;
+        fprintf(fp, ":02000004%04X%02X\n", (start_addr >> 16) & 0xffff, cs);
 
-    for (i = 0; i < size; i+=16)
-    {
-        cs = 0x10;                      // generate checksum
-        cs += ((start_addr+i) >> 8) & 0xff;
-        cs += (start_addr+i) & 0xff;
-        for (j = 0; j < 16; j++)
+        for (i = 0; i < size; i+=16)
         {
-            cs += phy_mem[i+j];
+            cs = 0x10;                      // generate checksum
+            cs += ((start_addr+i) >> 8) & 0xff;
+            cs += (start_addr+i) & 0xff;
+            for (j = 0; j < 16; j++)
+            {
+                cs += phy_mem[i+j];
+            }
+            cs = ~cs + 1;
+            fprintf(fp, ":10%04X00%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X\n", (start_addr+i) & 0xffff,     \
+                        phy_mem[i], phy_mem[i+1], phy_mem[i+2], phy_mem[i+3], phy_mem[i+4], phy_mem[i+5], phy_mem[i+6], phy_mem[i+7],   \
+                        phy_mem[i+8], phy_mem[i+9], phy_mem[i+10], phy_mem[i + 11], phy_mem[i + 12], phy_mem[i + 13], phy_mem[i + 14], phy_mem[i + 15], cs);
         }
-        cs = ~cs + 1;
-        fprintf(fp, ":10%04X00%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X\n", (start_addr+i) & 0xffff,     \
-                    phy_mem[i], phy_mem[i+1], phy_mem[i+2], phy_mem[i+3], phy_mem[i+4], phy_mem[i+5], phy_mem[i+6], phy_mem[i+7],   \
-                    phy_mem[i+8], phy_mem[i+9], phy_mem[i+10], phy_mem[i + 11], phy_mem[i + 12], phy_mem[i + 13], phy_mem[i + 14], phy_mem[i + 15], cs);
-    }
 
-    fprintf(fp, ":00000001FF\n");       // EOF record type
+        fprintf(fp, ":00000001FF\n");       // EOF record type
+    }
 
     fclose(fp);
     fp = NULL;
@@ -192,8 +278,6 @@ bool encrypt_file(const char *dest_filename, const char *src_filename)
     return_status = true;
 
 EXIT:
-    mem_map.clear();
-    
     if (fp)
         fclose(fp);
     
@@ -203,6 +287,344 @@ EXIT:
     return return_status;
 }
 
+//-------------------------------------------------------
+// Decode bench: legacy streaming parser against the parallel decoder at 1..N threads
+
+static bool legacy_decode(const char *src_filename)
+{
+    uint8_t fbuf[512];
+    size_t readcount;
+    
+    FILE *fp = fopen(src_filename, "r");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    
+    mem_map.clear();
+    ihex_reset_state();
+    ihex_set_callback_func(save_flash_data);
+    
+    while ((readcount = fread(fbuf, 1, sizeof(fbuf), fp)) > 0)
+    {
+        if (readcount < sizeof(fbuf))
+        {
+            fbuf[readcount] = '\0';
+        }
+        if (!ihex_parser(fbuf, sizeof(fbuf)))
+        {
+            fclose(fp);
+            return false;
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+bool bench_decode(const char *src_filename, unsigned max_threads)
+{
+    const int repeat = 3;
+    hex_image_t image;
+    string err;
+    double best;
+    int r;
+    
+    best = 1e30;
+    for (r = 0; r < repeat; r++)
+    {
+        auto t0 = chrono::steady_clock::now();
+        if (!legacy_decode(src_filename))
+        {
+            printf("Legacy parser failed\n");
+            return false;
+        }
+        best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+    }
+    
+    // Reference image from the legacy parser
+    uint32_t start_addr = mem_map.begin()->first;
+    uint32_t size = mem_map.rbegin()->first + (uint32_t)mem_map.rbegin()->second.size() - start_addr;
+    vector<uint8_t> ref(size, 0xFF);
+    for (const auto &rec : mem_map)
+    {
+        memcpy(&ref[rec.first - start_addr], rec.second.data(), rec.second.size());
+    }
+    mem_map.clear();
+    
+    printf("Size: %08X at %08X\n", size, start_addr);
+    printf("legacy      %9.1f ms\n", best);
+    double base_ms = 0;
+    
+    for (unsigned t = 1; ; t = min(t * 2, max_threads))
+    {
+        best = 1e30;
+        for (r = 0; r < repeat; r++)
+        {
+            auto t0 = chrono::steady_clock::now();
+            if (!hex_decode(src_filename, t, image, err))
+            {
+                printf("Parse failed: %s\n", err.c_str());
+                return false;
+            }
+            best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+        }
+        if (t == 1)
+        {
+            base_ms = best;
+        }
+        
+        uint32_t s, e;
+        vector<uint8_t> out(size);
+        if (!hex_image_range(image, s, e) || s != start_addr || e - s != size)
+        {
+            printf("%2u threads: range mismatch\n", t);
+            return false;
+        }
+        hex_image_flatten(image, s, out.data(), size);
+        if (out != ref)
+        {
+            printf("%2u threads: image mismatch\n", t);
+            return false;
+        }
+        
+        printf("%2u threads  %9.1f ms  x%.2f\n", t, best, base_ms / best);
+        
+        if (t >= max_threads)
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+//-------------------------------------------------------
+// Batch mode: convert many files concurrently, unchanged inputs are served from a content addressed cache
+
+// Bump when the output format of encrypt_file changes, so old cache entries are not reused
+#define BATCH_FORMAT_OPTIONS    "ihex;rec16;aes256-ctr-lfsr;v1"
+
+namespace fs = std::filesystem;
+
+typedef struct
+{
+    string src;
+    string dest;
+    bool hit;
+    bool ok;
+    double ms;
+}batch_job_t;
+
+static bool read_file(const string &filename, string &content)
+{
+    ifstream f(filename, ios::binary);
+    if (!f)
+    {
+        return false;
+    }
+    ostringstream ss;
+    ss << f.rdbuf();
+    content = ss.str();
+    return true;
+}
+
+// FNV-1a 64 over input bytes, key id and format options
+static string batch_cache_key(const string &content, uint32_t key_id)
+{
+    uint64_t h = 0xCBF29CE484222325ull;
+    size_t i;
+    
+    for (i = 0; i < content.size(); i++)
+    {
+        h = (h ^ (uint8_t)content[i]) * 0x100000001B3ull;
+    }
+    for (i = 0; i < 4; i++)
+    {
+        h = (h ^ ((key_id >> (i * 8)) & 0xff)) * 0x100000001B3ull;
+    }
+    for (i = 0; BATCH_FORMAT_OPTIONS[i]; i++)
+    {
+        h = (h ^ (uint8_t)BATCH_FORMAT_OPTIONS[i]) * 0x100000001B3ull;
+    }
+    
+    char name[32];
+    snprintf(name, sizeof(name), "%016llX.hex", (unsigned long long)h);
+    return name;
+}
+
+static void batch_run_job(batch_job_t &job, const fs::path &cache_dir, uint32_t key_id)
+{
+    auto t0 = chrono::steady_clock::now();
+    string content;
+    error_code ec;
+    
+    job.hit = false;
+    job.ok = false;
+    
+    if (read_file(job.src, content))
+    {
+        fs::path cached = cache_dir / batch_cache_key(content, key_id);
+        
+        if (fs::exists(cached, ec))
+        {
+            job.hit = true;
+            job.ok = fs::copy_file(cached, job.dest, fs::copy_options::overwrite_existing, ec);
+        }
+        else if (encrypt_file(job.dest.c_str(), job.src.c_str()))
+        {
+            // Publish by rename so a concurrent worker never sees a partial cache entry
+            fs::path tmp = cached;
+            tmp += "." + to_string(hash<thread::id>()(this_thread::get_id())) + ".tmp";
+            job.ok = true;
+            if (fs::copy_file(job.dest, tmp, fs::copy_options::overwrite_existing, ec))
+            {
+                fs::rename(tmp, cached, ec);
+            }
+        }
+    }
+    
+    job.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+// Manifest: one "src.hex [dest.hex]" per line, '#' starts a comment. Directory: every *.hex in it.
+static bool batch_collect(const char *input, const char *out_dir, vector<batch_job_t> &jobs)
+{
+    error_code ec;
+    
+    if (fs::is_directory(input, ec))
+    {
+        for (const auto &entry : fs::directory_iterator(input, ec))
+        {
+            string ext = entry.path().extension().string();
+            if (entry.is_regular_file() && (ext == ".hex" || ext == ".HEX"))
+            {
+                jobs.push_back({ entry.path().string(), (fs::path(out_dir) / entry.path().filename()).string(), false, false, 0 });
+            }
+        }
+        sort(jobs.begin(), jobs.end(), [](const batch_job_t &a, const batch_job_t &b) { return a.src < b.src; });
+        return true;
+    }
+    
+    ifstream f(input);
+    if (!f)
+    {
+        return false;
+    }
+    
+    string line;
+    while (getline(f, line))
+    {
+        istringstream ls(line);
+        string src, dest;
+        
+        if (!(ls >> src) || src[0] == '#')
+        {
+            continue;
+        }
+        if (!(ls >> dest))
+        {
+            dest = (fs::path(out_dir) / fs::path(src).filename()).string();
+        }
+        jobs.push_back({ src, dest, false, false, 0 });
+    }
+    return true;
+}
+
+bool batch_encrypt(const char *input, const char *out_dir, const char *cache_dir, unsigned threads)
+{
+    vector<batch_job_t> jobs;
+    vector<thread> workers;
+    atomic<size_t> next(0);
+    error_code ec;
+    uint32_t key_id = crypt_key_id();
+    
+    if (!batch_collect(input, out_dir, jobs))
+    {
+        printf("Cannot open manifest %s\n", input);
+        return false;
+    }
+    
+    fs::create_directories(out_dir, ec);
+    fs::create_directories(cache_dir, ec);
+    
+    verbose_output = false;
+    decode_threads = 1;                 // the files already run in parallel
+    
+    auto t0 = chrono::steady_clock::now();
+    
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+    threads = (unsigned)min((size_t)threads, max(jobs.size(), (size_t)1));
+    
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]() {
+            size_t i;
+            while ((i = next++) < jobs.size())
+            {
+                batch_run_job(jobs[i], cache_dir, key_id);
+            }
+        });
+    }
+    for (auto &w : workers)
+    {
+        w.join();
+    }
+    
+    double total_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+    
+    size_t hits = 0, fails = 0;
+    for (const auto &job : jobs)
+    {
+        printf("%-5s %8.2f ms  %s -> %s\n", !job.ok ? "FAIL" : (job.hit ? "HIT" : "MISS"), job.ms, job.src.c_str(), job.dest.c_str());
+        hits += job.hit ? 1 : 0;
+        fails += job.ok ? 0 : 1;
+    }
+    
+    printf("Key id: %08X, %u threads\n", key_id, threads);
+    printf("Files: %zu, cache hit: %zu (%.1f%%), failed: %zu, total: %.2f ms\n",
+           jobs.size(), hits, jobs.empty() ? 0.0 : (100.0 * hits / jobs.size()), fails, total_ms);
+    
+    return fails == 0;
+}
+
+//-------------------------------------------------------
+// FIRMWARE.BIN read from a bootloader with CONFIG_READ_FLASH_CRYPT: every 16 byte block is
+// encrypted with the keystream of its flash address, base_addr is the first one (APP_ADDR)
+
+bool decrypt_readback(const char *dest_filename, const char *src_filename, uint32_t base_addr)
+{
+    string content;
+    uint32_t i;
+    
+    if (!read_file(src_filename, content))
+    {
+        printf("Cannot open %s\n", src_filename);
+        return false;
+    }
+    if (content.size() % AES_BLOCKLEN)
+    {
+        printf("Size is not a multiple of %u\n", AES_BLOCKLEN);
+        return false;
+    }
+    
+    crypt_init();
+    for (i = 0; i < content.size(); i += AES_BLOCKLEN)
+    {
+        crypt_decrypt((uint8_t *)&content[i], AES_BLOCKLEN, base_addr + i);
+    }
+    
+    ofstream f(dest_filename, ios::binary);
+    f.write(content.data(), content.size());
+    if (!f)
+    {
+        printf("Cannot write %s\n", dest_filename);
+        return false;
+    }
+    return true;
+}
+
 bool test_crypt()
 {
     // Test crypt function
@@ -241,32 +663,165 @@ bool test_crypt()
     return true;
 }
 
+bool gen_roundkey_header(const char *dest_filename)
+{
+    uint32_t i;
+    
+    crypt_init();
+    const uint8_t *roundkey = crypt_get_roundkey();
+    
+    FILE *fp = fopen(dest_filename, "wb");
+    if (!fp)
+    {
+        printf("Cannot open file for writing\n");
+        return false;
+    }
+    
+    fprintf(fp, "// Generated by hex_crypt -g, do not edit.\n");
+    fprintf(fp, "// Pre-expanded AES key schedule of the key in crypt.c, placed in flash by the bootloader.\n\n");
+    fprintf(fp, "#ifndef _AES_ROUNDKEY_H_\n");
+    fprintf(fp, "#define _AES_ROUNDKEY_H_\n\n");
+    fprintf(fp, "#include <stdint.h>\n");
+    fprintf(fp, "#include \"aes.h\"\n\n");
+    fprintf(fp, "static const uint8_t AES_ROUNDKEY[AES_keyExpSize] = {");
+    for (i = 0; i < AES_keyExpSize; i++)
+    {
+        fprintf(fp, ((i % 16) == 0) ? "\n    " : " ");
+        fprintf(fp, "0x%02X%s", roundkey[i], (i + 1 < AES_keyExpSize) ? "," : "");
+    }
+    fprintf(fp, "\n};\n\n");
+    fprintf(fp, "#endif\n");
+    
+    fclose(fp);
+    return true;
+}
+
+bool test_roundkey()
+{
+    crypt_init();
+    
+    printf("=== Test pre-expanded key schedule\n");
+    if (memcmp(crypt_get_roundkey(), AES_ROUNDKEY, AES_keyExpSize) != 0)
+    {
+        printf("Inc/aes_roundkey.h does not match the runtime key expansion, regenerate it by hex_crypt -g\n");
+        return false;
+    }
+    printf("Key schedule matches (%u bytes)\n", AES_keyExpSize);
+    
+    return true;
+}
+
 void show_help()
 {
     printf("Crypt utility for STM32 MSD bootloader @ 2020\n\n");
     printf("Orginial author: https://github.com/sfyip\n");
     printf("Released under MIT License. Anyone is free to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so\n\n");
-    printf("Usage: hex_crypt -o dest.hex -i src.hex\n");
+    printf("Usage: hex_crypt -o dest.hex -i src.hex [-a]\n");
+    printf("                                       -a: sector aligned layout, parsed per sector by the bootloader\n");
+    printf("       hex_crypt -g aes_roundkey.h     generate the pre-expanded key schedule for the bootloader\n");
+    printf("       hex_crypt -t                    run self test\n");
+    printf("       hex_crypt -b manifest|dir -d out_dir [-c cache_dir] [-j threads]\n");
+    printf("                                       batch mode, manifest lines are \"src.hex [dest.hex]\"\n");
+    printf("       hex_crypt -r FIRMWARE.BIN app.bin [base]  decrypt an encrypted readback, base 0x08006000\n");
+    printf("       hex_crypt -p src.hex [-j threads]  decode bench, legacy parser against 1..N threads\n");
 }
 
 int main(int argc, char *argv[])
 {
-#if 0
-    if (!test_crypt())
+    if (argc == 2 && strcmp(argv[1], "-t") == 0)
+    {
+        if (!test_crypt() || !test_roundkey())
+        {
+            printf("Self test failed\n");
+            return EXIT_FAILURE;
+        }
+        printf("Self test passed\n");
+    }
+    else if (argc == 3 && strcmp(argv[1], "-g") == 0)
     {
-        printf("Test crypt function failed\n");
+        if (!gen_roundkey_header(argv[2]))
+        {
+            printf("Generate key schedule failed\n");
+            return EXIT_FAILURE;
+        }
+        printf("Generate key schedule done\n");
     }
-#endif
-
-    if (argc == 5)
+    else if ((argc == 4 || argc == 5) && strcmp(argv[1], "-r") == 0)
+    {
+        uint32_t base_addr = (argc == 5) ? (uint32_t)strtoul(argv[4], NULL, 0) : 0x08006000;
+        
+        if (!decrypt_readback(argv[3], argv[2], base_addr))
+        {
+            printf("Decrypt readback failed\n");
+            return EXIT_FAILURE;
+        }
+        printf("Decrypt readback done\n");
+    }
+    else if ((argc == 3 || argc == 5) && strcmp(argv[1], "-p") == 0)
+    {
+        unsigned threads = thread::hardware_concurrency();
+        
+        if (argc == 5 && strcmp(argv[3], "-j") == 0)
+        {
+            threads = (unsigned)atoi(argv[4]);
+        }
+        
+        if (!bench_decode(argv[2], max(threads, 1u)))
+        {
+            printf("Decode bench failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+    else if (argc >= 5 && strcmp(argv[1], "-b") == 0)
+    {
+        const char* input = argv[2];
+        const char* out_dir = 0;
+        const char* cache_dir = ".hex_crypt_cache";
+        unsigned threads = thread::hardware_concurrency();
+        
+        int i;
+        for (i = 3; (i + 1) < argc; i += 2)
+        {
+            if (strcmp(argv[i], "-d") == 0)
+            {
+                out_dir = argv[i + 1];
+            }
+            else if (strcmp(argv[i], "-c") == 0)
+            {
+                cache_dir = argv[i + 1];
+            }
+            else if (strcmp(argv[i], "-j") == 0)
+            {
+                threads = (unsigned)atoi(argv[i + 1]);
+            }
+        }
+        
+        if (out_dir == NULL)
+        {
+            printf("Please specific output directory\n");
+            return EXIT_FAILURE;
+        }
+        
+        if (!batch_encrypt(input, out_dir, cache_dir, threads))
+        {
+            printf("Batch encrypt failed\n");
+            return EXIT_FAILURE;
+        }
+        printf("Batch encrypt done\n");
+    }
+    else if (argc == 5 || argc == 6)
     {
         const char* dest_filename = 0;
         const char* src_filename = 0;
 
         uint8_t i;
-        for (i = 1; i < 5; i++)
+        for (i = 1; i < argc; i++)
         {
-            if (strcmp(argv[i], "-o") == 0)
+            if (strcmp(argv[i], "-a") == 0)
+            {
+                sector_aligned = true;
+            }
+            else if (strcmp(argv[i], "-o") == 0)
             {
                 if ((i + 1) < argc)
                 {
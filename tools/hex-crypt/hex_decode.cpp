@@ -0,0 +1,450 @@
+/*************************************************************************************
+# Released under MIT License
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+Permission is hereby granted, free of charge, to any person obtaining a copy of this
+software and associated documentation files (the "Software"), to deal in the Software
+without restriction, including without limitation the rights to use, copy, modify, merge,
+publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or
+substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <mutex>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "hex_decode.h"
+
+using namespace std;
+
+#define RECORD_TYPE_DATA            0x00
+#define RECORD_TYPE_EOF             0x01
+#define RECORD_TYPE_EX_SEG_ADDR     0x02
+#define RECORD_TYPE_START_SEG_ADDR  0x03
+#define RECORD_TYPE_EX_LIN_ADDR     0x04
+#define RECORD_TYPE_START_LIN_ADDR  0x05
+#define RECORD_TYPE_CRYPT_MODE      0x0E
+
+#define CHUNKS_PER_THREAD           4       // smaller chunks balance the load
+#define MIN_CHUNK_SIZE              (64 * 1024)
+
+// Data record seen before the first extended address record of its chunk
+typedef struct
+{
+    uint16_t addr_lo;
+    uint8_t len;
+    uint8_t data[255];
+}pending_record_t;
+
+typedef struct
+{
+    const char *begin;
+    const char *end;
+    
+    hex_image_t image;                  // records with a known base address
+    vector<pending_record_t> pending;   // resolved after the prefix scan
+    bool has_base;                      // an extended address record is in the chunk
+    uint32_t last_base;                 // base address in force at the end of the chunk
+    uint32_t base_in;                   // base address in force at the start, from the prefix scan
+    
+    bool ok;
+    size_t err_offset;
+}chunk_t;
+
+static int8_t hex_lut[256];
+
+static void hex_lut_init(void)
+{
+    int i;
+    
+    for (i = 0; i < 256; i++)
+    {
+        hex_lut[i] = -1;
+    }
+    for (i = 0; i < 10; i++)
+    {
+        hex_lut['0' + i] = i;
+    }
+    for (i = 0; i < 6; i++)
+    {
+        hex_lut['A' + i] = 10 + i;
+        hex_lut['a' + i] = 10 + i;
+    }
+}
+
+static void image_write(hex_image_t &image, uint32_t addr, const uint8_t *data, uint32_t len)
+{
+    while (len)
+    {
+        uint32_t page_addr = addr & ~(HEX_PAGE_SIZE - 1);
+        uint32_t offs = addr - page_addr;
+        uint32_t n = min(len, HEX_PAGE_SIZE - offs);
+        
+        auto it = image.find(page_addr);
+        if (it == image.end())
+        {
+            it = image.emplace(page_addr, hex_page_t()).first;
+            memset(it->second.data, 0xFF, sizeof(it->second.data));
+            memset(it->second.valid, 0, sizeof(it->second.valid));
+        }
+        
+        memcpy(&it->second.data[offs], data, n);
+        for (uint32_t i = offs; i < offs + n; i++)
+        {
+            it->second.valid[i >> 3] |= (uint8_t)(1u << (i & 7));
+        }
+        
+        addr += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static void image_merge(hex_image_t &dst, const hex_image_t &src)
+{
+    for (const auto &p : src)
+    {
+        auto it = dst.find(p.first);
+        if (it == dst.end())
+        {
+            dst.emplace(p.first, p.second);
+            continue;
+        }
+        for (uint32_t i = 0; i < HEX_PAGE_SIZE; i++)
+        {
+            if (p.second.valid[i >> 3] & (1u << (i & 7)))
+            {
+                it->second.data[i] = p.second.data[i];
+            }
+        }
+        for (uint32_t i = 0; i < sizeof(it->second.valid); i++)
+        {
+            it->second.valid[i] |= p.second.valid[i];
+        }
+    }
+}
+
+static bool decode_chunk(chunk_t &c)
+{
+    const uint8_t *p = (const uint8_t *)c.begin;
+    const uint8_t *end = (const uint8_t *)c.end;
+    uint8_t rec[5 + 255];
+    uint32_t base = 0;
+    
+    c.has_base = false;
+    c.ok = false;
+    
+    while (p < end)
+    {
+        if (*p == '\r' || *p == '\n' || *p == ' ' || *p == '\t')
+        {
+            p++;
+            continue;
+        }
+        if (*p == '\0')             // padding after the end of the file
+        {
+            break;
+        }
+        if (*p != ':' || end - p < 11)
+        {
+            c.err_offset = (const char *)p - c.begin;
+            return false;
+        }
+        p++;
+        
+        // count, address, type, data, checksum
+        int8_t h = hex_lut[p[0]], l = hex_lut[p[1]];
+        if ((h | l) < 0)
+        {
+            c.err_offset = (const char *)p - c.begin;
+            return false;
+        }
+        uint32_t n = 5 + (uint32_t)((h << 4) | l);
+        if ((size_t)(end - p) < 2 * n)
+        {
+            c.err_offset = (const char *)p - c.begin;
+            return false;
+        }
+        
+        uint8_t cs = 0;
+        for (uint32_t i = 0; i < n; i++, p += 2)
+        {
+            h = hex_lut[p[0]];
+            l = hex_lut[p[1]];
+            if ((h | l) < 0)
+            {
+                c.err_offset = (const char *)p - c.begin;
+                return false;
+            }
+            rec[i] = (uint8_t)((h << 4) | l);
+            cs += rec[i];
+        }
+        if (cs != 0)
+        {
+            c.err_offset = (const char *)p - c.begin;
+            return false;
+        }
+        
+        uint8_t len = rec[0];
+        uint16_t addr_lo = ((uint16_t)rec[1] << 8) | rec[2];
+        
+        switch (rec[3])
+        {
+        case RECORD_TYPE_DATA:
+            if (c.has_base)
+            {
+                image_write(c.image, base + addr_lo, &rec[4], len);
+            }
+            else
+            {
+                pending_record_t r;
+                r.addr_lo = addr_lo;
+                r.len = len;
+                memcpy(r.data, &rec[4], len);
+                c.pending.push_back(r);
+            }
+            break;
+            
+        case RECORD_TYPE_EX_SEG_ADDR:
+            base = (((uint32_t)rec[4] << 8) | rec[5]) << 4;
+            c.has_base = true;
+            break;
+            
+        case RECORD_TYPE_EX_LIN_ADDR:
+            base = (((uint32_t)rec[4] << 8) | rec[5]) << 16;
+            c.has_base = true;
+            break;
+            
+        case RECORD_TYPE_EOF:
+        case RECORD_TYPE_START_SEG_ADDR:
+        case RECORD_TYPE_START_LIN_ADDR:
+        case RECORD_TYPE_CRYPT_MODE:
+            break;
+            
+        default:
+            c.err_offset = (const char *)p - c.begin;
+            return false;
+        }
+    }
+    
+    c.last_base = base;
+    c.ok = true;
+    return true;
+}
+
+static void resolve_chunk(chunk_t &c)
+{
+    for (const auto &r : c.pending)
+    {
+        image_write(c.image, c.base_in + r.addr_lo, r.data, r.len);
+    }
+    c.pending.clear();
+}
+
+// Run fn(chunk index) on 'threads' workers
+template <typename F> static void run_pool(size_t nbr, unsigned threads, F fn)
+{
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    
+    for (unsigned t = 1; t < threads; t++)
+    {
+        workers.emplace_back([&]() {
+            size_t i;
+            while ((i = next++) < nbr)
+            {
+                fn(i);
+            }
+        });
+    }
+    size_t i;
+    while ((i = next++) < nbr)
+    {
+        fn(i);
+    }
+    for (auto &w : workers)
+    {
+        w.join();
+    }
+}
+
+bool hex_decode_buf(const char *buf, size_t size, unsigned threads, hex_image_t &image, string &err)
+{
+    static once_flag lut_once;
+    call_once(lut_once, hex_lut_init);
+    
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+    
+    // Split at line boundaries
+    size_t nbr = max((size_t)1, min((size_t)threads * CHUNKS_PER_THREAD, size / MIN_CHUNK_SIZE));
+    vector<chunk_t> chunks;
+    const char *end = buf + size;
+    const char *p = buf;
+    
+    for (size_t i = 0; i < nbr && p < end; i++)
+    {
+        const char *e = (i + 1 == nbr) ? end : min(end, buf + (size * (i + 1)) / nbr);
+        while (e < end && *(e - 1) != '\n')
+        {
+            e++;
+        }
+        if (e > p)
+        {
+            chunk_t c;
+            c.begin = p;
+            c.end = e;
+            chunks.push_back(std::move(c));
+        }
+        p = e;
+    }
+    
+    threads = (unsigned)min((size_t)threads, chunks.size());
+    run_pool(chunks.size(), threads, [&](size_t i) { decode_chunk(chunks[i]); });
+    
+    for (const auto &c : chunks)
+    {
+        if (!c.ok)
+        {
+            err = "invalid record at offset " + to_string((size_t)(c.begin - buf) + c.err_offset);
+            return false;
+        }
+    }
+    
+    // Prefix scan of the extended address records
+    uint32_t base = 0;
+    for (auto &c : chunks)
+    {
+        c.base_in = base;
+        if (c.has_base)
+        {
+            base = c.last_base;
+        }
+    }
+    
+    run_pool(chunks.size(), threads, [&](size_t i) { resolve_chunk(chunks[i]); });
+    
+    // Later records win, like programming the flash in file order
+    image.clear();
+    for (auto &c : chunks)
+    {
+        if (image.empty())
+        {
+            image.swap(c.image);
+        }
+        else
+        {
+            image_merge(image, c.image);
+        }
+    }
+    return true;
+}
+
+bool hex_decode(const char *filename, unsigned threads, hex_image_t &image, string &err)
+{
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        err = string("cannot open ") + filename;
+        return false;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        image.clear();
+        return true;
+    }
+    
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        err = string("cannot map ") + filename;
+        return false;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    
+    bool ok = hex_decode_buf((const char *)map, (size_t)st.st_size, threads, image, err);
+    munmap(map, (size_t)st.st_size);
+    return ok;
+#else
+    ifstream f(filename, ios::binary);
+    if (!f)
+    {
+        err = string("cannot open ") + filename;
+        return false;
+    }
+    ostringstream ss;
+    ss << f.rdbuf();
+    string content = ss.str();
+    return hex_decode_buf(content.data(), content.size(), threads, image, err);
+#endif
+}
+
+bool hex_image_range(const hex_image_t &image, uint32_t &start, uint32_t &end)
+{
+    uint32_t i;
+    
+    if (image.empty())
+    {
+        return false;
+    }
+    
+    const hex_page_t &first = image.begin()->second;
+    for (i = 0; i < HEX_PAGE_SIZE && !(first.valid[i >> 3] & (1u << (i & 7))); i++)
+    {
+    }
+    start = image.begin()->first + i;
+    
+    const hex_page_t &last = image.rbegin()->second;
+    for (i = HEX_PAGE_SIZE; i > 0 && !(last.valid[(i - 1) >> 3] & (1u << ((i - 1) & 7))); i--)
+    {
+    }
+    end = image.rbegin()->first + i;
+    return true;
+}
+
+void hex_image_flatten(const hex_image_t &image, uint32_t start, uint8_t *dst, uint32_t size)
+{
+    memset(dst, 0xFF, size);
+    
+    for (const auto &p : image)
+    {
+        uint32_t i;
+        for (i = 0; i < HEX_PAGE_SIZE; i++)
+        {
+            uint32_t addr = p.first + i;
+            if ((p.second.valid[i >> 3] & (1u << (i & 7))) && addr >= start && addr - start < size)
+            {
+                dst[addr - start] = p.second.data[i];
+            }
+        }
+    }
+}
@@ -0,0 +1,47 @@
+/*************************************************************************************
+# Released under MIT License
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+Permission is hereby granted, free of charge, to any person obtaining a copy of this
+software and associated documentation files (the "Software"), to deal in the Software
+without restriction, including without limitation the rights to use, copy, modify, merge,
+publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or
+substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+#ifndef _HEX_DECODE_H_
+#define _HEX_DECODE_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+// Parallel intel hex decoder for large files: the memory mapped input is split at line
+// boundaries, the chunks are decoded on a thread pool, the extended address (type 02/04)
+// in force at the start of each chunk is resolved by a prefix scan over the chunks.
+
+#define HEX_PAGE_SIZE       1024u
+
+typedef struct
+{
+    uint8_t data[HEX_PAGE_SIZE];
+    uint8_t valid[HEX_PAGE_SIZE / 8];   // bit set: byte written by a data record
+}hex_page_t;
+
+typedef std::map<uint32_t, hex_page_t> hex_image_t;    // page address -> page
+
+bool hex_decode(const char *filename, unsigned threads, hex_image_t &image, std::string &err);
+bool hex_decode_buf(const char *buf, size_t size, unsigned threads, hex_image_t &image, std::string &err);
+
+// First written byte and end (last written byte + 1), false if the image is empty
+bool hex_image_range(const hex_image_t &image, uint32_t &start, uint32_t &end);
+// Unwritten bytes are 0xFF
+void hex_image_flatten(const hex_image_t &image, uint32_t start, uint8_t *dst, uint32_t size);
+
+#endif
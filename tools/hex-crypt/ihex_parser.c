@@ -41,6 +41,9 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEAL
 
 #define INVALID_HEX_CHAR        'x'
 
+// Parser state is per thread, so hex_crypt can convert several files concurrently (batch mode)
+#define IHEX_TLS                _Thread_local
+
 // The maximum data size in ihex file should be 255, but most of compiler tools use 16/32. 32 should be already enough for general application.
 #define IHEX_DATA_SIZE          255
 
@@ -56,20 +59,20 @@ static uint8_t HexToDec(uint8_t h)
         return INVALID_HEX_CHAR;
 }
 
-static uint8_t state;
-static uint8_t byte_count;
-static uint16_t address_lo;
-static uint16_t address_hi;
-static bool ex_segment_addr_mode = false;
-static uint8_t record_type;
-static uint8_t data[IHEX_DATA_SIZE];
-static uint16_t data_size_in_nibble;    // In case IHEX_DATA_SIZE = 255, it should count up to 510
+static IHEX_TLS uint8_t state;
+static IHEX_TLS uint8_t byte_count;
+static IHEX_TLS uint16_t address_lo;
+static IHEX_TLS uint16_t address_hi;
+static IHEX_TLS bool ex_segment_addr_mode = false;
+static IHEX_TLS uint8_t record_type;
+static IHEX_TLS uint8_t data[IHEX_DATA_SIZE];
+static IHEX_TLS uint16_t data_size_in_nibble;    // In case IHEX_DATA_SIZE = 255, it should count up to 510
 
-static uint8_t temp_cs;         // save checksum high byte
-static uint8_t calc_cs;         // calculate checksum
-static bool calc_cs_toogle = false;
+static IHEX_TLS uint8_t temp_cs;         // save checksum high byte
+static IHEX_TLS uint8_t calc_cs;         // calculate checksum
+static IHEX_TLS bool calc_cs_toogle = false;
 
-static ihex_callback_fp callback_fp = 0;
+static IHEX_TLS ihex_callback_fp callback_fp = 0;
 
 #define TRANSFORM_ADDR(addr_hi, addr_lo)       (ex_segment_addr_mode) ?                                  \
                                                 ( (((uint32_t)(addr_hi)) << 4) + ((uint32_t)(addr_lo)) ): \
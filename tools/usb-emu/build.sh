@@ -0,0 +1,18 @@
+#!/bin/sh
+# The bootloader sources are built for the host, emu_target.h replaces the Cortex-M3 intrinsics
+R=../..
+M=$R/Middlewares/ST/STM32_USB_Device_Library
+INC="-I. -I$R/Inc -I$M/Core/Inc -I$M/Class/MSC/Inc -I$R/Drivers/STM32F1xx_HAL_Driver/Inc -I$R/Drivers/CMSIS/Device/ST/STM32F1xx/Include -I$R/Drivers/CMSIS/Include"
+DEF="-Wno-int-to-pointer-cast -Wno-pointer-to-int-cast -DSTM32F103xB -DUSE_HAL_DRIVER -include emu_target.h"
+SRC="$M/Core/Src/usbd_core.c $M/Core/Src/usbd_ctlreq.c $M/Core/Src/usbd_ioreq.c \
+     $M/Class/MSC/Src/usbd_msc.c $M/Class/MSC/Src/usbd_msc_bot.c $M/Class/MSC/Src/usbd_msc_data.c $M/Class/MSC/Src/usbd_msc_scsi.c \
+     $R/Src/usbd_storage_if.c $R/Src/fat32.c $R/Src/pipeline.c $R/Src/ihex_parser.c $R/Src/flash_sink.c \
+     $R/Src/crypt.c $R/Src/aes.c $R/Src/aes_ttable.c $R/Src/btldr_status.c $R/Src/uf2.c $R/Src/raw_lun.c \
+     $R/Src/selfupdate.c $R/Src/ram_app.c emu_board.c emu_device.c"
+rm -f *.o
+for f in $SRC; do
+    gcc -c -O2 $INC $DEF $f || exit 1
+done
+gcc -c -O2 usb_emu.c || exit 1
+gcc -o usb_emu *.o -pthread
+rm -f *.o
@@ -0,0 +1,68 @@
+/*************************************************************************************
+# Released under MIT License
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+Permission is hereby granted, free of charge, to any person obtaining a copy of this
+software and associated documentation files (the "Software"), to deal in the Software
+without restriction, including without limitation the rights to use, copy, modify, merge,
+publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or
+substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+// Interface between the emulated board (emu_board.c) and the FunctionFS front end (usb_emu.c)
+
+#ifndef EMU_H
+#define EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maps the flash (FLASH_BASE, 128KB) and SRAM (SRAM_BASE, 20KB) at their STM32 addresses.
+// flash_file keeps the flash content across runs (created erased), 0 for a RAM only flash.
+// flash_timing adds the erase (20ms) and half-word program (52us) time of the STM32F103.
+bool emu_board_init(const char *flash_file, bool flash_timing);
+
+// Endpoint callbacks run as the USB interrupt: the main loop is held off while PRIMASK is set
+void emu_isr_enter(void);
+void emu_isr_leave(void);
+
+// emu_device.c: USB device library and bootloader, called with the interrupt held
+bool emu_device_init(void);
+uint32_t emu_device_interface(uint8_t *fs, uint8_t *hs);    // interface + endpoint descriptors
+void emu_device_enable(void);
+void emu_device_disable(void);
+void emu_device_setup(const uint8_t *setup);
+void emu_device_in_done(uint8_t ep_addr);
+void emu_device_out_done(uint8_t ep_addr, uint8_t *buf, uint32_t size);
+void emu_device_halt_cleared(uint8_t ep_addr);
+void emu_device_poll(void);                                 // main loop, interrupt not held
+bool emu_inject(const char *spec);
+
+// usb_emu.c: endpoint I/O on FunctionFS. Bulk transfers complete later in the endpoint
+// thread (emu_device_in_done / emu_device_out_done), ep0 transfers complete at once.
+void emu_ep_transmit(uint8_t ep_addr, const uint8_t *buf, uint32_t size);
+void emu_ep_receive(uint8_t ep_addr, uint8_t *buf, uint32_t size);
+void emu_ep_stall(uint8_t ep_addr);
+void emu_ep_flush(uint8_t ep_addr);
+void emu_ep0_write(const uint8_t *buf, uint32_t size);
+uint32_t emu_ep0_read(uint8_t *buf, uint32_t size);
+void emu_ep0_stall(void);
+
+// The device left USB mode (end of the hex session, RAM image started), vector = 0 for a reset
+void emu_device_reset(const char *reason, uint32_t vector);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,301 @@
+/*************************************************************************************
+# Released under MIT License
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+Permission is hereby granted, free of charge, to any person obtaining a copy of this
+software and associated documentation files (the "Software"), to deal in the Software
+without restriction, including without limitation the rights to use, copy, modify, merge,
+publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or
+substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+// Host side of the board: flash and SRAM at their STM32 addresses, flash controller, HAL tick,
+// CRC, PRIMASK. Everything above (fat32, pipeline, flash sink, crypt, USB library) is the
+// bootloader code as it runs on the target.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stm32f1xx_hal.h"
+#include "btldr_config.h"
+#include "flash_ll.h"
+#include "crc.h"
+#include "usbd_msc.h"
+#include "emu.h"
+
+#define EMU_FLASH_SIZE          DEV_FLASH_SIZE
+#define EMU_SRAM_SIZE           DEV_SRAM_SIZE
+#define EMU_ERASE_US            20000u      // tERASE, STM32F103 datasheet
+#define EMU_PROG_US             52u         // tPROG per half-word
+
+DWT_Type emu_dwt;
+CoreDebug_Type emu_core_debug;
+
+static pthread_mutex_t emu_irq = PTHREAD_MUTEX_INITIALIZER;
+static __thread uint32_t emu_primask;       // 1 while this thread holds emu_irq
+static struct timespec emu_t0;
+static bool emu_flash_timing;
+static uint32_t emu_flash_debt_us;          // program time not slept yet
+static bool emu_flash_locked = true;
+
+//-------------------------------------------------------
+// PRIMASK
+
+uint32_t emu_get_primask(void)
+{
+    return emu_primask;
+}
+
+void emu_disable_irq(void)
+{
+    if (!emu_primask)
+    {
+        pthread_mutex_lock(&emu_irq);
+        emu_primask = 1;
+    }
+}
+
+void emu_enable_irq(void)
+{
+    if (emu_primask)
+    {
+        emu_primask = 0;
+        pthread_mutex_unlock(&emu_irq);
+    }
+}
+
+void emu_set_primask(uint32_t primask)
+{
+    if (primask)
+    {
+        emu_disable_irq();
+    }
+    else
+    {
+        emu_enable_irq();
+    }
+}
+
+void emu_isr_enter(void)
+{
+    emu_disable_irq();
+}
+
+void emu_isr_leave(void)
+{
+    emu_enable_irq();
+}
+
+//-------------------------------------------------------
+// HAL
+
+uint32_t HAL_GetTick(void)
+{
+    struct timespec t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint32_t)((t.tv_sec - emu_t0.tv_sec) * 1000 + (t.tv_nsec - emu_t0.tv_nsec) / 1000000);
+}
+
+void HAL_Delay(uint32_t delay)
+{
+    usleep(delay * 1000u);
+}
+
+HAL_StatusTypeDef HAL_DeInit(void)
+{
+    return HAL_OK;
+}
+
+void jump_to_image(uint32_t vector)
+{
+    emu_device_reset("RAM image started", vector);
+}
+
+// No fast boot path in the emulator, see fast_boot.c
+void app_token_clear(void)
+{
+}
+
+//-------------------------------------------------------
+// Flash controller: NOR semantics, a half-word is programmed once after the erase
+
+static void _emu_flash_delay(uint32_t us)
+{
+    if (!emu_flash_timing)
+    {
+        return;
+    }
+    
+    // Sleep in 1ms steps, a nanosleep per half-word would cost more than the half-word
+    emu_flash_debt_us += us;
+    if (emu_flash_debt_us >= 1000u)
+    {
+        usleep(emu_flash_debt_us);
+        emu_flash_debt_us = 0;
+    }
+}
+
+bool flash_ll_unlock(void)
+{
+    bool was_locked = emu_flash_locked;
+    
+    emu_flash_locked = false;
+    return was_locked;
+}
+
+void flash_ll_lock(void)
+{
+    emu_flash_locked = true;
+}
+
+bool flash_ll_erase_page(uint32_t addr)
+{
+    if (emu_flash_locked || addr < FLASH_BASE || addr >= FLASH_BASE + EMU_FLASH_SIZE)
+    {
+        return false;
+    }
+    
+    memset((void *)(uintptr_t)(addr & ~(FLASH_PAGE_SIZE - 1u)), 0xFF, FLASH_PAGE_SIZE);
+    _emu_flash_delay(EMU_ERASE_US);
+    return true;
+}
+
+bool flash_ll_program_halfword(uint32_t addr, uint16_t value)
+{
+    volatile uint16_t *p = (volatile uint16_t *)(uintptr_t)addr;
+    
+    if (emu_flash_locked || addr < FLASH_BASE || addr >= FLASH_BASE + EMU_FLASH_SIZE || (addr & 1u))
+    {
+        return false;
+    }
+    if (*p != 0xFFFF && value != 0x0000)
+    {
+        return false;               // PGERR
+    }
+    
+    *p = value;
+    _emu_flash_delay(EMU_PROG_US);
+    return true;
+}
+
+//-------------------------------------------------------
+// CRC32, the software variant of Src/crc.c (the target one uses the CRC unit)
+
+static const uint32_t emu_crc32_nibble_tab[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+    0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+uint32_t crc32_update(uint32_t crc, const unsigned char *data, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ emu_crc32_nibble_tab[crc & 0x0F];
+        crc = (crc >> 4) ^ emu_crc32_nibble_tab[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+uint32_t crc32_finish(uint32_t crc)
+{
+    return __builtin_bswap32(crc);
+}
+
+uint32_t crc32_calculate(const unsigned char *data, size_t len)
+{
+    return crc32_finish(crc32_update(0, data, len));
+}
+
+//-------------------------------------------------------
+// USB library static allocation, same as Src/usbd_conf.c
+
+void *USBD_static_malloc(uint32_t size)
+{
+    static uint32_t mem[(sizeof(USBD_MSC_BOT_HandleTypeDef) / 4) + 1];
+    
+    (void)size;
+    return mem;
+}
+
+void USBD_static_free(void *p)
+{
+    (void)p;
+}
+
+//-------------------------------------------------------
+
+static bool _emu_map(uintptr_t addr, uint32_t size, int fd)
+{
+    void *p = mmap((void *)addr, size, PROT_READ | PROT_WRITE,
+                   MAP_FIXED_NOREPLACE | (fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED), fd, 0);
+    
+    if (p != (void *)addr)
+    {
+        printf("Cannot map 0x%08lX (%s)\n", (unsigned long)addr, p == MAP_FAILED ? strerror(errno) : "address in use");
+        return false;
+    }
+    return true;
+}
+
+bool emu_board_init(const char *flash_file, bool flash_timing)
+{
+    int fd = -1;
+    struct stat st;
+    bool fresh = true;
+    
+    clock_gettime(CLOCK_MONOTONIC, &emu_t0);
+    emu_flash_timing = flash_timing;
+    
+    if (flash_file)
+    {
+        fd = open(flash_file, O_RDWR | O_CREAT, 0644);
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            printf("Cannot open %s\n", flash_file);
+            return false;
+        }
+        fresh = (st.st_size == 0);
+        if (ftruncate(fd, EMU_FLASH_SIZE) != 0)
+        {
+            close(fd);
+            return false;
+        }
+    }
+    
+    if (!_emu_map(FLASH_BASE, EMU_FLASH_SIZE, fd) || !_emu_map(SRAM_BASE, EMU_SRAM_SIZE, -1))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    
+    if (fresh)
+    {
+        memset((void *)(uintptr_t)FLASH_BASE, 0xFF, EMU_FLASH_SIZE);
+    }
+    return true;
+}
@@ -0,0 +1,379 @@
+/*************************************************************************************
+# Released under MIT License
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+Permission is hereby granted, free of charge, to any person obtaining a copy of this
+software and associated documentation files (the "Software"), to deal in the Software
+without restriction, including without limitation the rights to use, copy, modify, merge,
+publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or
+substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+// Device side of the emulator: the low level driver interface (USBD_LL_*) of the ST USB
+// device library on top of the FunctionFS endpoints, the bring-up done by MX_USB_DEVICE_Init
+// and the main loop of main.c. Everything here runs with the emulated USB interrupt held,
+// except emu_device_poll (main loop).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "usbd_core.h"
+#include "usbd_msc.h"
+#include "usbd_msc_bot.h"
+#include "usbd_msc_scsi.h"
+#include "usbd_storage_if.h"
+#include "btldr_config.h"
+#include "fat32.h"
+#include "crypt.h"
+#include "btldr_status.h"
+#include "emu.h"
+
+#define EMU_RULE_NBR            16
+
+typedef struct
+{
+    char type;                  // 'r' read error, 'w' write error, 'n' not ready, 'd' delay
+    uint32_t lba;
+    uint32_t count;             // remaining hits, 0 = every time
+    uint32_t ms;
+}emu_rule_t;
+
+static USBD_HandleTypeDef emu_dev;
+static USBD_StorageTypeDef emu_storage;
+static uint32_t emu_rx_size[16];
+static emu_rule_t emu_rules[EMU_RULE_NBR];
+static uint32_t emu_rule_nbr;
+static bool emu_session_reported;
+
+//-------------------------------------------------------
+// Error injection in front of the bootloader storage (usbd_storage_if.c)
+
+bool emu_inject(const char *spec)
+{
+    emu_rule_t r = {0};
+    char type;
+    unsigned a = 0, b = 0;
+    int n = sscanf(spec, "%c:%u:%u", &type, &a, &b);
+    
+    if (n < 2 || emu_rule_nbr >= EMU_RULE_NBR || !strchr("rwnd", type))
+    {
+        return false;
+    }
+    
+    r.type = type;
+    switch (type)
+    {
+    case 'r':
+    case 'w':
+        r.lba = a;
+        r.count = (n == 3) ? b : 1;
+        break;
+    case 'n':
+        r.count = a;
+        break;
+    case 'd':
+        r.ms = a;
+        break;
+    }
+    emu_rules[emu_rule_nbr++] = r;
+    return true;
+}
+
+static bool _emu_rule_hit(char type, uint32_t blk_addr, uint16_t blk_len)
+{
+    uint32_t i;
+    
+    for (i = 0; i < emu_rule_nbr; i++)
+    {
+        emu_rule_t *r = &emu_rules[i];
+        
+        if (r->type == 'd' && (type == 'r' || type == 'w'))
+        {
+            usleep(r->ms * 1000u);
+            continue;
+        }
+        if (r->type != type)
+        {
+            continue;
+        }
+        if (type != 'n' && !(r->lba >= blk_addr && r->lba < blk_addr + blk_len))
+        {
+            continue;
+        }
+        if (r->count && --r->count == 0)
+        {
+            r->type = '-';          // used up, a count of 0 fails every time
+        }
+        printf("inject: %s error at LBA %u\n", type == 'r' ? "read" : type == 'w' ? "write" : "not ready", (unsigned)r->lba);
+        return true;
+    }
+    return false;
+}
+
+static int8_t _emu_storage_ready(uint8_t lun)
+{
+    if (_emu_rule_hit('n', 0, 0))
+    {
+        return -1;
+    }
+    return USBD_Storage_Interface_fops_FS.IsReady(lun);
+}
+
+static int8_t _emu_storage_read(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len)
+{
+    if (_emu_rule_hit('r', blk_addr, blk_len))
+    {
+        return -1;
+    }
+    return USBD_Storage_Interface_fops_FS.Read(lun, buf, blk_addr, blk_len);
+}
+
+static int8_t _emu_storage_write(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len)
+{
+    if (_emu_rule_hit('w', blk_addr, blk_len))
+    {
+        return -1;
+    }
+    return USBD_Storage_Interface_fops_FS.Write(lun, buf, blk_addr, blk_len);
+}
+
+//-------------------------------------------------------
+// Low level driver
+
+USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
+{
+    (void)pdev;
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_DeInit(USBD_HandleTypeDef *pdev)
+{
+    (void)pdev;
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Start(USBD_HandleTypeDef *pdev)
+{
+    (void)pdev;
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Stop(USBD_HandleTypeDef *pdev)
+{
+    (void)pdev;
+    return USBD_OK;
+}
+
+// FunctionFS enables the endpoints with the configuration
+USBD_StatusTypeDef USBD_LL_OpenEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t ep_type, uint16_t ep_mps)
+{
+    (void)pdev; (void)ep_addr; (void)ep_type; (void)ep_mps;
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_CloseEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    (void)pdev; (void)ep_addr;
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_FlushEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    (void)pdev;
+    if (ep_addr & 0x7F)
+    {
+        emu_ep_flush(ep_addr);
+    }
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_StallEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    (void)pdev;
+    if (ep_addr & 0x7F)
+    {
+        emu_ep_stall(ep_addr);
+    }
+    else
+    {
+        emu_ep0_stall();
+    }
+    return USBD_OK;
+}
+
+// The host clears a halt through dummy_hcd, see emu_device_halt_cleared
+USBD_StatusTypeDef USBD_LL_ClearStallEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    (void)pdev; (void)ep_addr;
+    return USBD_OK;
+}
+
+uint8_t USBD_LL_IsStallEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    (void)pdev; (void)ep_addr;
+    return 0;
+}
+
+USBD_StatusTypeDef USBD_LL_SetUSBAddress(USBD_HandleTypeDef *pdev, uint8_t dev_addr)
+{
+    (void)pdev; (void)dev_addr;
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Transmit(USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t *pbuf, uint16_t size)
+{
+    (void)pdev;
+    if (ep_addr & 0x7F)
+    {
+        emu_ep_transmit(ep_addr, pbuf, size);
+    }
+    else
+    {
+        emu_ep0_write(pbuf, size);
+    }
+    return USBD_OK;
+}
+
+// The status stage of a control transfer is done by FunctionFS
+USBD_StatusTypeDef USBD_LL_PrepareReceive(USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t *pbuf, uint16_t size)
+{
+    (void)pdev;
+    if (ep_addr & 0x7F)
+    {
+        emu_ep_receive(ep_addr, pbuf, size);
+    }
+    else if (size != 0)
+    {
+        emu_rx_size[0] = emu_ep0_read(pbuf, size);
+    }
+    return USBD_OK;
+}
+
+uint32_t USBD_LL_GetRxDataSize(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    (void)pdev;
+    return emu_rx_size[ep_addr & 0x0F];
+}
+
+//-------------------------------------------------------
+
+uint32_t emu_device_interface(uint8_t *fs, uint8_t *hs)
+{
+    uint16_t len;
+    uint8_t *cfg;
+    
+    // Interface and endpoint descriptors of the class, without the configuration descriptor
+    cfg = emu_dev.pClass->GetFSConfigDescriptor(&len);
+    memcpy(fs, cfg + 9, len - 9);
+    cfg = emu_dev.pClass->GetHSConfigDescriptor(&len);
+    memcpy(hs, cfg + 9, len - 9);
+    return len - 9;
+}
+
+// MX_USB_DEVICE_Init and the start of the bootloader branch of main()
+bool emu_device_init(void)
+{
+    status_init();
+    
+    emu_storage = USBD_Storage_Interface_fops_FS;
+    emu_storage.IsReady = _emu_storage_ready;
+    emu_storage.Read = _emu_storage_read;
+    emu_storage.Write = _emu_storage_write;
+    
+    if (USBD_Init(&emu_dev, NULL, DEVICE_FS) != USBD_OK ||
+        USBD_RegisterClass(&emu_dev, &USBD_MSC) != USBD_OK ||
+        USBD_MSC_RegisterStorage(&emu_dev, &emu_storage) != USBD_OK ||
+        USBD_Start(&emu_dev) != USBD_OK)
+    {
+        return false;
+    }
+    
+#if (CONFIG_SUPPORT_CRYPT_MODE > 0u)
+    crypt_init();
+#endif
+    return true;
+}
+
+// Bus reset and SET_CONFIGURATION, FunctionFS reports both as one ENABLE event
+void emu_device_enable(void)
+{
+    USBD_LL_Reset(&emu_dev);
+    USBD_LL_SetSpeed(&emu_dev, USBD_SPEED_FULL);
+    emu_dev.dev_config = 1;
+    emu_dev.dev_state = USBD_STATE_CONFIGURED;
+    USBD_SetClassConfig(&emu_dev, 1);
+}
+
+void emu_device_disable(void)
+{
+    if (emu_dev.dev_state == USBD_STATE_CONFIGURED)
+    {
+        USBD_ClrClassConfig(&emu_dev, 1);
+    }
+    emu_dev.dev_state = USBD_STATE_DEFAULT;
+}
+
+void emu_device_setup(const uint8_t *setup)
+{
+    USBD_LL_SetupStage(&emu_dev, (uint8_t *)setup);
+}
+
+void emu_device_in_done(uint8_t ep_addr)
+{
+    USBD_LL_DataInStage(&emu_dev, ep_addr & 0x7F, NULL);
+}
+
+void emu_device_out_done(uint8_t ep_addr, uint8_t *buf, uint32_t size)
+{
+    emu_rx_size[ep_addr & 0x0F] = size;
+    USBD_LL_DataOutStage(&emu_dev, ep_addr & 0x7F, buf);
+}
+
+// dummy_hcd handles CLEAR_FEATURE(ENDPOINT_HALT) itself, the gadget never sees it. usb-storage
+// clears a halted bulk endpoint before it uses it again and the requests queued meanwhile stay
+// behind the halt, so the clear is reported to the class as soon as the halt is set. After a bad
+// CBW the halt lasts until the reset recovery (class reset request), the clear is not reported.
+void emu_device_halt_cleared(uint8_t ep_addr)
+{
+    USBD_MSC_BOT_HandleTypeDef *hmsc = (USBD_MSC_BOT_HandleTypeDef *)emu_dev.pClassData;
+    USBD_SetupReqTypedef req;
+    
+    if (hmsc == NULL || hmsc->bot_status == USBD_BOT_STATUS_ERROR || emu_dev.dev_state != USBD_STATE_CONFIGURED)
+    {
+        return;
+    }
+    
+    req.bmRequest = USB_REQ_RECIPIENT_ENDPOINT;
+    req.bRequest = USB_REQ_CLEAR_FEATURE;
+    req.wValue = USB_FEATURE_EP_HALT;
+    req.wIndex = ep_addr;
+    req.wLength = 0;
+    emu_dev.pClass->Setup(&emu_dev, &req);
+}
+
+// One pass of the main loop of main.c
+void emu_device_poll(void)
+{
+#if (MSC_READ_AHEAD > 0)
+    SCSI_ReadAhead(&emu_dev);
+#endif
+#if (CONFIG_SUPPORT_CRYPT_MODE > 0u)
+    if (fat32_is_crypt_mode())
+    {
+        crypt_keystream_fill();
+    }
+#endif
+    if (!emu_session_reported && fat32_session_is_done())
+    {
+        emu_session_reported = true;
+        emu_device_reset("hex session done", 0);
+    }
+}
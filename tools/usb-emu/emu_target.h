@@ -0,0 +1,56 @@
+/*************************************************************************************
+# Released under MIT License
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+Permission is hereby granted, free of charge, to any person obtaining a copy of this
+software and associated documentation files (the "Software"), to deal in the Software
+without restriction, including without limitation the rights to use, copy, modify, merge,
+publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or
+substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+// Force-included in front of every bootloader and USB library source built for the host.
+// The Cortex-M intrinsics the target code uses are mapped to the emulator: PRIMASK is a
+// mutex shared with the endpoint threads (the "USB interrupt"), DWT is a plain variable.
+
+#ifndef EMU_TARGET_H
+#define EMU_TARGET_H
+
+#include "stm32f1xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t emu_get_primask(void);
+void emu_set_primask(uint32_t primask);
+void emu_disable_irq(void);
+void emu_enable_irq(void);
+
+extern DWT_Type emu_dwt;
+extern CoreDebug_Type emu_core_debug;
+
+#ifdef __cplusplus
+}
+#endif
+
+#define __get_PRIMASK()         emu_get_primask()
+#define __set_PRIMASK(x)        emu_set_primask(x)
+#define __disable_irq()         emu_disable_irq()
+#define __enable_irq()          emu_enable_irq()
+#define __DMB()                 __sync_synchronize()
+#define __DSB()                 __sync_synchronize()
+#define __ISB()                 __sync_synchronize()
+
+#undef DWT
+#define DWT                     (&emu_dwt)
+#undef CoreDebug
+#define CoreDebug               (&emu_core_debug)
+
+#endif
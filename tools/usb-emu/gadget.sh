@@ -0,0 +1,43 @@
+#!/bin/sh
+# gadget.sh start [usb_emu options] | stop
+# USB gadget with one FunctionFS function on dummy_hcd, the host side is the usb-storage driver
+G=/sys/kernel/config/usb_gadget/btldr
+FFS=/dev/ffs-btldr
+
+case "$1" in
+start)
+    shift
+    modprobe libcomposite || exit 1
+    modprobe dummy_hcd is_high_speed=0 || exit 1
+    mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+    mkdir -p $G/strings/0x409 $G/configs/c.1/strings/0x409 $G/functions/ffs.btldr
+    echo 0x0483 > $G/idVendor
+    echo 0x572a > $G/idProduct
+    echo STMicroelectronics > $G/strings/0x409/manufacturer
+    echo "STM32 Mass Storage" > $G/strings/0x409/product
+    echo "Bootloader" > $G/configs/c.1/strings/0x409/configuration
+    [ -e $G/configs/c.1/ffs.btldr ] || ln -s $G/functions/ffs.btldr $G/configs/c.1/
+    mkdir -p $FFS
+    mountpoint -q $FFS || mount -t functionfs btldr $FFS || exit 1
+    "$(dirname "$0")/usb_emu" -f $FFS "$@" &
+    PID=$!
+    while [ ! -e $FFS/ep1 ]; do
+        kill -0 $PID 2>/dev/null || exit 1
+        sleep 0.1
+    done
+    ls /sys/class/udc | head -n 1 > $G/UDC
+    wait
+    ;;
+stop)
+    [ -e $G/UDC ] && echo "" > $G/UDC
+    pkill -INT -x usb_emu
+    sleep 0.5
+    umount $FFS 2>/dev/null
+    rm -f $G/configs/c.1/ffs.btldr
+    rmdir $G/configs/c.1/strings/0x409 $G/configs/c.1 $G/functions/ffs.btldr $G/strings/0x409 $G 2>/dev/null
+    ;;
+*)
+    echo "usage: gadget.sh start [usb_emu options] | stop"
+    exit 1
+    ;;
+esac
@@ -0,0 +1,733 @@
+/*************************************************************************************
+# Released under MIT License
+Copyright (c) 2020 SF Yip (yipxxx@gmail.com)
+Permission is hereby granted, free of charge, to any person obtaining a copy of this
+software and associated documentation files (the "Software"), to deal in the Software
+without restriction, including without limitation the rights to use, copy, modify, merge,
+publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or
+substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**************************************************************************************/
+
+// USB level emulation of the bootloader on Linux. The ST USB device library (core + MSC class)
+// and the bootloader storage run on a FunctionFS function, dummy_hcd connects the gadget to the
+// usb-storage driver of the same machine: mount, cp and dd work as with the real device.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <endian.h>
+#include <linux/usb/functionfs.h>
+
+#include "emu.h"
+
+#define EMU_EP_NBR              2
+#define EMU_QUEUE_LEN           4           // BOT has at most a halt and a transfer pending per endpoint
+#define EMU_DESC_MAX            64
+#define EMU_INTERFACE_NAME      "STM32 MSD bootloader (emulated)"
+
+#define BOT_CBW_SIGNATURE       0x43425355u
+#define BOT_CSW_SIGNATURE       0x53425355u
+#define BOT_CBW_LENGTH          31u
+#define BOT_CSW_LENGTH          13u
+
+typedef enum
+{
+    EMU_OP_TX,
+    EMU_OP_RX,
+    EMU_OP_HALT,
+}emu_op_type_t;
+
+typedef struct
+{
+    emu_op_type_t type;
+    uint8_t *buf;
+    uint32_t size;
+}emu_op_t;
+
+typedef struct
+{
+    uint8_t addr;
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    emu_op_t queue[EMU_QUEUE_LEN];
+    uint32_t head;
+    uint32_t tail;
+    bool busy;                      // an I/O of this endpoint is in the kernel
+    uint32_t gen;                   // incremented by a flush, completions of older I/O are dropped
+}emu_ep_t;
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t failed;
+    uint64_t bytes;
+    double us_sum;
+    double us_max;
+}emu_cmd_stats_t;
+
+static emu_ep_t emu_eps[EMU_EP_NBR];
+static int emu_ep0 = -1;
+static uint8_t emu_setup_type;      // bmRequestType of the control request in progress
+static bool emu_ep0_halted;
+
+static pthread_mutex_t emu_loop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t emu_loop_cond = PTHREAD_COND_INITIALIZER;
+static bool emu_loop_pending;
+
+static volatile sig_atomic_t emu_quit;
+static bool emu_keep_running;
+static bool emu_verbose;
+static FILE *emu_trace_fp;
+static struct timespec emu_t0;
+
+// Command in progress, CBW received -> CSW sent
+static struct
+{
+    bool active;
+    uint32_t tag;
+    uint8_t opcode;
+    uint32_t lba;
+    uint32_t blocks;
+    uint32_t data_len;
+    double t0;
+}emu_cmd;
+static emu_cmd_stats_t emu_cmd_stats[256];
+
+//-------------------------------------------------------
+
+static double _emu_now_us(void)
+{
+    struct timespec t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec - emu_t0.tv_sec) * 1e6 + (t.tv_nsec - emu_t0.tv_nsec) / 1e3;
+}
+
+static uint32_t _get_le32(const uint8_t *b)
+{
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint32_t _get_be32(const uint8_t *b)
+{
+    return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static const char *_emu_cmd_name(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case 0x00: return "TEST UNIT READY";
+    case 0x03: return "REQUEST SENSE";
+    case 0x12: return "INQUIRY";
+    case 0x1A: return "MODE SENSE6";
+    case 0x1B: return "START STOP UNIT";
+    case 0x1E: return "PREVENT REMOVAL";
+    case 0x23: return "READ FORMAT CAP";
+    case 0x25: return "READ CAPACITY10";
+    case 0x28: return "READ10";
+    case 0x2A: return "WRITE10";
+    case 0x2F: return "VERIFY10";
+    case 0x35: return "SYNC CACHE10";
+    case 0x5A: return "MODE SENSE10";
+    case 0x9E: return "READ CAPACITY16";
+    default:   return "other";
+    }
+}
+
+//-------------------------------------------------------
+// CBW-to-CSW tracing, called with the interrupt held
+
+static void _emu_trace_cbw(const uint8_t *b, uint32_t size)
+{
+    if (size != BOT_CBW_LENGTH || _get_le32(b) != BOT_CBW_SIGNATURE)
+    {
+        return;
+    }
+    
+    emu_cmd.active = true;
+    emu_cmd.tag = _get_le32(b + 4);
+    emu_cmd.data_len = _get_le32(b + 8);
+    emu_cmd.opcode = b[15];
+    emu_cmd.lba = 0;
+    emu_cmd.blocks = 0;
+    if (emu_cmd.opcode == 0x28 || emu_cmd.opcode == 0x2A || emu_cmd.opcode == 0x2F)
+    {
+        emu_cmd.lba = _get_be32(b + 17);
+        emu_cmd.blocks = (b[22] << 8) | b[23];
+    }
+    emu_cmd.t0 = _emu_now_us();
+}
+
+static void _emu_trace_csw(const uint8_t *b, uint32_t size)
+{
+    emu_cmd_stats_t *st;
+    uint32_t residue;
+    uint8_t status;
+    double us;
+    
+    if (size != BOT_CSW_LENGTH || _get_le32(b) != BOT_CSW_SIGNATURE ||
+        !emu_cmd.active || _get_le32(b + 4) != emu_cmd.tag)
+    {
+        return;
+    }
+    
+    emu_cmd.active = false;
+    residue = _get_le32(b + 8);
+    status = b[12];
+    us = _emu_now_us() - emu_cmd.t0;
+    
+    st = &emu_cmd_stats[emu_cmd.opcode];
+    st->count++;
+    st->failed += (status != 0);
+    st->bytes += emu_cmd.data_len - ((residue <= emu_cmd.data_len) ? residue : emu_cmd.data_len);
+    st->us_sum += us;
+    if (us > st->us_max)
+    {
+        st->us_max = us;
+    }
+    
+    if (emu_trace_fp)
+    {
+        fprintf(emu_trace_fp, "%.3f,%u,0x%02X,%u,%u,%u,%u,%u,%.1f\n", emu_cmd.t0 / 1000.0, emu_cmd.tag,
+                emu_cmd.opcode, emu_cmd.lba, emu_cmd.blocks, emu_cmd.data_len, residue, status, us);
+    }
+    if (emu_verbose)
+    {
+        printf("%-16s lba %6u blocks %4u status %u %9.1f us\n", _emu_cmd_name(emu_cmd.opcode),
+               emu_cmd.lba, emu_cmd.blocks, status, us);
+    }
+}
+
+static void _emu_summary(void)
+{
+    uint32_t i;
+    
+    printf("\n%-16s %7s %6s %10s %10s %8s\n", "command", "count", "failed", "avg us", "max us", "MB/s");
+    for (i = 0; i < 256; i++)
+    {
+        const emu_cmd_stats_t *st = &emu_cmd_stats[i];
+        
+        if (st->count == 0)
+        {
+            continue;
+        }
+        printf("%-16s %7u %6u %10.1f %10.1f", i == 0xFF ? "other" : _emu_cmd_name((uint8_t)i),
+               st->count, st->failed, st->us_sum / st->count, st->us_max);
+        if (st->bytes)
+        {
+            printf(" %8.3f", st->bytes / st->us_sum);        // bytes per us = MB/s
+        }
+        printf("\n");
+    }
+    if (emu_trace_fp)
+    {
+        fclose(emu_trace_fp);
+        emu_trace_fp = NULL;
+    }
+}
+
+void emu_device_reset(const char *reason, uint32_t vector)
+{
+    if (vector)
+    {
+        printf("device reset: %s (vector 0x%08X)\n", reason, (unsigned)vector);
+    }
+    else
+    {
+        printf("device reset: %s\n", reason);
+    }
+    if (!emu_keep_running)
+    {
+        _emu_summary();
+        exit(EXIT_SUCCESS);
+    }
+}
+
+//-------------------------------------------------------
+// Bulk endpoints: one thread each, the completion runs as the USB interrupt
+
+static emu_ep_t *_emu_ep(uint8_t addr)
+{
+    uint32_t i;
+    
+    for (i = 0; i < EMU_EP_NBR; i++)
+    {
+        if (emu_eps[i].addr == addr)
+        {
+            return &emu_eps[i];
+        }
+    }
+    printf("No endpoint 0x%02X\n", addr);
+    exit(EXIT_FAILURE);
+}
+
+static void _emu_ep_queue(uint8_t addr, emu_op_type_t type, uint8_t *buf, uint32_t size)
+{
+    emu_ep_t *ep = _emu_ep(addr);
+    
+    pthread_mutex_lock(&ep->lock);
+    if (ep->tail - ep->head < EMU_QUEUE_LEN)
+    {
+        ep->queue[ep->tail % EMU_QUEUE_LEN] = (emu_op_t){type, buf, size};
+        ep->tail++;
+        pthread_cond_signal(&ep->cond);
+    }
+    else
+    {
+        printf("Endpoint 0x%02X queue full\n", addr);
+    }
+    pthread_mutex_unlock(&ep->lock);
+}
+
+static void _emu_loop_wake(void)
+{
+    pthread_mutex_lock(&emu_loop_lock);
+    emu_loop_pending = true;
+    pthread_cond_signal(&emu_loop_cond);
+    pthread_mutex_unlock(&emu_loop_lock);
+}
+
+static void *_emu_ep_thread(void *arg)
+{
+    emu_ep_t *ep = (emu_ep_t *)arg;
+    emu_op_t op;
+    uint32_t gen;
+    uint8_t dummy = 0;
+    ssize_t n;
+    bool stale;
+    
+    for (;;)
+    {
+        pthread_mutex_lock(&ep->lock);
+        while (ep->head == ep->tail)
+        {
+            pthread_cond_wait(&ep->cond, &ep->lock);
+        }
+        op = ep->queue[ep->head % EMU_QUEUE_LEN];
+        ep->head++;
+        ep->busy = true;
+        gen = ep->gen;
+        pthread_mutex_unlock(&ep->lock);
+        
+        switch (op.type)
+        {
+        case EMU_OP_TX:
+            n = write(ep->fd, op.buf, op.size);
+            break;
+        case EMU_OP_RX:
+            n = read(ep->fd, op.buf, op.size);
+            break;
+        default:
+            // I/O in the wrong direction halts the endpoint (EBADMSG)
+            n = (ep->addr & 0x80) ? read(ep->fd, &dummy, 1) : write(ep->fd, &dummy, 1);
+            n = 0;
+            break;
+        }
+        
+        pthread_mutex_lock(&ep->lock);
+        ep->busy = false;
+        pthread_mutex_unlock(&ep->lock);
+        
+        if (n < 0)
+        {
+            if (errno != EINTR && errno != ESHUTDOWN)
+            {
+                printf("Endpoint 0x%02X: %s\n", ep->addr, strerror(errno));
+            }
+            continue;               // flushed, or the function was disabled
+        }
+        
+        emu_isr_enter();
+        pthread_mutex_lock(&ep->lock);
+        stale = (gen != ep->gen);
+        pthread_mutex_unlock(&ep->lock);
+        if (!stale)
+        {
+            switch (op.type)
+            {
+            case EMU_OP_TX:
+                _emu_trace_csw(op.buf, (uint32_t)n);
+                emu_device_in_done(ep->addr);
+                break;
+            case EMU_OP_RX:
+                _emu_trace_cbw(op.buf, (uint32_t)n);
+                emu_device_out_done(ep->addr, op.buf, (uint32_t)n);
+                break;
+            default:
+                emu_device_halt_cleared(ep->addr);
+                break;
+            }
+        }
+        emu_isr_leave();
+        _emu_loop_wake();
+    }
+    return NULL;
+}
+
+void emu_ep_transmit(uint8_t ep_addr, const uint8_t *buf, uint32_t size)
+{
+    _emu_ep_queue(ep_addr, EMU_OP_TX, (uint8_t *)buf, size);
+}
+
+void emu_ep_receive(uint8_t ep_addr, uint8_t *buf, uint32_t size)
+{
+    _emu_ep_queue(ep_addr, EMU_OP_RX, buf, size);
+}
+
+void emu_ep_stall(uint8_t ep_addr)
+{
+    _emu_ep_queue(ep_addr, EMU_OP_HALT, NULL, 0);
+}
+
+// Drop the queued transfers and abort the one in the kernel (FunctionFS dequeues on a signal)
+void emu_ep_flush(uint8_t ep_addr)
+{
+    emu_ep_t *ep = _emu_ep(ep_addr);
+    
+    pthread_mutex_lock(&ep->lock);
+    ep->gen++;
+    ep->head = ep->tail;
+    while (ep->busy)
+    {
+        pthread_kill(ep->thread, SIGUSR1);
+        pthread_mutex_unlock(&ep->lock);
+        usleep(100);
+        pthread_mutex_lock(&ep->lock);
+    }
+    pthread_mutex_unlock(&ep->lock);
+}
+
+//-------------------------------------------------------
+// ep0: FunctionFS does the status stage, a no-data request is acknowledged by a zero length read
+
+void emu_ep0_write(const uint8_t *buf, uint32_t size)
+{
+    uint8_t dummy;
+    
+    if (size == 0 && !(emu_setup_type & USB_DIR_IN))
+    {
+        if (read(emu_ep0, &dummy, 0) < 0)
+        {
+            printf("ep0 status: %s\n", strerror(errno));
+        }
+    }
+    else if (write(emu_ep0, buf, size) < 0)
+    {
+        printf("ep0 write: %s\n", strerror(errno));
+    }
+}
+
+uint32_t emu_ep0_read(uint8_t *buf, uint32_t size)
+{
+    ssize_t n = read(emu_ep0, buf, size);
+    
+    return (n < 0) ? 0 : (uint32_t)n;
+}
+
+// The core stalls both directions of ep0, FunctionFS stalls on I/O in the wrong direction
+void emu_ep0_stall(void)
+{
+    uint8_t dummy = 0;
+    ssize_t n;
+    
+    if (emu_ep0_halted)
+    {
+        return;
+    }
+    emu_ep0_halted = true;
+    n = (emu_setup_type & USB_DIR_IN) ? read(emu_ep0, &dummy, 0) : write(emu_ep0, &dummy, 0);
+    (void)n;
+}
+
+//-------------------------------------------------------
+
+static uint8_t *_put_le32(uint8_t *p, uint32_t v)
+{
+    *(uint32_t *)(void *)p = htole32(v);
+    return p + 4;
+}
+
+static bool _emu_write_descriptors(const char *ffs_dir)
+{
+    uint8_t fs[EMU_DESC_MAX], hs[EMU_DESC_MAX];
+    uint8_t buf[16 + 2 * EMU_DESC_MAX + 8];
+    uint8_t *p;
+    uint32_t len, i, count = 0, ep_nbr = 0;
+    char path[512];
+    
+    len = emu_device_interface(fs, hs);
+    fs[8] = hs[8] = 1;              // iInterface: first string of the function
+    
+    // Endpoint files are numbered in the order of the endpoint descriptors
+    for (i = 0; i < len; i += fs[i])
+    {
+        count++;
+        if (fs[i + 1] == USB_DT_ENDPOINT && ep_nbr < EMU_EP_NBR)
+        {
+            emu_eps[ep_nbr++].addr = fs[i + 2];
+        }
+    }
+    
+    p = _put_le32(buf, FUNCTIONFS_DESCRIPTORS_MAGIC_V2);
+    p = _put_le32(p, 20 + 2 * len);
+    p = _put_le32(p, FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC);
+    p = _put_le32(p, count);
+    p = _put_le32(p, count);
+    memcpy(p, fs, len);
+    memcpy(p + len, hs, len);
+    if (write(emu_ep0, buf, 20 + 2 * len) < 0)
+    {
+        printf("Write descriptors: %s\n", strerror(errno));
+        return false;
+    }
+    
+    p = _put_le32(buf, FUNCTIONFS_STRINGS_MAGIC);
+    p = _put_le32(p, 16 + 2 + sizeof(EMU_INTERFACE_NAME));
+    p = _put_le32(p, 1);            // strings
+    p = _put_le32(p, 1);            // languages
+    *p++ = 0x09;                    // en-US
+    *p++ = 0x04;
+    memcpy(p, EMU_INTERFACE_NAME, sizeof(EMU_INTERFACE_NAME));
+    if (write(emu_ep0, buf, 16 + 2 + sizeof(EMU_INTERFACE_NAME)) < 0)
+    {
+        printf("Write strings: %s\n", strerror(errno));
+        return false;
+    }
+    
+    for (i = 0; i < EMU_EP_NBR; i++)
+    {
+        emu_ep_t *ep = &emu_eps[i];
+        
+        snprintf(path, sizeof(path), "%s/ep%u", ffs_dir, (unsigned)(i + 1));
+        ep->fd = open(path, O_RDWR);
+        if (ep->fd < 0)
+        {
+            printf("Cannot open %s\n", path);
+            return false;
+        }
+        pthread_mutex_init(&ep->lock, NULL);
+        pthread_cond_init(&ep->cond, NULL);
+        pthread_create(&ep->thread, NULL, _emu_ep_thread, ep);
+    }
+    return true;
+}
+
+// main loop of main.c: after every interrupt and at least every 1ms
+static void *_emu_loop_thread(void *arg)
+{
+    struct timespec t;
+    
+    (void)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&emu_loop_lock);
+        if (!emu_loop_pending)
+        {
+            clock_gettime(CLOCK_REALTIME, &t);
+            t.tv_nsec += 1000000;
+            if (t.tv_nsec >= 1000000000)
+            {
+                t.tv_sec++;
+                t.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&emu_loop_cond, &emu_loop_lock, &t);
+        }
+        emu_loop_pending = false;
+        pthread_mutex_unlock(&emu_loop_lock);
+        
+        emu_device_poll();
+    }
+    return NULL;
+}
+
+static void _emu_ep0_events(void)
+{
+    struct usb_functionfs_event ev[4];
+    ssize_t n;
+    uint32_t i;
+    
+    while (!emu_quit)
+    {
+        n = read(emu_ep0, ev, sizeof(ev));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            printf("ep0: %s\n", strerror(errno));
+            return;
+        }
+        
+        for (i = 0; i < n / sizeof(ev[0]); i++)
+        {
+            switch (ev[i].type)
+            {
+            case FUNCTIONFS_BIND:
+                printf("bound to the UDC\n");
+                break;
+            case FUNCTIONFS_UNBIND:
+                printf("unbound\n");
+                break;
+            case FUNCTIONFS_ENABLE:
+                emu_isr_enter();
+                emu_device_enable();
+                emu_isr_leave();
+                printf("configured by the host\n");
+                break;
+            case FUNCTIONFS_DISABLE:
+                emu_isr_enter();
+                emu_device_disable();
+                emu_ep_flush(emu_eps[0].addr);
+                emu_ep_flush(emu_eps[1].addr);
+                emu_isr_leave();
+                printf("disabled\n");
+                break;
+            case FUNCTIONFS_SETUP:
+                emu_setup_type = ev[i].u.setup.bRequestType;
+                emu_ep0_halted = false;
+                emu_isr_enter();
+                emu_device_setup((const uint8_t *)&ev[i].u.setup);
+                emu_isr_leave();
+                break;
+            default:
+                break;
+            }
+        }
+        _emu_loop_wake();
+    }
+}
+
+static void _emu_signal(int sig)
+{
+    if (sig != SIGUSR1)
+    {
+        emu_quit = 1;
+    }
+}
+
+static void show_help(void)
+{
+    printf("USB level emulator for STM32 MSD bootloader, FunctionFS + dummy_hcd\n\n");
+    printf("Usage: usb_emu -f ffs_dir [-s flash.bin] [-t] [-e rule]... [-l trace.csv] [-v] [-k]\n");
+    printf("       -f ffs_dir    FunctionFS mount point of the gadget function (gadget.sh start)\n");
+    printf("       -s flash.bin  keep the 128KB flash in a file (created erased)\n");
+    printf("       -t            STM32F103 flash timing: 20ms page erase, 52us half-word program\n");
+    printf("       -e r:LBA[:N]  READ10 of LBA fails N times (default 1, 0 = always)\n");
+    printf("       -e w:LBA[:N]  WRITE10 of LBA fails N times\n");
+    printf("       -e n:N        the medium is not ready for the next N commands\n");
+    printf("       -e d:MS       every storage read/write takes MS longer\n");
+    printf("       -l trace.csv  one line per command: t_ms,tag,opcode,lba,blocks,data_len,residue,status,cbw_csw_us\n");
+    printf("       -v            print every command\n");
+    printf("       -k            keep running when the device would reset (hex session done)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *ffs_dir = NULL;
+    const char *flash_file = NULL;
+    const char *trace_file = NULL;
+    bool flash_timing = false;
+    char path[512];
+    struct sigaction sa;
+    sigset_t mask;
+    pthread_t loop_thread;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "f:s:te:l:vkh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f': ffs_dir = optarg; break;
+        case 's': flash_file = optarg; break;
+        case 't': flash_timing = true; break;
+        case 'l': trace_file = optarg; break;
+        case 'v': emu_verbose = true; break;
+        case 'k': emu_keep_running = true; break;
+        case 'e':
+            if (!emu_inject(optarg))
+            {
+                printf("Bad rule %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            show_help();
+            return EXIT_FAILURE;
+        }
+    }
+    if (ffs_dir == NULL)
+    {
+        show_help();
+        return EXIT_FAILURE;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    clock_gettime(CLOCK_MONOTONIC, &emu_t0);
+    
+    if (trace_file)
+    {
+        emu_trace_fp = fopen(trace_file, "w");
+        if (!emu_trace_fp)
+        {
+            printf("Cannot open %s\n", trace_file);
+            return EXIT_FAILURE;
+        }
+        fprintf(emu_trace_fp, "t_ms,tag,opcode,lba,blocks,data_len,residue,status,cbw_csw_us\n");
+    }
+    
+    // No SA_RESTART: SIGUSR1 aborts an endpoint I/O, SIGINT the ep0 read
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _emu_signal;
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    
+    if (!emu_board_init(flash_file, flash_timing) || !emu_device_init())
+    {
+        return EXIT_FAILURE;
+    }
+    
+    snprintf(path, sizeof(path), "%s/ep0", ffs_dir);
+    emu_ep0 = open(path, O_RDWR);
+    if (emu_ep0 < 0)
+    {
+        printf("Cannot open %s, is functionfs mounted?\n", path);
+        return EXIT_FAILURE;
+    }
+    
+    // SIGINT/SIGTERM go to the ep0 thread only
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    if (!_emu_write_descriptors(ffs_dir))
+    {
+        return EXIT_FAILURE;
+    }
+    pthread_create(&loop_thread, NULL, _emu_loop_thread, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+    
+    printf("descriptors written, bind the gadget to the UDC\n");
+    _emu_ep0_events();
+    
+    _emu_summary();
+    return EXIT_SUCCESS;
+}